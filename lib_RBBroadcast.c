@@ -0,0 +1,150 @@
+#include <string.h>
+#include "lib_RBBroadcast.h"
+
+#ifdef __GNUC__
+#define RB_BARRIER()	__sync_synchronize()
+#else
+#define RB_BARRIER()
+#endif
+
+
+
+int RB_BcInit(struct RB_Broadcast * bc, char * mem, long long size, struct RB_Buffer_Block * items, int item_size, int lag_limit)
+{
+	int i;
+
+	RB_init(&bc->buf);
+	if (mem != NULL && (items == NULL || !RB_Move(&bc->buf, mem, size, items, item_size))) return 0;
+	bc->tail = 0;
+	bc->head = 0;
+	bc->lag_limit = lag_limit;
+
+	for (i = 0; i < RB_BC_MAX_CONSUMERS; i++)
+	{
+		bc->cursor[i].seq = 0;
+		bc->cursor[i].active = 0;
+		bc->cursor[i].gen = 0;
+	}
+	return 1;
+}
+
+/*
+  消费者id对应的游标, 位置越界或代数不符(已注销后重新注册)时为NULL
+*/
+static struct RB_BcCursor * RB_BcCursorOf(struct RB_Broadcast * bc, int id, int * gen)
+{
+	struct RB_BcCursor * c;
+
+	if (id < 0) return NULL;
+	c = &bc->cursor[id % RB_BC_MAX_CONSUMERS];
+	*gen = id / RB_BC_MAX_CONSUMERS;
+	if (c->gen != *gen) return NULL;
+	return c;
+}
+
+int RB_BcAttach(struct RB_Broadcast * bc)
+{
+	int i;
+
+	for (i = 0; i < RB_BC_MAX_CONSUMERS; i++)
+	{
+		if (!bc->cursor[i].active)
+		{
+			bc->cursor[i].gen = (bc->cursor[i].gen + 1) & RB_BC_GEN_MASK;
+			bc->cursor[i].seq = bc->head;
+			RB_BARRIER();
+			bc->cursor[i].active = 1;
+			return bc->cursor[i].gen * RB_BC_MAX_CONSUMERS + i;
+		}
+	}
+	return -1;
+}
+
+int RB_BcDetach(struct RB_Broadcast * bc, int id)
+{
+	struct RB_BcCursor * c;
+	int gen;
+
+	if ((c = RB_BcCursorOf(bc, id, &gen)) == NULL || !c->active) return -1;
+	c->active = 0;
+	return 0;
+}
+
+/*
+  回收所有消费者都读过的记录
+*/
+static void RB_BcReclaim(struct RB_Broadcast * bc)
+{
+	unsigned long min = bc->head;
+	unsigned long seq;
+	int i;
+
+	for (i = 0; i < RB_BC_MAX_CONSUMERS; i++)
+	{
+		if (!bc->cursor[i].active) continue;
+		seq = bc->cursor[i].seq;
+		if (seq < min) min = seq;
+	}
+	RB_BARRIER();		//读完游标后才能覆盖数据
+
+	while (bc->tail < min)
+	{
+		RB_DropItem(&bc->buf);
+		bc->tail++;
+	}
+}
+
+/*
+  ring满时摘除落后过多的消费者
+*/
+static void RB_BcDetachLaggards(struct RB_Broadcast * bc)
+{
+	int i;
+
+	for (i = 0; i < RB_BC_MAX_CONSUMERS; i++)
+	{
+		if (bc->cursor[i].active && bc->head - bc->cursor[i].seq >= (unsigned long)bc->lag_limit)
+			bc->cursor[i].active = 0;
+	}
+}
+
+int RB_BcPublish(struct RB_Broadcast * bc, const char * data, int length)
+{
+	int n;
+
+	RB_BcReclaim(bc);
+	n = RB_write(&bc->buf, data, length);
+
+	if (n == 0 && bc->lag_limit > 0)
+	{
+		RB_BcDetachLaggards(bc);
+		RB_BcReclaim(bc);
+		n = RB_write(&bc->buf, data, length);
+	}
+
+	if (n > 0)
+	{
+		RB_BARRIER();	//数据写完再发布
+		bc->head++;
+	}
+	return n;
+}
+
+int RB_BcRead(struct RB_Broadcast * bc, int id, char * data, int SizeofData)
+{
+	struct RB_BcCursor * c;
+	unsigned long seq;
+	int len, gen;
+
+	if ((c = RB_BcCursorOf(bc, id, &gen)) == NULL || !c->active) return -1;
+	seq = c->seq;
+	if (seq == bc->head) return 0;
+	RB_BARRIER();		//先看到head, 再读数据
+
+	len = RB_CopyItem(&bc->buf, (int)(seq % bc->buf.item_size), data, SizeofData);
+
+	RB_BARRIER();		//数据读完再让出
+	if (!c->active || c->gen != gen) return -1;	//读的过程中被摘除, 数据可能已被覆盖
+	c->seq = seq + 1;
+	return len;
+}
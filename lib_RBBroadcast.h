@@ -0,0 +1,75 @@
+#ifndef _LIB_RBBROADCAST_H_
+#define _LIB_RBBROADCAST_H_
+
+#include "lib_RingBuffer.h"
+
+#define RB_BC_MAX_CONSUMERS	8	/*最多注册的消费者*/
+#define RB_BC_GEN_MASK		0xFFFFFF	/*消费者id = 代数 * RB_BC_MAX_CONSUMERS + 位置*/
+#define RB_CACHE_LINE		64
+
+#ifdef __GNUC__
+#define RB_CACHE_ALIGNED	__attribute__((aligned(RB_CACHE_LINE)))
+#else
+#define RB_CACHE_ALIGNED	/*其他编译器只靠填充, 不保证对齐*/
+#endif
+
+/**
+	广播ring: 生产者写入一次, 每个消费者有自己的读位置(各占一个对齐的cache line),
+	所有消费者都读过的记录才回收. 单生产者, 每个消费者一个线程.
+	消费者的注册/注销应在生产者开始写入之前(或在生产者线程中)完成.
+	动态分配RB_Broadcast时要按RB_CACHE_LINE对齐(posix_memalign), malloc不保证.
+**/
+
+struct RB_BcCursor {
+		volatile unsigned long	seq;	/*下一条要读的记录号*/
+		volatile int		active;	/*0--未注册或已被摘除*/
+		volatile int		gen;	/*每次注册加1, 旧的id随之失效*/
+		char	pad[RB_CACHE_LINE - sizeof(unsigned long) - 2 * sizeof(int)];
+} RB_CACHE_ALIGNED;
+
+struct RB_Broadcast {
+		struct RB_Buffer	buf;		/*记录的存储, 只有生产者修改*/
+		unsigned long		tail;		/*最早未回收的记录号*/
+		int			lag_limit;	/*ring满时摘除落后超过此记录数的消费者, 0--不摘除*/
+		char			pad0[RB_CACHE_LINE];
+
+		volatile unsigned long	head RB_CACHE_ALIGNED;	/*已发布的记录数*/
+		char			pad1[RB_CACHE_LINE - sizeof(unsigned long)];
+
+		struct RB_BcCursor	cursor[RB_BC_MAX_CONSUMERS];
+};
+
+/*初始化, 使用调用者提供的数据空间和记录表(见RB_Move, 只用其中2的幂部分),
+  mem为NULL时使用内置的空间(RB_BUFFER_SIZE字节, RB_Max_Items条). lag_limit见上. 1--成功 0--失败*/
+int   RB_BcInit(struct RB_Broadcast * bc, char * mem, long long size, struct RB_Buffer_Block * items, int item_size, int lag_limit);
+
+/*注册消费者, 从下一条发布的记录开始读, 返回消费者id(>=0), -1--已满.
+  id带有代数: 位置被注销后重新注册, 旧id不会读到新消费者的数据*/
+int   RB_BcAttach(struct RB_Broadcast * bc);
+
+/*注销消费者. 0--成功 -1--id无效(不是当前注册的消费者)*/
+int   RB_BcDetach(struct RB_Broadcast * bc, int id);
+
+/*发布一条记录, 返回写入长度, 0--ring满(最慢的消费者还没读完)*/
+int   RB_BcPublish(struct RB_Broadcast * bc, const char * data, int length);
+
+/*消费者读取下一条记录, 返回长度, 0--没有新记录, -1--已被摘除或id无效*/
+int   RB_BcRead(struct RB_Broadcast * bc, int id, char * data, int SizeofData);
+
+/**
+//例子：
+struct RB_Broadcast BC;
+static char mem[64*1024];
+static struct RB_Buffer_Block items[1024];
+char swap[32];
+int a,b;
+RB_BcInit(&BC,mem,sizeof(mem),items,1024,0);
+a=RB_BcAttach(&BC);
+b=RB_BcAttach(&BC);
+RB_BcPublish(&BC,"0123456789",10);
+RB_BcRead(&BC,a,swap,32);
+RB_BcRead(&BC,b,swap,32);
+
+**/
+
+#endif
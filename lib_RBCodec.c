@@ -0,0 +1,150 @@
+#include <string.h>
+#include "lib_RBCodec.h"
+
+
+
+const struct RB_Codec RB_LZCodec = { RB_LZCompress, RB_LZDecompress };
+
+/*取4字节做哈希*/
+static int RB_LZHash(const unsigned char * p)
+{
+	unsigned long v;
+
+	v = (unsigned long)p[0] | ((unsigned long)p[1] << 8)
+	  | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+	return (int)(((v * 2654435761UL) & 0xFFFFFFFFUL) >> (32 - RB_LZ_HASH_BITS));
+}
+
+/*长度扩展字节, 返回新的输出位置, -1--空间不够*/
+static int RB_LZLength(char * dst, int op, int dstcap, int n)
+{
+	if (op < 0) return -1;
+	while (n >= 255)
+	{
+		if (op >= dstcap) return -1;
+		dst[op++] = (char)255;
+		n -= 255;
+	}
+	if (op >= dstcap) return -1;
+	dst[op++] = (char)n;
+	return op;
+}
+
+/*输出一组 字面数据+匹配, mlen为0表示最后一组*/
+static int RB_LZSequence(char * dst, int op, int dstcap,
+			 const unsigned char * lit, int litlen, int offset, int mlen)
+{
+	int token;
+
+	if (op >= dstcap) return -1;
+	token = (litlen < 15 ? litlen : 15) << 4;
+	if (mlen > 0) token |= (mlen - RB_LZ_MIN_MATCH < 15) ? mlen - RB_LZ_MIN_MATCH : 15;
+	dst[op++] = (char)token;
+
+	if (litlen >= 15) op = RB_LZLength(dst, op, dstcap, litlen - 15);
+	if (op < 0 || op + litlen > dstcap) return -1;
+	memcpy(&dst[op], lit, litlen);
+	op += litlen;
+
+	if (mlen == 0) return op;
+
+	if (op + 2 > dstcap) return -1;
+	dst[op++] = (char)(offset & 0xFF);
+	dst[op++] = (char)((offset >> 8) & 0xFF);
+	if (mlen - RB_LZ_MIN_MATCH >= 15) op = RB_LZLength(dst, op, dstcap, mlen - RB_LZ_MIN_MATCH - 15);
+	return op;
+}
+
+/*
+  return 压缩后长度, 0--不可压缩或超过dstcap
+*/
+int RB_LZCompress(const char * src, int srclen, char * dst, int dstcap)
+{
+	unsigned short table[1 << RB_LZ_HASH_BITS];	/*位置+1, 0为空*/
+	const unsigned char * in = (const unsigned char *)src;
+	int ip = 0, anchor = 0, op = 0;
+	int h, ref, mlen;
+
+	if (srclen <= 0 || srclen > 65534) return 0;	//偏移只有2字节
+	memset(table, 0, sizeof(table));
+
+	while (ip + RB_LZ_MIN_MATCH <= srclen)
+	{
+		h = RB_LZHash(&in[ip]);
+		ref = (int)table[h] - 1;
+		table[h] = (unsigned short)(ip + 1);
+
+		if (ref < 0 || memcmp(&in[ref], &in[ip], RB_LZ_MIN_MATCH) != 0)
+		{
+			ip++;
+			continue;
+		}
+
+		mlen = RB_LZ_MIN_MATCH;
+		while (ip + mlen < srclen && in[ref + mlen] == in[ip + mlen]) mlen++;
+
+		op = RB_LZSequence(dst, op, dstcap, &in[anchor], ip - anchor, ip - ref, mlen);
+		if (op < 0) return 0;
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+	op = RB_LZSequence(dst, op, dstcap, &in[anchor], srclen - anchor, 0, 0);
+	return (op < 0) ? 0 : op;
+}
+
+/*
+  return 解压后长度(超过dstcap截断), -1--数据损坏
+*/
+int RB_LZDecompress(const char * src, int srclen, char * dst, int dstcap)
+{
+	const unsigned char * in = (const unsigned char *)src;
+	int ip = 0, op = 0;
+	int token, len, n, offset;
+
+	while (ip < srclen)
+	{
+		token = in[ip++];
+
+		len = token >> 4;
+		if (len == 15)
+		{
+			do {
+				if (ip >= srclen) return -1;
+				n = in[ip++];
+				len += n;
+			} while (n == 255);
+		}
+		if (ip + len > srclen) return -1;
+
+		n = (op + len > dstcap) ? dstcap - op : len;
+		memcpy(&dst[op], &in[ip], n);
+		op += n;
+		ip += len;
+		if (n < len) return op;		//输出已满
+
+		if (ip >= srclen) break;	//最后一组没有匹配
+
+		if (ip + 2 > srclen) return -1;
+		offset = in[ip] | (in[ip + 1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op) return -1;
+
+		len = (token & 15) + RB_LZ_MIN_MATCH;
+		if ((token & 15) == 15)
+		{
+			do {
+				if (ip >= srclen) return -1;
+				n = in[ip++];
+				len += n;
+			} while (n == 255);
+		}
+
+		for (n = 0; n < len && op < dstcap; n++, op++)
+			dst[op] = dst[op - offset];	//允许重叠, 逐字节复制
+		if (n < len) return op;
+	}
+
+	return op;
+}
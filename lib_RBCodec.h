@@ -0,0 +1,34 @@
+#ifndef _LIB_RBCODEC_H_
+#define _LIB_RBCODEC_H_
+
+#include "lib_RingBuffer.h"
+
+#define RB_LZ_HASH_BITS  8	/*匹配哈希表大小(2^n项), 占用栈空间 2*2^n 字节*/
+#define RB_LZ_MIN_MATCH  4
+
+/**
+	内置的LZ压缩, 无外部依赖, 适合文本/JSON类记录
+	格式: [token][字面长度扩展][字面数据][偏移2字节][匹配长度扩展] ...
+	token高4位为字面长度, 低4位为匹配长度-4, 为15时后续字节累加(255表示继续)
+	最后一组只有字面数据
+**/
+
+extern const struct RB_Codec RB_LZCodec;
+
+int   RB_LZCompress(const char * src, int srclen, char * dst, int dstcap);
+int   RB_LZDecompress(const char * src, int srclen, char * dst, int dstcap);
+
+/**
+//例子：
+struct RB_Buffer RBB;
+char swap[128];
+unsigned long raw,stored;
+RB_init(&RBB);
+RB_SetCodec(&RBB,&RB_LZCodec,32);
+RB_write(&RBB,"{\"id\":1,\"id\":1,\"id\":1,\"id\":1,\"id\":1}",36);
+RB_ReadItem(&RBB,swap,128);
+RB_GetCodecStats(&RBB,&raw,&stored);
+
+**/
+
+#endif
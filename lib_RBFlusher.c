@@ -0,0 +1,329 @@
+#ifdef __linux__
+#define _GNU_SOURCE		/*O_DIRECT, sync_file_range*/
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lib_RBFlusher.h"
+
+
+
+/*ring已过半, 需要尽快落盘*/
+static int RB_FlusherUrgent(struct RB_Flusher * fl)
+{
+	return (RB_COUNT(fl->buf) * 2 >= fl->buf->item_size
+		|| RB_USED(fl->buf) * 2 >= fl->buf->size);
+}
+
+/*
+  暂存区写入文件. tail=0 只写完整的块, tail=1 连同不足一块的尾部一起写
+  (O_DIRECT 时尾部补零到整块, 下次从同一块边界重写)
+  return 0--成功, 否则为errno(数据丢弃, 由调用者持锁记入fl->error)
+*/
+static int RB_FlusherOut(struct RB_Flusher * fl, int tail)
+{
+	int whole, len, out, done, n, err = 0;
+
+	whole = (fl->batch_fill / fl->block_size) * fl->block_size;
+	len = tail ? fl->batch_fill : whole;
+	if (len == 0 || (len <= fl->batch_done && whole == 0)) return 0;
+
+	out = len;
+	if (fl->flags & RB_FLUSH_DIRECT)
+	{
+		out = ((len + fl->block_size - 1) / fl->block_size) * fl->block_size;
+		memset(&fl->batch[len], 0, out - len);
+	}
+
+	for (done = 0; done < out; done += n)
+	{
+		n = pwrite(fl->fd, &fl->batch[done], out - done, fl->file_offset + done);
+		if (n < 0)
+		{
+			if (errno == EINTR) { n = 0; continue; }
+			err = errno;	//数据丢弃, 通过barrier报告
+			break;
+		}
+	}
+
+#ifdef SYNC_FILE_RANGE_WRITE
+	if ((fl->flags & RB_FLUSH_SYNCRANGE) && whole > 0)
+		sync_file_range(fl->fd, fl->file_offset, whole, SYNC_FILE_RANGE_WRITE);
+#endif
+
+	/*完整的块不再改写, 尾部移到暂存区开头*/
+	memmove(fl->batch, &fl->batch[whole], fl->batch_fill - whole);
+	fl->batch_fill -= whole;
+	fl->file_offset += whole;
+	fl->batch_done = len - whole;
+	return err;
+}
+
+static void * RB_FlusherThread(void * arg)
+{
+	struct RB_Flusher * fl = (struct RB_Flusher *)arg;
+	struct RB_Buffer * buf = fl->buf;
+	struct RB_Buffer_Block * item;
+	struct timespec ts, now;
+	unsigned long drained;
+	int len, more, tail, want_sync, stop, err;
+
+	pthread_mutex_lock(&fl->lock);
+	for (;;)
+	{
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += RB_FLUSH_INTERVAL_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+
+		while (fl->running
+			&& fl->flush_req <= fl->flush_seq
+			&& fl->sync_req <= fl->sync_seq
+			&& !RB_FlusherUrgent(fl))
+		{
+			if (pthread_cond_timedwait(&fl->wake, &fl->lock, &ts) == ETIMEDOUT) break;
+		}
+
+		/*合并帧要发布后才能取出: barrier/停止/ring过半时立即发布, 否则按帧超时(毫秒)*/
+		if (fl->flush_req > fl->flush_seq || fl->sync_req > fl->sync_seq || !fl->running || RB_FlusherUrgent(fl))
+			RB_FlushFrame(buf);
+		else
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			RB_PollFrame(buf, (unsigned long)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+		}
+
+		/*成批取出记录, 直到暂存区放不下*/
+		while (RB_COUNT(buf) > 0)
+		{
+			item = &buf->pitems[buf->item_read_index & buf->item_mask];
+			len = item->length;
+			if (item->flags & RB_Item_Packed) len = buf->codec_max;	//解压后不超过codec_max
+			if (fl->batch_fill + len > fl->batch_size) break;
+			fl->batch_fill += RB_ReadItem(buf, &fl->batch[fl->batch_fill], len);
+			fl->drain_seq++;
+		}
+
+		more = (RB_COUNT(buf) > 0);
+		drained = fl->drain_seq;
+		want_sync = (fl->sync_req > fl->sync_seq);
+		tail = (!more || want_sync || fl->flush_req > fl->flush_seq || !fl->running);
+		stop = (!fl->running && !more);
+		pthread_cond_broadcast(&fl->done);	/*ring腾出了空间*/
+		pthread_mutex_unlock(&fl->lock);
+
+		/*暂存区只有本线程访问, IO不持锁*/
+		err = RB_FlusherOut(fl, tail);
+		if (want_sync && fdatasync(fl->fd) < 0 && err == 0) err = errno;
+
+		pthread_mutex_lock(&fl->lock);
+		if (err != 0) fl->error = err;
+		if (tail) fl->flush_seq = drained;
+		if (want_sync) fl->sync_seq = drained;
+		pthread_cond_broadcast(&fl->done);
+		if (stop) break;
+	}
+	pthread_mutex_unlock(&fl->lock);
+
+	return NULL;
+}
+
+int RB_FlusherStart(struct RB_Flusher * fl, struct RB_Buffer * buf, const char * path, int flags)
+{
+	struct stat st;
+	void * mem;
+	int oflags = O_RDWR | O_CREAT;
+
+	memset(fl, 0, sizeof(*fl));
+	fl->buf = buf;
+	fl->flags = flags;
+
+#ifdef O_DIRECT
+	if (flags & RB_FLUSH_DIRECT)
+	{
+		fl->fd = open(path, oflags | O_DIRECT, 0644);
+		if (fl->fd < 0 && errno == EINVAL) fl->flags &= ~RB_FLUSH_DIRECT;	//文件系统不支持, 退回page cache
+	}
+	else
+#endif
+	{
+		fl->flags &= ~RB_FLUSH_DIRECT;
+		fl->fd = -1;
+	}
+	if (fl->fd < 0) fl->fd = open(path, oflags, 0644);
+	if (fl->fd < 0) return -1;
+
+	if (fstat(fl->fd, &st) < 0) goto fail;
+	fl->block_size = (st.st_blksize >= 512) ? (int)st.st_blksize : 4096;
+
+	/*暂存区: 批量 + 上次留下的尾块 + 一条最长记录, 再多一块用于补零*/
+	fl->batch_size = RB_FLUSH_BATCH;
+	if (fl->batch_size < buf->size + fl->block_size)	//记录长度为int, 暂存区最多1GB
+		fl->batch_size = (buf->size < RB_FLUSH_BATCH_MAX) ? (int)buf->size + fl->block_size : RB_FLUSH_BATCH_MAX;
+	if (fl->batch_size < RB_CODEC_RECORD_MAX + fl->block_size) fl->batch_size = RB_CODEC_RECORD_MAX + fl->block_size;	//解压后的记录
+	fl->batch_size = ((fl->batch_size + fl->block_size - 1) / fl->block_size) * fl->block_size;
+	if (posix_memalign(&mem, fl->block_size, fl->batch_size + fl->block_size) != 0) goto fail;
+	fl->batch = (char *)mem;
+
+	/*追加到已有文件之后: 不足一块的尾部读回暂存区*/
+	fl->file_offset = (st.st_size / fl->block_size) * fl->block_size;
+	fl->batch_fill = (int)(st.st_size - fl->file_offset);
+	if (fl->batch_fill > 0
+		&& pread(fl->fd, fl->batch, fl->block_size, fl->file_offset) < fl->batch_fill) goto fail;
+	fl->batch_done = fl->batch_fill;
+
+	pthread_mutex_init(&fl->lock, NULL);
+	pthread_mutex_init(&fl->resize_lock, NULL);
+	pthread_cond_init(&fl->wake, NULL);
+	pthread_cond_init(&fl->done, NULL);
+	fl->running = 1;
+
+	if (pthread_create(&fl->thread, NULL, RB_FlusherThread, fl) != 0)
+	{
+		pthread_cond_destroy(&fl->done);
+		pthread_cond_destroy(&fl->wake);
+		pthread_mutex_destroy(&fl->resize_lock);
+		pthread_mutex_destroy(&fl->lock);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	free(fl->batch);
+	fl->batch = NULL;
+	close(fl->fd);
+	fl->fd = -1;
+	return -1;
+}
+
+int RB_FlusherWrite(struct RB_Flusher * fl, const char * data, int length)
+{
+	int n = 0;
+
+	if (length <= 0 || length > fl->batch_size - fl->block_size) return 0;	//暂存区放不下的记录永远排不空
+
+	pthread_mutex_lock(&fl->lock);
+	while (length <= fl->buf->size			//ring放不下的记录等多久也写不进去(持锁检查: size可能被RB_FlusherResize改变)
+		&& (n = RB_write(fl->buf, data, length)) == 0 && fl->running)
+	{
+		pthread_cond_signal(&fl->wake);
+		pthread_cond_wait(&fl->done, &fl->lock);
+	}
+	if (n > 0)
+	{
+		fl->write_seq++;
+		if (RB_FlusherUrgent(fl)) pthread_cond_signal(&fl->wake);
+	}
+	pthread_mutex_unlock(&fl->lock);
+
+	return n;
+}
+
+int RB_FlusherFlush(struct RB_Flusher * fl)
+{
+	unsigned long target;
+	int ret;
+
+	pthread_mutex_lock(&fl->lock);
+	target = fl->write_seq;
+	if (fl->flush_req < target) fl->flush_req = target;
+	pthread_cond_signal(&fl->wake);
+	while (fl->flush_seq < target) pthread_cond_wait(&fl->done, &fl->lock);
+	ret = fl->error ? -1 : 0;
+	pthread_mutex_unlock(&fl->lock);
+
+	return ret;
+}
+
+int RB_FlusherSync(struct RB_Flusher * fl)
+{
+	unsigned long target;
+	int ret;
+
+	pthread_mutex_lock(&fl->lock);
+	target = fl->write_seq;
+	if (fl->sync_req < target) fl->sync_req = target;
+	pthread_cond_signal(&fl->wake);
+	while (fl->sync_seq < target) pthread_cond_wait(&fl->done, &fl->lock);
+	ret = fl->error ? -1 : 0;
+	pthread_mutex_unlock(&fl->lock);
+
+	return ret;
+}
+
+int RB_FlusherResize(struct RB_Flusher * fl, long long new_capacity, int new_items)
+{
+	struct RB_Buffer * buf = fl->buf;
+	struct RB_Buffer_Block * items, * old_items;
+	struct RB_MoveMark mark;
+	char * mem, * old_mem;
+	char owned;
+	int ok;
+
+	/*分配, 大块复制和释放都不持锁, 持锁期间只补上复制期间写入的部分*/
+	if (new_items <= 0) new_items = buf->item_size;
+	mem = (char *)RB_MALLOC(new_capacity);
+	items = (struct RB_Buffer_Block *)RB_MALLOC(new_items * sizeof(struct RB_Buffer_Block));
+	if (mem == NULL || items == NULL)
+	{
+		if (mem != NULL) RB_FREE(mem);
+		if (items != NULL) RB_FREE(items);
+		return 0;
+	}
+
+	pthread_mutex_lock(&fl->resize_lock);
+	pthread_mutex_lock(&fl->lock);
+	RB_MoveStart(buf, &mark);
+	pthread_mutex_unlock(&fl->lock);
+
+	RB_MoveCopy(buf, mem, new_capacity, items, new_items, &mark);
+
+	pthread_mutex_lock(&fl->lock);
+	old_mem = buf->pdata;
+	old_items = buf->pitems;
+	owned = buf->owned;
+	ok = RB_MoveFinish(buf, mem, new_capacity, items, new_items, &mark);
+	if (ok) buf->owned = 3;
+	pthread_cond_broadcast(&fl->done);	//变大后等待的生产者可以继续
+	pthread_mutex_unlock(&fl->lock);
+	pthread_mutex_unlock(&fl->resize_lock);
+
+	if (!ok)
+	{
+		RB_FREE(mem);
+		RB_FREE(items);
+		return 0;
+	}
+	if (owned & 1) RB_FREE(old_mem);
+	if (owned & 2) RB_FREE(old_items);
+	return 1;
+}
+
+void RB_FlusherStop(struct RB_Flusher * fl)
+{
+	pthread_mutex_lock(&fl->lock);
+	fl->running = 0;
+	pthread_cond_broadcast(&fl->wake);
+	pthread_cond_broadcast(&fl->done);
+	pthread_mutex_unlock(&fl->lock);
+
+	pthread_join(fl->thread, NULL);
+
+	/*O_DIRECT 补的零截掉, 截不掉时文件尾部留有补零*/
+	if ((fl->flags & RB_FLUSH_DIRECT) && ftruncate(fl->fd, fl->file_offset + fl->batch_fill) != 0)
+		fl->error = errno;
+
+	close(fl->fd);
+	fl->fd = -1;
+	free(fl->batch);
+	fl->batch = NULL;
+
+	pthread_cond_destroy(&fl->done);
+	pthread_cond_destroy(&fl->wake);
+	pthread_mutex_destroy(&fl->resize_lock);
+	pthread_mutex_destroy(&fl->lock);
+}
@@ -0,0 +1,79 @@
+#ifndef _LIB_RBFLUSHER_H_
+#define _LIB_RBFLUSHER_H_
+
+#include <pthread.h>
+#include "lib_RingBuffer.h"
+
+#define RB_FLUSH_DIRECT		0x01	/*O_DIRECT 直写, 绕过page cache*/
+#define RB_FLUSH_SYNCRANGE	0x02	/*sync_file_range 提前启动回写*/
+
+#define RB_FLUSH_BATCH		(64*1024)	/*单次落盘的最大批量*/
+#define RB_FLUSH_BATCH_MAX	(1<<30)		/*ring很大时暂存区的上限*/
+#define RB_FLUSH_INTERVAL_MS	10		/*无人唤醒时的落盘周期*/
+
+/**
+	后台落盘线程: 生产者写入ring, 线程成批取出记录,
+	按文件系统块大小对齐后顺序写入日志文件.
+	ring可以开启小记录合并(RB_SetCoalesce), 帧超时的单位为毫秒; barrier和停止时未满的帧立即发布
+**/
+
+struct RB_Flusher {
+		struct RB_Buffer * buf;	/*被排空的ring*/
+		int		fd;
+		int		flags;
+		int		block_size;	/*文件系统块大小*/
+		int		error;		/*最近一次IO错误(errno)*/
+		int		running;
+
+		char *		batch;		/*对齐的暂存区*/
+		int		batch_size;
+		int		batch_fill;	/*暂存区有效数据, 起始于file_offset*/
+		int		batch_done;	/*暂存区中已交给内核的部分*/
+		long long	file_offset;	/*已完整落盘的块边界*/
+
+		unsigned long	write_seq;	/*已写入ring的记录数*/
+		unsigned long	drain_seq;	/*已取入暂存区的记录数*/
+		unsigned long	flush_seq;	/*已交给内核的记录数*/
+		unsigned long	sync_seq;	/*已fdatasync的记录数*/
+		unsigned long	flush_req;	/*barrier请求*/
+		unsigned long	sync_req;
+
+		pthread_t	thread;
+		pthread_mutex_t	lock;
+		pthread_mutex_t	resize_lock;	/*RB_FlusherResize之间互斥*/
+		pthread_cond_t	wake;		/*生产者/barrier -> 落盘线程*/
+		pthread_cond_t	done;		/*落盘线程 -> 生产者/barrier*/
+};
+
+/*打开日志文件并启动落盘线程, 0--成功 -1--失败*/
+int   RB_FlusherStart(struct RB_Flusher * fl, struct RB_Buffer * buf, const char * path, int flags);
+
+/*写入一条记录, ring满时等待落盘线程腾出空间, 返回写入长度 0--失败(比ring或暂存区长的记录不等待, 直接失败)*/
+int   RB_FlusherWrite(struct RB_Flusher * fl, const char * data, int length);
+
+/*barrier: 之前写入的记录全部交给内核, 0--成功 -1--IO错误*/
+int   RB_FlusherFlush(struct RB_Flusher * fl);
+
+/*barrier: 之前写入的记录全部fdatasync到磁盘*/
+int   RB_FlusherSync(struct RB_Flusher * fl);
+
+/*运行中改变ring大小(见RB_Resize). 未读数据在锁外复制, 持锁期间只补上复制期间新写入的部分并切换,
+  写入方只等这一小段. new_items<=0 时记录表大小不变. 1--成功 0--放不下或分配失败*/
+int   RB_FlusherResize(struct RB_Flusher * fl, long long new_capacity, int new_items);
+
+/*排空剩余记录, 停止线程, 关闭文件. 之后fl->error非0表示有数据没能正确落盘*/
+void  RB_FlusherStop(struct RB_Flusher * fl);
+
+/**
+//例子：
+struct RB_Buffer RBB;
+struct RB_Flusher FL;
+RB_init(&RBB);
+RB_FlusherStart(&FL,&RBB,"app.log",RB_FLUSH_SYNCRANGE);
+RB_FlusherWrite(&FL,"0123456789\n",11);
+RB_FlusherSync(&FL);
+RB_FlusherStop(&FL);
+
+**/
+
+#endif
@@ -0,0 +1,192 @@
+#include <string.h>
+#include "lib_RBMux.h"
+
+
+static void RB_MuxDrain(struct RB_Mux * mux);
+static int RB_MuxRequeue(struct RB_Mux * mux);
+
+/*ring能放下的最长记录*/
+static int RB_MuxRecordMax(struct RB_Mux * mux)
+{
+	return (mux->buf->size < RB_CODEC_RECORD_MAX) ? (int)mux->buf->size : RB_CODEC_RECORD_MAX;
+}
+
+int RB_MuxInit(struct RB_Mux * mux, struct RB_Buffer * buf, int channels, long long quota)
+{
+	int i, n;
+
+	memset(mux, 0, sizeof(*mux));
+	if (channels <= 0 || RB_COUNT(buf) > 0) return 0;	//已有的记录不属于任何通道
+	if (buf->frame_limit > 0) return 0;			//合并帧里的记录没有自己的记录表项
+
+	/*每个通道都可能有一条记录停在ring里, 记录表按通道数扩大*/
+	for (n = 1; n < channels * RB_MUX_ITEMS_PER_CHANNEL; n <<= 1);
+	if (n > buf->item_size && !RB_Resize(buf, buf->size, n)) return 0;
+	n = buf->item_size;
+
+	mux->chan = (struct RB_MuxChannel *)RB_MALLOC(channels * sizeof(struct RB_MuxChannel));
+	mux->rec_chan = (int *)RB_MALLOC(n * sizeof(int));
+	mux->rec_next = (unsigned long long *)RB_MALLOC(n * sizeof(unsigned long long));
+	mux->rec_prev = (unsigned long long *)RB_MALLOC(n * sizeof(unsigned long long));
+	if (mux->chan == NULL || mux->rec_chan == NULL || mux->rec_next == NULL || mux->rec_prev == NULL)
+	{
+		RB_MuxFree(mux);
+		return 0;
+	}
+
+	for (i = 0; i < channels; i++)
+	{
+		mux->chan[i].head = 0;
+		mux->chan[i].tail = 0;
+		mux->chan[i].count = 0;
+		mux->chan[i].bytes = 0;
+		mux->chan[i].quota = quota;
+	}
+	for (i = 0; i < n; i++) mux->rec_chan[i] = -1;
+
+	mux->buf = buf;
+	mux->channels = channels;
+	mux->item_mask = buf->item_mask;
+	return 1;
+}
+
+void RB_MuxFree(struct RB_Mux * mux)
+{
+	if (mux->chan != NULL) RB_FREE(mux->chan);
+	if (mux->rec_chan != NULL) RB_FREE(mux->rec_chan);
+	if (mux->rec_next != NULL) RB_FREE(mux->rec_next);
+	if (mux->rec_prev != NULL) RB_FREE(mux->rec_prev);
+	mux->chan = NULL;
+	mux->rec_chan = NULL;
+	mux->rec_next = NULL;
+	mux->rec_prev = NULL;
+	mux->channels = 0;
+}
+
+void RB_MuxSetQuota(struct RB_Mux * mux, int ch, long long quota)
+{
+	if (ch >= 0 && ch < mux->channels) mux->chan[ch].quota = quota;
+}
+
+int RB_MuxWrite(struct RB_Mux * mux, int ch, const char * data, int length)
+{
+	struct RB_MuxChannel * c;
+	unsigned long long cursor;
+	int n, k, slot;
+
+	if (ch < 0 || ch >= mux->channels) return -1;
+	if (length <= 0 || length > RB_MuxRecordMax(mux)) return -1;	//永远写不进去的记录不必移动别的记录
+	c = &mux->chan[ch];
+	if (c->quota > 0 && c->bytes + length > c->quota) return -1;	//压缩后可能更小, 按原长度预估
+
+	cursor = mux->buf->item_write_index;
+	n = RB_write(mux->buf, data, length);
+
+	/*写不下时把挡在队首的未取出记录移到队尾, 让它后面已取出的记录出队*/
+	for (k = RB_COUNT(mux->buf); n == 0 && mux->done > 0 && k > 0; k--)
+	{
+		if (!RB_MuxRequeue(mux)) break;
+		cursor = mux->buf->item_write_index;
+		n = RB_write(mux->buf, data, length);
+	}
+	if (n == 0) return 0;
+
+	/*新记录接到通道链表尾部*/
+	slot = (int)(cursor & mux->item_mask);
+	mux->rec_chan[slot] = ch;
+	if (c->count > 0)
+	{
+		mux->rec_next[c->tail & mux->item_mask] = cursor;
+		mux->rec_prev[slot] = c->tail;
+	}
+	else c->head = cursor;
+	c->tail = cursor;
+	c->count++;
+	c->bytes += mux->buf->pitems[slot].length;
+
+	return n;
+}
+
+int RB_MuxRead(struct RB_Mux * mux, int ch, char * data, int SizeofData)
+{
+	struct RB_Buffer * buf = mux->buf;
+	struct RB_MuxChannel * c;
+	int slot, len;
+
+	if (ch < 0 || ch >= mux->channels || mux->chan[ch].count == 0) return 0;
+	c = &mux->chan[ch];
+
+	slot = (int)(c->head & mux->item_mask);
+	len = RB_CopyItem(buf, slot, data, SizeofData);
+
+	mux->rec_chan[slot] = -1;
+	c->bytes -= buf->pitems[slot].length;
+	c->head = mux->rec_next[slot];
+	c->count--;
+	mux->done++;
+
+	RB_MuxDrain(mux);
+	return len;
+}
+
+int RB_MuxReadAny(struct RB_Mux * mux, int * ch, char * data, int SizeofData)
+{
+	struct RB_Buffer * buf = mux->buf;
+
+	if (RB_COUNT(buf) <= 0) return 0;
+
+	/*队首总是未取出的记录; 该通道更早的记录若被移到了队尾, 按通道内顺序先取那条*/
+	*ch = mux->rec_chan[buf->item_read_index & mux->item_mask];
+	return RB_MuxRead(mux, *ch, data, SizeofData);
+}
+
+int RB_MuxPending(struct RB_Mux * mux, int ch)
+{
+	if (ch < 0 || ch >= mux->channels) return 0;
+	return mux->chan[ch].count;
+}
+
+/*
+  队首及其后已取出的记录出队, 释放空间
+*/
+static void RB_MuxDrain(struct RB_Mux * mux)
+{
+	struct RB_Buffer * buf = mux->buf;
+
+	while (RB_COUNT(buf) > 0 && mux->rec_chan[buf->item_read_index & mux->item_mask] < 0)
+	{
+		RB_DropItem(buf);
+		mux->done--;
+	}
+}
+
+/*
+  把队首(未取出)的记录移到队尾, 改链表中指向它的游标, 再让出已取出的记录
+  return 1--已移动 0--不能移动
+*/
+static int RB_MuxRequeue(struct RB_Mux * mux)
+{
+	struct RB_Buffer * buf = mux->buf;
+	unsigned long long from = buf->item_read_index;
+	unsigned long long to = buf->item_write_index;
+	int slot = (int)(from & mux->item_mask);
+	int ch = mux->rec_chan[slot];
+	unsigned long long prev = mux->rec_prev[slot];
+	unsigned long long next = mux->rec_next[slot];
+	struct RB_MuxChannel * c = &mux->chan[ch];
+
+	if (!RB_Requeue(buf)) return 0;
+
+	mux->rec_chan[slot] = -1;			//记录表满时新旧表项是同一个
+	slot = (int)(to & mux->item_mask);
+	mux->rec_chan[slot] = ch;
+	mux->rec_prev[slot] = prev;
+	mux->rec_next[slot] = next;
+	if (c->head == from) c->head = to;
+	else mux->rec_next[prev & mux->item_mask] = to;
+	if (c->tail == from) c->tail = to;
+	else mux->rec_prev[next & mux->item_mask] = to;
+
+	RB_MuxDrain(mux);
+	return 1;
+}
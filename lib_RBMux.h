@@ -0,0 +1,76 @@
+#ifndef _LIB_RBMUX_H_
+#define _LIB_RBMUX_H_
+
+#include "lib_RingBuffer.h"
+
+/**
+	多路复用: 很多逻辑通道共用一个ring, 每条记录带通道号.
+	每个通道把自己的记录按写入顺序串成链表(链接存在与记录表平行的数组中),
+	所以可以O(1)取出指定通道的下一条记录, 不用扫描.
+	先取出的非队首记录只做标记, 队首记录被取出时连同后面已取出的一起出队释放空间.
+	空闲通道的未取出记录停在队首会挡住后面已取出记录的空间: 写不下时把这样的队首记录
+	原样移到队尾(RB_Requeue), 再让出已取出的记录, 所以只有未取出的记录占用ring.
+	每个通道有字节配额(按ring中的占用计), 一个通道写得多不会占满ring.
+	记录表至少为 通道数*RB_MUX_ITEMS_PER_CHANNEL 项(不够时RB_MuxInit用RB_Resize扩大),
+	ring不要开启小记录合并, 使用期间不要RB_Resize(记录表大小不能变).
+**/
+
+#define RB_MUX_ITEMS_PER_CHANNEL 2	/*记录表项数至少为通道数的几倍*/
+
+struct RB_MuxChannel {
+		unsigned long long	head;		/*最早未取出记录的游标*/
+		unsigned long long	tail;		/*最新记录的游标*/
+		int			count;		/*未取出的记录数*/
+		long long		bytes;		/*未取出记录占用的字节数*/
+		long long		quota;		/*bytes的上限, 0--不限*/
+};
+
+struct RB_Mux {
+		struct RB_Buffer *	buf;
+		int			channels;
+		struct RB_MuxChannel *	chan;
+		int *			rec_chan;	/*每个记录表项所属的通道, -1--已取出*/
+		unsigned long long *	rec_next;	/*同一通道下一条记录的游标*/
+		unsigned long long *	rec_prev;	/*同一通道上一条记录的游标(移动记录时改链接用)*/
+		int			done;		/*已取出但还没出队的记录数*/
+		unsigned long long	item_mask;	/*初始化时的记录表大小-1*/
+};
+
+/*在已初始化的空ring上建立channels个通道, quota为每个通道的默认配额(0--不限).
+  记录表不够大时扩大. 1--成功 0--失败*/
+int   RB_MuxInit(struct RB_Mux * mux, struct RB_Buffer * buf, int channels, long long quota);
+
+/*释放通道表(ring不释放)*/
+void  RB_MuxFree(struct RB_Mux * mux);
+
+/*设置单个通道的配额, 0--不限*/
+void  RB_MuxSetQuota(struct RB_Mux * mux, int ch, long long quota);
+
+/*向通道ch写入一条记录, 返回写入长度, 0--ring满,
+  -1--超出通道配额, 通道号无效, 或长度不在1..min(ring大小, RB_CODEC_RECORD_MAX)内*/
+int   RB_MuxWrite(struct RB_Mux * mux, int ch, const char * data, int length);
+
+/*取出通道ch的下一条记录, 超过SizeofData的部分截断, 返回复制长度, 0--该通道没有记录*/
+int   RB_MuxRead(struct RB_Mux * mux, int ch, char * data, int SizeofData);
+
+/*按写入顺序(被移到队尾的记录按通道内顺序提前)取出任意通道的下一条记录, *ch返回其通道号. 返回复制长度, 0--ring空*/
+int   RB_MuxReadAny(struct RB_Mux * mux, int * ch, char * data, int SizeofData);
+
+/*通道ch未取出的记录数*/
+int   RB_MuxPending(struct RB_Mux * mux, int ch);
+
+/**
+//例子：
+struct RB_Buffer RBB;
+struct RB_Mux MX;
+char swap[32];
+RB_init(&RBB);
+RB_MuxInit(&MX,&RBB,1000,64);
+RB_MuxWrite(&MX,7,"0123456789",10);
+RB_MuxWrite(&MX,3,"abc",3);
+RB_MuxRead(&MX,3,swap,32);	//"abc", 不必先取出通道7的记录
+RB_MuxFree(&MX);
+
+**/
+
+#endif
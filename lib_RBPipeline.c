@@ -0,0 +1,321 @@
+#ifdef __linux__
+#define _GNU_SOURCE		/*pthread_setaffinity_np*/
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include "lib_RBPipeline.h"
+
+
+
+static unsigned long long RB_PipeNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*下游ring能放下的最长记录*/
+static int RB_PipeRecordMax(struct RB_PipeLink * link)
+{
+	return (link->buf->size < RB_PIPE_RECORD_MAX) ? (int)link->buf->size : RB_PIPE_RECORD_MAX;
+}
+
+/*
+  输出批写入下游, 一次持锁写完. 下游满时等待, 返回等待的时间
+*/
+static unsigned long long RB_PipeEmit(struct RB_PipeLink * out, const char * data, const int * lens, int n)
+{
+	unsigned long long stall = 0, t0;
+	int i, off = 0;
+
+	pthread_mutex_lock(&out->lock);
+	for (i = 0; i < n; off += lens[i++])
+	{
+		while (RB_write(out->buf, &data[off], lens[i]) == 0)
+		{
+			/*先让下游看到已写入的部分, 再等它腾出空间*/
+			pthread_cond_signal(&out->not_empty);
+			t0 = RB_PipeNow();
+			pthread_cond_wait(&out->not_full, &out->lock);
+			stall += RB_PipeNow() - t0;
+		}
+	}
+	pthread_cond_signal(&out->not_empty);
+	pthread_mutex_unlock(&out->lock);
+
+	return stall;
+}
+
+static void * RB_PipeThread(void * arg)
+{
+	struct RB_PipeStage * st = (struct RB_PipeStage *)arg;
+	struct RB_PipeLink * in = st->in;
+	struct RB_PipeLink * out = st->out;
+	struct RB_Buffer_Block * item;
+	struct RB_PipeStats got;
+	char * inb = st->scratch;
+	char * outb = st->scratch + RB_PIPE_SCRATCH;
+	int inlen[RB_PIPE_BATCH_MAX], outlen[RB_PIPE_BATCH_MAX];
+	int n, i, len, depth, fill, ofill, on, outcap, r;
+	unsigned long long t0, busy;
+
+#ifdef __linux__
+	if (st->cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(st->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) st->cpu = -1;	//没有这个CPU, 不绑定
+	}
+#else
+	st->cpu = -1;
+#endif
+
+	outcap = out ? RB_PipeRecordMax(out) : 0;
+
+	pthread_mutex_lock(&in->lock);
+	for (;;)
+	{
+		while (RB_COUNT(in->buf) == 0 && !in->closed) pthread_cond_wait(&in->not_empty, &in->lock);
+		if (RB_COUNT(in->buf) == 0) break;	//上游已结束且排空
+
+		/*成批取出, 直到批量或暂存区用完*/
+		depth = RB_COUNT(in->buf);
+		for (n = 0, fill = 0; n < st->stats.batch && RB_COUNT(in->buf) > 0; n++)
+		{
+			item = &in->buf->pitems[in->buf->item_read_index & in->buf->item_mask];
+			len = item->length;
+			if (item->flags & RB_Item_Packed) len = in->buf->codec_max;	//解压后不超过codec_max
+			if (n > 0 && fill + len > RB_PIPE_SCRATCH) break;
+			inlen[n] = RB_ReadItem(in->buf, &inb[fill], RB_PIPE_SCRATCH - fill);
+			fill += inlen[n];
+		}
+
+		/*批量跟随队列深度: 取完仍有积压则翻倍, 不到一半则减半*/
+		if (depth > st->stats.batch && st->stats.batch < RB_PIPE_BATCH_MAX) st->stats.batch *= 2;
+		else if (depth * 2 < st->stats.batch) st->stats.batch /= 2;
+
+		pthread_cond_broadcast(&in->not_full);	/*输入ring腾出了空间*/
+		pthread_mutex_unlock(&in->lock);
+
+		/*回调和写下游都不持输入锁*/
+		memset(&got, 0, sizeof(got));
+		t0 = RB_PipeNow();
+		busy = 0;
+		for (i = 0, fill = 0, ofill = 0, on = 0; i < n; fill += inlen[i++])
+		{
+			if (out && ofill + outcap > RB_PIPE_SCRATCH)
+			{
+				busy += RB_PipeNow() - t0;
+				got.stall_ns += RB_PipeEmit(out, outb, outlen, on);
+				got.out += on;
+				ofill = on = 0;
+				t0 = RB_PipeNow();
+			}
+
+			r = st->fn(st->ctx, &inb[fill], inlen[i], out ? &outb[ofill] : NULL, outcap);
+			if (r < 0 || r > outcap) got.errors++;		//超长的输出已越界或被截断, 不能往下传
+			else if (r > 0)
+			{
+				outlen[on++] = r;
+				ofill += r;
+			}
+		}
+		busy += RB_PipeNow() - t0;
+		if (on > 0)
+		{
+			got.stall_ns += RB_PipeEmit(out, outb, outlen, on);
+			got.out += on;
+		}
+
+		pthread_mutex_lock(&in->lock);
+		st->stats.records += n;
+		st->stats.bytes += fill;
+		st->stats.out += got.out;
+		st->stats.errors += got.errors;
+		st->stats.batches++;
+		st->stats.busy_ns += busy;
+		if (busy > st->stats.max_ns) st->stats.max_ns = busy;
+		st->stats.stall_ns += got.stall_ns;
+	}
+	pthread_mutex_unlock(&in->lock);
+
+	/*本阶段结束, 下游排空后也结束*/
+	if (out)
+	{
+		pthread_mutex_lock(&out->lock);
+		out->closed = 1;
+		pthread_cond_broadcast(&out->not_empty);
+		pthread_mutex_unlock(&out->lock);
+	}
+
+	return NULL;
+}
+
+void RB_PipeInit(struct RB_Pipeline * pipe)
+{
+	memset(pipe, 0, sizeof(*pipe));
+}
+
+int RB_PipeAddStage(struct RB_Pipeline * pipe, struct RB_Buffer * in, RB_PipeFunc fn, void * ctx, int cpu)
+{
+	struct RB_PipeStage * st;
+	int k = pipe->stages;
+
+	if (pipe->running || k >= RB_PIPE_MAX_STAGES || in == NULL || fn == NULL) return -1;
+
+	pipe->link[k].buf = in;
+	st = &pipe->stage[k];
+	st->pipe = pipe;
+	st->index = k;
+	st->fn = fn;
+	st->ctx = ctx;
+	st->cpu = cpu;
+	pipe->stages++;
+
+	return k;
+}
+
+int RB_PipeStart(struct RB_Pipeline * pipe)
+{
+	struct RB_PipeStage * st;
+	int k;
+
+	if (pipe->running || pipe->stages == 0) return -1;
+
+	for (k = 0; k < pipe->stages; k++)
+	{
+		st = &pipe->stage[k];
+		st->in = &pipe->link[k];
+		st->out = (k + 1 < pipe->stages) ? &pipe->link[k + 1] : NULL;
+		st->scratch = (char *)malloc(2 * RB_PIPE_SCRATCH);
+		memset(&st->stats, 0, sizeof(st->stats));
+		st->stats.batch = 1;
+
+		pthread_mutex_init(&pipe->link[k].lock, NULL);
+		pthread_cond_init(&pipe->link[k].not_empty, NULL);
+		pthread_cond_init(&pipe->link[k].not_full, NULL);
+		pipe->link[k].closed = 0;
+	}
+
+	for (k = 0; k < pipe->stages; k++)
+	{
+		if (pipe->stage[k].scratch == NULL) goto fail;
+	}
+
+	/*从最后一个阶段启动: 失败时已启动的阶段都在下游, 关闭其输入即可退出*/
+	for (k = pipe->stages - 1; k >= 0; k--)
+	{
+		if (pthread_create(&pipe->stage[k].thread, NULL, RB_PipeThread, &pipe->stage[k]) != 0) break;
+	}
+	if (k < 0)
+	{
+		pipe->stopping = 0;
+		pipe->running = 1;
+		return 0;
+	}
+
+	if (++k < pipe->stages)
+	{
+		pthread_mutex_lock(&pipe->link[k].lock);
+		pipe->link[k].closed = 1;
+		pthread_cond_broadcast(&pipe->link[k].not_empty);
+		pthread_mutex_unlock(&pipe->link[k].lock);
+	}
+	for (; k < pipe->stages; k++)
+	{
+		pthread_join(pipe->stage[k].thread, NULL);
+	}
+
+fail:
+	for (k = 0; k < pipe->stages; k++)
+	{
+		free(pipe->stage[k].scratch);
+		pipe->stage[k].scratch = NULL;
+		pthread_cond_destroy(&pipe->link[k].not_full);
+		pthread_cond_destroy(&pipe->link[k].not_empty);
+		pthread_mutex_destroy(&pipe->link[k].lock);
+	}
+	return -1;
+}
+
+int RB_PipePush(struct RB_Pipeline * pipe, const char * data, int length)
+{
+	struct RB_PipeLink * in = &pipe->link[0];
+	int n = 0;
+
+	if (length <= 0) return 0;
+
+	/*先登记再看状态: RB_PipeStop置stopping之后等登记的都离开, 之后登记的看到stopping不碰锁*/
+	__sync_add_and_fetch(&pipe->pushers, 1);
+	if (pipe->running && !pipe->stopping && length <= RB_PipeRecordMax(in))	//放不进第一个ring的记录永远写不进去
+	{
+		pthread_mutex_lock(&in->lock);
+		while (!in->closed && (n = RB_write(in->buf, data, length)) == 0)
+		{
+			pthread_cond_signal(&in->not_empty);
+			pthread_cond_wait(&in->not_full, &in->lock);
+		}
+		if (n > 0) pthread_cond_signal(&in->not_empty);
+		pthread_mutex_unlock(&in->lock);
+	}
+	__sync_sub_and_fetch(&pipe->pushers, 1);
+
+	return n;
+}
+
+int RB_PipeGetStats(struct RB_Pipeline * pipe, int stage, struct RB_PipeStats * stats)
+{
+	struct RB_PipeStage * st;
+
+	if (stage < 0 || stage >= pipe->stages) return -1;
+	st = &pipe->stage[stage];
+
+	if (!pipe->running)
+	{
+		*stats = st->stats;
+		return 0;
+	}
+
+	pthread_mutex_lock(&st->in->lock);
+	*stats = st->stats;
+	pthread_mutex_unlock(&st->in->lock);
+	return 0;
+}
+
+void RB_PipeStop(struct RB_Pipeline * pipe)
+{
+	struct RB_PipeLink * in = &pipe->link[0];
+	int k;
+
+	if (!pipe->running) return;
+
+	__sync_lock_test_and_set(&pipe->stopping, 1);
+	pthread_mutex_lock(&in->lock);
+	in->closed = 1;
+	pthread_cond_broadcast(&in->not_empty);
+	pthread_cond_broadcast(&in->not_full);	//等待中的RB_PipePush返回0
+	pthread_mutex_unlock(&in->lock);
+
+	/*每个阶段排空输入后关闭自己的输出, 逐级退出*/
+	for (k = 0; k < pipe->stages; k++)
+	{
+		pthread_join(pipe->stage[k].thread, NULL);
+	}
+
+	/*还在RB_PipePush里的调用者已被唤醒(in->closed), 等它们放开锁*/
+	while (pipe->pushers > 0) sched_yield();
+	pipe->running = 0;
+
+	for (k = 0; k < pipe->stages; k++)
+	{
+		free(pipe->stage[k].scratch);
+		pipe->stage[k].scratch = NULL;
+		pthread_cond_destroy(&pipe->link[k].not_full);
+		pthread_cond_destroy(&pipe->link[k].not_empty);
+		pthread_mutex_destroy(&pipe->link[k].lock);
+	}
+}
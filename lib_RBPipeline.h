@@ -0,0 +1,104 @@
+#ifndef _LIB_RBPIPELINE_H_
+#define _LIB_RBPIPELINE_H_
+
+#include <pthread.h>
+#include "lib_RingBuffer.h"
+
+#define RB_PIPE_MAX_STAGES	8		/*最多的阶段数*/
+#define RB_PIPE_BATCH_MAX	64		/*一批最多取出的记录数*/
+#define RB_PIPE_RECORD_MAX	4096		/*回调输出一条记录的最大长度(还受下游ring大小限制)*/
+#define RB_PIPE_SCRATCH		(RB_PIPE_BATCH_MAX * RB_PIPE_RECORD_MAX)	/*每个阶段输入/输出暂存区大小*/
+
+/**
+	多阶段流水线: 每个阶段一个线程, 从自己的输入ring成批取出记录,
+	逐条交给回调处理, 输出成批写入下一阶段的ring.
+	下游ring满时阶段阻塞, 输入ring随之积压, 反压一直传到RB_PipePush.
+	批量随队列深度自动调整: 积压时翻倍, 队列变浅时减半.
+	ring由调用者初始化, 不要开启小记录合并(RB_SetCoalesce).
+**/
+
+/*阶段回调: 处理一条记录, 输出写入out(最多outcap字节), 返回输出长度
+  0--没有输出(过滤掉), <0或>outcap--出错(记录丢弃, 计入errors). 最后一个阶段out为NULL, outcap为0*/
+typedef int (*RB_PipeFunc)(void * ctx, const char * in, int inlen, char * out, int outcap);
+
+/*阶段计数, 时间单位为纳秒*/
+struct RB_PipeStats {
+		unsigned long long	records;	/*取出的记录数*/
+		unsigned long long	bytes;		/*取出的字节数*/
+		unsigned long long	out;		/*写入下游的记录数*/
+		unsigned long long	errors;		/*回调出错(返回<0或超过outcap)的次数*/
+		unsigned long long	batches;	/*批次数*/
+		unsigned long long	busy_ns;	/*回调耗时合计, busy_ns/records为平均处理延迟*/
+		unsigned long long	max_ns;		/*单批回调耗时的最大值*/
+		unsigned long long	stall_ns;	/*因下游满而等待的时间(反压)*/
+		int			batch;		/*当前批量*/
+};
+
+/*两个阶段之间的连接*/
+struct RB_PipeLink {
+		struct RB_Buffer *	buf;
+		int			closed;		/*上游已结束, 排空后下游退出*/
+		pthread_mutex_t		lock;
+		pthread_cond_t		not_empty;	/*上游 -> 下游*/
+		pthread_cond_t		not_full;	/*下游 -> 上游*/
+};
+
+struct RB_PipeStage {
+		struct RB_Pipeline *	pipe;
+		int			index;
+		RB_PipeFunc		fn;
+		void *			ctx;
+		int			cpu;		/*绑定的CPU, -1--不绑定或绑定失败*/
+		struct RB_PipeLink *	in;
+		struct RB_PipeLink *	out;		/*最后一个阶段为NULL*/
+		char *			scratch;	/*输入批 + 输出批*/
+		struct RB_PipeStats	stats;		/*在in->lock下更新*/
+		pthread_t		thread;
+};
+
+struct RB_Pipeline {
+		int			stages;
+		int			running;
+		volatile int		stopping;	/*RB_PipeStop已开始, RB_PipePush不再进入*/
+		volatile int		pushers;	/*正在RB_PipePush中的调用者, RB_PipeStop等它们离开后才销毁锁*/
+		struct RB_PipeLink	link[RB_PIPE_MAX_STAGES];	/*link[k]是阶段k的输入*/
+		struct RB_PipeStage	stage[RB_PIPE_MAX_STAGES];
+};
+
+/*初始化一条空流水线*/
+void  RB_PipeInit(struct RB_Pipeline * pipe);
+
+/*追加一个阶段, in为其输入ring(即上一阶段的输出), cpu<0不绑定. 返回阶段号, -1--失败*/
+int   RB_PipeAddStage(struct RB_Pipeline * pipe, struct RB_Buffer * in, RB_PipeFunc fn, void * ctx, int cpu);
+
+/*启动所有阶段的线程, 0--成功 -1--失败*/
+int   RB_PipeStart(struct RB_Pipeline * pipe);
+
+/*向第一个阶段写入一条记录, 流水线满时等待, 返回写入长度 0--未启动/已停止或记录太长
+  可以和RB_PipeStop并发(返回0), 但不能和RB_PipeStart/RB_PipeInit并发*/
+int   RB_PipePush(struct RB_Pipeline * pipe, const char * data, int length);
+
+/*阶段计数快照, 不能和RB_PipeStop并发. 0--成功 -1--没有这个阶段*/
+int   RB_PipeGetStats(struct RB_Pipeline * pipe, int stage, struct RB_PipeStats * stats);
+
+/*不再接收新记录, 逐级排空后停止所有线程*/
+void  RB_PipeStop(struct RB_Pipeline * pipe);
+
+/**
+//例子：
+struct RB_Buffer A, B;
+struct RB_Pipeline P;
+int parse(void * ctx, const char * in, int len, char * out, int cap);
+int store(void * ctx, const char * in, int len, char * out, int cap);
+RB_init(&A);
+RB_init(&B);
+RB_PipeInit(&P);
+RB_PipeAddStage(&P,&A,parse,NULL,0);
+RB_PipeAddStage(&P,&B,store,NULL,1);
+RB_PipeStart(&P);
+RB_PipePush(&P,"0123456789",10);
+RB_PipeStop(&P);
+
+**/
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include "lib_RBPriority.h"
+
+
+
+/*最低的置位*/
+static int RB_PrioFirst(unsigned int mask)
+{
+#ifdef __GNUC__
+	return __builtin_ctz(mask);
+#else
+	int n = 0;
+	while ((mask & 1) == 0) { mask >>= 1; n++; }
+	return n;
+#endif
+}
+
+/*WRR新一轮: 重新发放配额*/
+static void RB_PrioRefill(struct RB_Priority * p)
+{
+	int i;
+
+	p->credited = 0;
+	for (i = 0; i < RB_PRIO_LANES; i++)
+	{
+		p->credit[i] = p->weight[i];
+		if (p->credit[i] > 0) p->credited |= 1u << i;
+	}
+}
+
+void RB_PrioInit(struct RB_Priority * p, int mode, const int * weights)
+{
+	int i;
+
+	for (i = 0; i < RB_PRIO_LANES; i++)
+	{
+		RB_init(&p->lane[i]);
+		p->weight[i] = (weights != NULL) ? weights[i] : 1;
+	}
+	p->nonempty = 0;
+	p->mode = mode;
+	RB_PrioRefill(p);
+}
+
+int RB_PrioWrite(struct RB_Priority * p, int lane, const char * data, int length)
+{
+	int n;
+
+	if (lane < 0 || lane >= RB_PRIO_LANES) return 0;
+
+	n = RB_write(&p->lane[lane], data, length);
+	if (n > 0) p->nonempty |= 1u << lane;
+	return n;
+}
+
+int RB_PrioRead(struct RB_Priority * p, char * data, int SizeofData, int * lane)
+{
+	unsigned int ready;
+	int i, n;
+
+	if (p->nonempty == 0) return 0;
+
+	if (p->mode == RB_PRIO_WRR)
+	{
+		ready = p->nonempty & p->credited;
+		if (ready == 0)		//有数据的通道配额都用完了
+		{
+			RB_PrioRefill(p);
+			ready = p->nonempty & p->credited;
+			if (ready == 0) ready = p->nonempty;	//权重全为0的通道也要能取出
+		}
+		i = RB_PrioFirst(ready);
+		if (--p->credit[i] <= 0) p->credited &= ~(1u << i);
+	}
+	else
+	{
+		i = RB_PrioFirst(p->nonempty);
+	}
+
+	n = RB_ReadItem(&p->lane[i], data, SizeofData);
+	if (RB_GetItemsCount(&p->lane[i]) == 0) p->nonempty &= ~(1u << i);
+	if (lane != NULL) *lane = i;
+	return n;
+}
+
+int RB_PrioGetItemsCount(struct RB_Priority * p)
+{
+	int i, n = 0;
+
+	for (i = 0; i < RB_PRIO_LANES; i++) n += RB_GetItemsCount(&p->lane[i]);
+	return n;
+}
@@ -0,0 +1,50 @@
+#ifndef _LIB_RBPRIORITY_H_
+#define _LIB_RBPRIORITY_H_
+
+#include "lib_RingBuffer.h"
+
+#define RB_PRIO_LANES	4	/*通道数, 不超过32*/
+
+#define RB_PRIO_STRICT	0	/*严格优先级: 总是先取编号小的通道*/
+#define RB_PRIO_WRR	1	/*加权轮询: 每轮每个通道最多取weight条*/
+
+/**
+	多通道优先级队列: 一个对象内有RB_PRIO_LANES个ring,
+	用位图记录哪些通道非空, 取数据时不需要逐个扫描通道
+**/
+
+struct RB_Priority {
+		struct RB_Buffer lane[RB_PRIO_LANES];	/*lane[0]优先级最高*/
+		unsigned int	nonempty;		/*bit i: lane[i]有数据*/
+		unsigned int	credited;		/*bit i: lane[i]本轮还有配额 (WRR)*/
+		int		mode;
+		int		weight[RB_PRIO_LANES];
+		int		credit[RB_PRIO_LANES];	/*本轮剩余配额 (WRR)*/
+};
+
+/*初始化, weights为NULL时每个通道权重为1 (仅WRR使用)*/
+void  RB_PrioInit(struct RB_Priority * p, int mode, const int * weights);
+
+/*写入指定通道, 返回写入长度, 0--该通道满*/
+int   RB_PrioWrite(struct RB_Priority * p, int lane, const char * data, int length);
+
+/*按策略取出下一条记录, lane返回来源通道(可为NULL), 返回长度, 0--全部为空*/
+int   RB_PrioRead(struct RB_Priority * p, char * data, int SizeofData, int * lane);
+
+/*所有通道的记录总数*/
+int   RB_PrioGetItemsCount(struct RB_Priority * p);
+
+/**
+//例子：
+struct RB_Priority PQ;
+int w[RB_PRIO_LANES]={8,4,2,1};
+char swap[32];
+int lane;
+RB_PrioInit(&PQ,RB_PRIO_WRR,w);
+RB_PrioWrite(&PQ,3,"bulk",4);
+RB_PrioWrite(&PQ,0,"ctrl",4);
+RB_PrioRead(&PQ,swap,32,&lane);	//ctrl, lane=0
+
+**/
+
+#endif
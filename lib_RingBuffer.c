@@ -2,18 +2,129 @@
 #include <string.h>
 #include "lib_RingBuffer.h"
 
+#define RB_FRAME_UNSTAMPED  (~0UL)
 
+#ifdef RB_SOJOURN
+#define RB_STAMP(item)		((item)->stamp = RB_NOW())
+#define RB_SOJOURN_DONE(buf, item)	rb_hist_record(&(buf)->sojourn, RB_NOW() - (item)->stamp)
+#else
+#define RB_STAMP(item)
+#define RB_SOJOURN_DONE(buf, item)
+#endif
+
+#define RB_ITEM(buf, cursor)	(&(buf)->pitems[(cursor) & (buf)->item_mask])	/*记录游标对应的记录表项*/
+
+/*快照的序号锁: 修改游标/记录表之前登记, 改完注销; 快照读取方用读屏障*/
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define RB_RMB()	__asm__ __volatile__("" ::: "memory")	/*x86的load不乱序, 只需挡住编译器*/
+#elif defined(__GNUC__)
+#define RB_RMB()	__sync_synchronize()
+#else
+#define RB_RMB()
+#endif
+
+/*写入方和取出方都会修改(可以各在一个线程), 所以低16位记正在修改的个数, 其上记改完的次数:
+  两方同时修改时低位不为0, 直到都改完. 原子加自带完整的内存屏障*/
+#define RB_SEQ_WRITER	1UL
+#define RB_SEQ_DONE	(1UL << 16)
+#define RB_SEQ_BUSY(seq)	((seq) & (RB_SEQ_DONE - 1))
+#if defined(__GNUC__)
+#define RB_SEQ_ADD(buf, n)	__sync_fetch_and_add(&(buf)->seq, (n))
+#else
+#define RB_SEQ_ADD(buf, n)	((buf)->seq += (n))		/*没有原子操作: 只能由一方修改, 或修改时持同一把锁*/
+#endif
+#define RB_SEQ_BEGIN(buf)	RB_SEQ_ADD(buf, RB_SEQ_WRITER)
+#define RB_SEQ_END(buf)		RB_SEQ_ADD(buf, RB_SEQ_DONE - RB_SEQ_WRITER)
+
+static int RB_WriteItem(struct RB_Buffer * buf, const char * data, int length, char flags);
+static void RB_PutBytes(struct RB_Buffer * buf, const char * data, int length);
+static int RB_FrameAppend(struct RB_Buffer * buf, const char * data, int length);
+static int RB_FrameRead(struct RB_Buffer * buf, char * data, int SizeofData);
+
+
+/*
+  不超过n的最大2的幂, 游标 & (size-1) 即物理位置
+*/
+static long long RB_Pow2(long long n)
+{
+	long long p = 1;
+
+	if (n <= 0) return 0;
+	while (p <= n / 2) p <<= 1;
+	return p;
+}
 
 /*
-  初始化环形buffer
+  从游标pos复制n字节出来(可跨圈)
+*/
+static void RB_GetBytes(struct RB_Buffer * buf, unsigned long long pos, char * data, int n)
+{
+	long long off = pos & buf->mask;
+	long long FirstPart = buf->size - off;
+
+	if (FirstPart > n) FirstPart = n;
+	memcpy(data, &buf->pdata[off], FirstPart);
+	memcpy(&data[FirstPart], &buf->pdata[0], n - FirstPart);
+}
+
+/*
+  解压游标pos开始的len字节压缩数据到data, 超过SizeofData截断.
+  不跨圈时直接从ring解压, 不用共享的临时空间, 多个读取方(如广播的消费者)可同时读;
+  跨圈的压缩记录只在RB_Move改变大小之后出现, 临时分配
+  return 解压长度, 0--失败
+*/
+static int RB_Unpack(struct RB_Buffer * buf, unsigned long long pos, int len, char * data, int SizeofData)
+{
+	long long off = pos & buf->mask;
+	char * swap;
+	int n;
+
+	if (off + len <= buf->size)
+		n = buf->codec->decompress(&buf->pdata[off], len, data, SizeofData);
+	else
+	{
+		swap = (char *)RB_MALLOC(len);
+		if (swap == NULL) return 0;
+		RB_GetBytes(buf, pos, swap, len);
+		n = buf->codec->decompress(swap, len, data, SizeofData);
+		RB_FREE(swap);
+	}
+	return (n < 0) ? 0 : n;
+}
+
+/*
+  初始化环形buffer, 使用内置的data空间
 */
 void RB_init(struct RB_Buffer * buf)
+{
+	RB_InitEx(buf, buf->data, RB_BUFFER_SIZE);
+}
+
+/*
+  初始化环形buffer, 使用外部提供的数据空间(如大页/NUMA内存)
+  只使用其中不超过size的最大2的幂
+  buf已初始化过时, 先释放之前RB_Resize/RB_SetCodec分配的空间
+  return 1--成功 0--失败
+*/
+int RB_InitEx(struct RB_Buffer * buf, char * mem, long long size)
 {
 	int i;
+
+	size = RB_Pow2(size);
+	if (mem == NULL || size <= 0) return 0;
+	if (buf->self == buf) RB_Destroy(buf);		//未初始化的buf里是随机内容, 不能据owned释放
+
+	buf->self = buf;
+	buf->pitems = buf->items;
+	buf->item_size = (int)RB_Pow2(RB_Max_Items);
+	buf->item_mask = buf->item_size - 1;
+	buf->owned = 0;
+
 	for (i=0; i < RB_Max_Items; i++)
 	{
-		buf->items[i].read_index = 0;
-		buf->items[i].length = 0;
+		buf->pitems[i].read_index = 0;
+		buf->pitems[i].length = 0;
+		buf->pitems[i].flags = RB_Item_Raw;
 	}
 	
 	buf->read_index = 0;
@@ -21,48 +132,110 @@ void RB_init(struct RB_Buffer * buf)
 
 	buf->item_read_index=0;
 	buf->item_write_index=0;
-	buf->item_counts=0;
 
-	buf->item_counts = 0;
-	buf->length = 0;
-	buf->size =RB_BUFFER_SIZE;
+	buf->pdata = mem;
+	buf->size = size;
+	buf->mask = size - 1;
 	buf->status = RB_Status_Free;
-	
+
+	buf->codec = NULL;
+	buf->codec_threshold = 0;
+	buf->codec_in = 0;
+	buf->codec_out = 0;
+	buf->codec_max = 0;
+	buf->codec_swap = NULL;
+
+	buf->frame_limit = 0;
+	buf->frame_timeout = 0;
+	buf->frame_time = 0;
+	buf->frame_open = 0;
+	buf->frame_read = 0;
+	buf->chunk_base = 0;
+	buf->chunk_unpacked = -1;
+	buf->seq = 0;
+
+#ifdef RB_SOJOURN
+	rb_hist_init(&buf->sojourn);
+#endif
+	return 1;
+}
+
+/*
+  释放RB_Resize分配的数据空间/记录表和RB_SetCodec分配的临时空间
+  外部提供的空间(RB_InitEx/RB_Move)由调用者释放
+*/
+void RB_Destroy(struct RB_Buffer * buf)
+{
+	RB_SetCodec(buf, NULL, 0);
+	if (buf->owned & 1) RB_FREE(buf->pdata);
+	if (buf->owned & 2) RB_FREE(buf->pitems);
+	buf->owned = 0;
+	buf->pdata = buf->data;
+	buf->pitems = buf->items;
+	buf->size = 0;
+	buf->mask = 0;
+	buf->self = NULL;
 }
 
 int RB_write(struct RB_Buffer * buf, const char * data, int length)
 {
-	 int FirstPart;
-	 int SecondPart;
+	 if (length <= 0) return 0;		//空记录在合并帧里也占一项, 但无法与失败区分
+	 if (buf->frame_limit > 0 && length < buf->frame_limit && length <= RB_FRAME_RECORD_MAX)
+		return RB_FrameAppend(buf, data, length);
 
-	 buf->status = RB_Status_Busy;
-	
-	 buf->items[buf->item_write_index].read_index =buf->write_index;
-	 buf->items[buf->item_write_index].length=length;
-	 buf->item_write_index++;
-	 buf->item_counts++;
-	 if (buf->item_write_index>RB_Max_Items-1) buf->item_write_index=0;
+	 return RB_WriteItem(buf, data, length, RB_Item_Raw);
+}
 
-	 //printf("[%s]\n",data);
+int RB_WriteChunk(struct RB_Buffer * buf, const char * data, int length, int more)
+{
+	 return RB_WriteItem(buf, data, length, more ? RB_Item_More : RB_Item_Raw);	//分片不合并, 保留RB_Item_More
+}
 
-	 if ( ((buf->write_index)+length)  <  buf->size  )	//[本圈]	no wrap-around 
-	 {
-	   	memcpy(&buf->data[buf->write_index],data,length); //写入 buffer
+/*
+  写入一个记录表项, flags为附加标志
+*/
+static int RB_WriteItem(struct RB_Buffer * buf, const char * data, int length, char flags)
+{
+	 struct RB_Buffer_Block * item;
+	 int PackedLength;
+	 int RawLength = length;
 
-		buf->write_index += length;  //标记write入位置
-	 }
-	 else  											// [换圈]	data wraps around
-	 {
+	 RB_FlushFrame(buf);		//大记录之前先发布未满的帧, 保持顺序
 
-	    FirstPart=(buf->size) - (buf->write_index);
-		SecondPart=length-FirstPart;
-		memcpy(&buf->data[buf->write_index],data, FirstPart);
-		memcpy(&buf->data[0],&data[FirstPart], SecondPart);
-		buf->write_index =SecondPart;  //标记write入位置
-		
+	 if (buf->codec != NULL && length >= buf->codec_threshold && length <= buf->codec_max)
+	 {
+		PackedLength = buf->codec->compress(data, length, buf->codec_swap, length - 1);
+		if (PackedLength > 0		//压缩有效且不跨圈才保存压缩数据: 读取方直接从ring解压
+			&& (long long)(buf->write_index & buf->mask) + PackedLength <= buf->size)
+		{
+			data = buf->codec_swap;
+			length = PackedLength;
+			flags |= RB_Item_Packed;
+		}
 	 }
 
+	 if (RB_COUNT(buf) >= buf->item_size) return 0;		//记录表已满
+	 if (length <= 0 || length > buf->size - RB_USED(buf)) return 0;	//数据空间不够
+
+	 buf->status = RB_Status_Busy;
+	 RB_SEQ_BEGIN(buf);
+	
+	 item = RB_ITEM(buf, buf->item_write_index);
+	 item->read_index = buf->write_index;
+	 item->length = length;
+	 item->flags = flags;
+	 RB_STAMP(item);
+
+	 //printf("[%s]\n",data);
+
+	 RB_PutBytes(buf, data, length);	//写入 buffer(跨圈时分两段), 移动写游标
+	 buf->item_write_index++;
+	 buf->codec_in += RawLength;
+	 buf->codec_out += length;
+
+	 RB_SEQ_END(buf);
 	 buf->status = RB_Status_Free;
+	 return RawLength;
 }
 /*
 
@@ -71,51 +244,548 @@ int RB_write(struct RB_Buffer * buf, const char * data, int length)
 
 int RB_ReadItem(struct RB_Buffer * buf,  char *data, int SizeofData)
 {
-   int readcount=0;
-   int readPos,len;
-   int FirstPart,SecondPart;
+   struct RB_Buffer_Block * item;
+   int len;
 
-   if (buf->item_counts<=0) return 0;
+   if (RB_COUNT(buf)<=0) return 0;
 
-   readPos=buf->items[buf->item_read_index].read_index;
+   item = RB_ITEM(buf, buf->item_read_index);
+   if (item->flags & RB_Item_Frame)	//合并帧, 每次取出其中一条
+	  return RB_FrameRead(buf, data, SizeofData);
 
-   len	  =buf->items[buf->item_read_index].length;
+   len = item->length;
 
-   if ( ( readPos+len ) <  buf->size  )	  //圈内数据
-   {
-   	   buf->read_index += len; 
-	   if (len>SizeofData) len=SizeofData;  	   
-       memcpy(data, &buf->data[readPos], len);   	   
-			 
-   }
-   else   //跨圈 To Do: data空间不够，会出错 
+   if (item->flags & RB_Item_Packed)	//压缩数据
+	  len = RB_Unpack(buf, item->read_index, len, data, SizeofData);
+   else		//超过SizeofData的部分截断
    {
-   	  FirstPart=buf->size - readPos;
-	  SecondPart =len-FirstPart ;
-      memcpy(data, &buf->data[readPos], FirstPart);
-      memcpy(&data[FirstPart], &buf->data[0], SecondPart);
-	  buf->read_index = SecondPart; 
+	  if (len>SizeofData) len=SizeofData;
+	  RB_GetBytes(buf, item->read_index, data, len);
    }
 
-
-
-   buf->item_read_index++;	 //第一组数据索引+1
-   if (buf->item_read_index>RB_Max_Items-1) buf->item_read_index=0;
-   buf->item_counts--;
+   RB_DropItem(buf);	//第一组数据出队
 
    return len; 
 
 }
 
 
-short int RB_GetItemsCount(struct RB_Buffer * buf)
+int RB_GetItemsCount(struct RB_Buffer * buf)
 {
-	return buf->item_counts;
+	return RB_COUNT(buf);
 }
 
 char * RB_GetAllData(struct RB_Buffer * buf)
 {
-	return (buf->data);
+	return (buf->pdata);
+}
+
+/*
+  无锁快照: 先记下序号, 复制游标/记录表/数据, 序号没变才算一致, 否则重试.
+  写入方只多两次序号自增, 不会等待观察者
+  return 快照中的记录数, -1--调用者的空间不够(snap->used/count为所需大小), -2--一直在修改, 重试次数用完
+*/
+int RB_Snapshot(struct RB_Buffer * buf, struct RB_Snap * snap)
+{
+	struct RB_Buffer_Block * items;
+	unsigned long long c, item_mask;
+	unsigned long seq;
+	long long size, off, FirstPart;
+	char * pdata;
+	int retry;
+
+	for (retry = 0; retry < RB_SNAP_RETRIES; retry++)
+	{
+		seq = buf->seq;
+		if (RB_SEQ_BUSY(seq)) continue;		//有人正在修改
+		RB_RMB();
+
+		snap->read_index = buf->read_index;
+		snap->write_index = buf->write_index;
+		snap->item_read_index = buf->item_read_index;
+		snap->item_write_index = buf->item_write_index;
+		pdata = buf->pdata;
+		size = buf->size;
+		items = buf->pitems;
+		item_mask = buf->item_mask;
+		snap->used = (long long)(snap->write_index - snap->read_index);
+		snap->count = (int)(snap->item_write_index - snap->item_read_index);
+
+		/*游标和空间先确认一致, 再按它们复制, 不会越界*/
+		RB_RMB();
+		if (buf->seq != seq) continue;
+
+		if (snap->used > snap->data_cap || snap->count > snap->item_cap) return -1;
+
+		off = snap->read_index & (size - 1);
+		FirstPart = size - off;
+		if (FirstPart > snap->used) FirstPart = snap->used;
+		memcpy(snap->data, &pdata[off], FirstPart);
+		memcpy(&snap->data[FirstPart], &pdata[0], snap->used - FirstPart);
+
+		for (c = snap->item_read_index; c < snap->item_write_index; c++)
+			snap->items[c - snap->item_read_index] = items[c & item_mask];
+
+		RB_RMB();
+		if (buf->seq == seq) return snap->count;
+	}
+	return -2;
+}
+
+long long RB_GetFreeSize(struct RB_Buffer * buf)
+{
+	return (buf->size - RB_USED(buf));
+}
+
+int RB_SetCodec(struct RB_Buffer * buf, const struct RB_Codec * codec, int threshold)
+{
+	if (buf->codec_swap != NULL) RB_FREE(buf->codec_swap);
+	buf->codec = NULL;
+	buf->codec_swap = NULL;
+	buf->codec_max = 0;
+	buf->chunk_unpacked = -1;
+	if (codec == NULL) return 1;
+
+	/*写入和流式读取可能在不同线程, 各用各的临时空间; RB_ReadItem/RB_CopyItem不用*/
+	buf->codec_max = (buf->size < RB_CODEC_RECORD_MAX) ? (int)buf->size : RB_CODEC_RECORD_MAX;
+	buf->codec_swap = (char *)RB_MALLOC(2 * buf->codec_max);
+	if (buf->codec_swap == NULL)
+	{
+		buf->codec_max = 0;
+		return 0;
+	}
+	buf->codec = codec;
+	buf->codec_threshold = threshold;
+	return 1;
+}
+
+void RB_GetCodecStats(struct RB_Buffer * buf, unsigned long * raw, unsigned long * stored)
+{
+	*raw = buf->codec_in;
+	*stored = buf->codec_out;
+}
+
+#ifdef RB_SOJOURN
+void RB_GetSojourn(struct RB_Buffer * buf, struct rb_histogram * snap)
+{
+	rb_hist_snapshot(&buf->sojourn, snap);
+}
+#endif
+
+/*
+  复制记录表中第slot条记录, 不出队, 超过SizeofData截断
+  return 复制长度
+*/
+int RB_CopyItem(struct RB_Buffer * buf, int slot, char * data, int SizeofData)
+{
+	struct RB_Buffer_Block * item = &buf->pitems[slot];
+	int len = item->length;
+
+	if (item->flags & RB_Item_Packed) return RB_Unpack(buf, item->read_index, len, data, SizeofData);
+
+	if (len > SizeofData) len = SizeofData;
+	RB_GetBytes(buf, item->read_index, data, len);
+	return len;
+}
+
+/*
+  记录游标c对应记录的原地视图; 队首合并帧只包含未读出的部分
+  return 占用长度, 0--c不在队列中
+*/
+static int RB_ViewAt(struct RB_Buffer * buf, unsigned long long c, struct RB_View * view)
+{
+	struct RB_Buffer_Block * item;
+	unsigned long long pos;
+	long long off;
+	int len;
+
+	if (c < buf->item_read_index || c >= buf->item_write_index) return 0;
+
+	item = RB_ITEM(buf, c);
+	pos = item->read_index;
+	len = item->length;
+	if (c == buf->item_read_index && (item->flags & RB_Item_Frame))
+	{
+		pos += buf->frame_read;
+		len -= buf->frame_read;
+	}
+
+	off = pos & buf->mask;
+	view->flags = item->flags;
+	view->data = &buf->pdata[off];
+	view->length = len;
+	view->wrap = NULL;
+	view->wrap_length = 0;
+	if (off + len > buf->size)		//跨圈, 第二段从数据空间开头
+	{
+		view->length = (int)(buf->size - off);
+		view->wrap = buf->pdata;
+		view->wrap_length = len - view->length;
+	}
+	return len;
+}
+
+int RB_PeekItem(struct RB_Buffer * buf, int n, struct RB_View * view)
+{
+	if (n < 0) return 0;
+	return RB_ViewAt(buf, buf->item_read_index + n, view);
+}
+
+void RB_IterBegin(struct RB_Buffer * buf, struct RB_Iter * it)
+{
+	it->cursor = buf->item_read_index;
+}
+
+int RB_IterNext(struct RB_Buffer * buf, struct RB_Iter * it, struct RB_View * view)
+{
+	int len;
+
+	if (it->cursor < buf->item_read_index) it->cursor = buf->item_read_index;	//期间有记录出队, 从队首继续
+	len = RB_ViewAt(buf, it->cursor, view);
+	if (len > 0) it->cursor++;
+	return len;
+}
+
+/*
+  丢弃队首记录(不复制)
+  return 丢弃的占用长度, 0--队列空
+*/
+int RB_DropItem(struct RB_Buffer * buf)
+{
+	struct RB_Buffer_Block * item;
+	int len;
+
+	if (RB_COUNT(buf) <= 0) return 0;
+
+	item = RB_ITEM(buf, buf->item_read_index);
+	len = item->length;
+	RB_SEQ_BEGIN(buf);
+	buf->read_index = item->read_index + len;
+
+	RB_SOJOURN_DONE(buf, item);
+	buf->item_read_index++;
+	RB_SEQ_END(buf);
+	buf->frame_read = 0;
+	buf->chunk_base = 0;		//不经RB_ReadChunk取走分片, 流式读取重新从0算
+	buf->chunk_unpacked = -1;
+
+	return len;
+}
+
+/*
+  队首记录原样(压缩/分片标志和写入时间不变)移到队尾, 原来的位置随即可重用.
+  数据从读游标搬到写游标: 目标在源之后used字节, 按顺序逐段搬时只会覆盖已搬走的源字节
+  return 记录占用长度, 0--队列空, 有未发布的帧, 队首是分片记录或正在流式读取
+*/
+int RB_Requeue(struct RB_Buffer * buf)
+{
+	struct RB_Buffer_Block head, * item;
+	unsigned long long src, dst;
+	long long n, k;
+
+	if (RB_COUNT(buf) <= 0 || buf->frame_open || buf->frame_read > 0 || buf->chunk_base > 0) return 0;
+
+	head = *RB_ITEM(buf, buf->item_read_index);
+	if (head.flags & RB_Item_More) return 0;		//分片必须相邻
+	src = head.read_index;
+	dst = buf->write_index;
+
+	buf->status = RB_Status_Busy;
+	RB_SEQ_BEGIN(buf);
+	buf->read_index = src + head.length;
+	buf->item_read_index++;
+
+	for (k = 0; k < head.length; k += n)
+	{
+		n = head.length - k;
+		if (n > buf->size - (long long)((src + k) & buf->mask)) n = buf->size - (long long)((src + k) & buf->mask);
+		if (n > buf->size - (long long)((dst + k) & buf->mask)) n = buf->size - (long long)((dst + k) & buf->mask);
+		memmove(&buf->pdata[(dst + k) & buf->mask], &buf->pdata[(src + k) & buf->mask], n);
+	}
+
+	item = RB_ITEM(buf, buf->item_write_index);	//记录表满时正是刚空出的队首表项
+	*item = head;
+	item->read_index = dst;
+	buf->write_index = dst + head.length;
+	buf->item_write_index++;
+
+	RB_SEQ_END(buf);
+	buf->status = RB_Status_Free;
+	buf->chunk_unpacked = -1;
+	return head.length;
+}
+
+/*
+  流式读取: 从队首记录(合并帧中为当前小记录, 分片记录为当前分片)的offset处复制,
+  读到末尾后出队; 分片记录直到最后一个分片读完才算整条读完
+  return 复制长度, 0--队列空或offset不在当前分片内
+*/
+int RB_ReadChunk(struct RB_Buffer * buf, int offset, char * data, int SizeofData, int * last)
+{
+	struct RB_Buffer_Block * item;
+	char * swap = buf->codec_swap + buf->codec_max;	//整条解压后的记录
+	unsigned long long pos = 0;
+	int len, n, base;
+	char packed, more;
+
+	*last = 0;
+	if (RB_COUNT(buf) <= 0) return 0;
+
+	item = RB_ITEM(buf, buf->item_read_index);
+	offset -= buf->chunk_base;		//已出队的分片之后的位置
+	packed = item->flags & RB_Item_Packed;
+	more = item->flags & RB_Item_More;
+
+	if (item->flags & RB_Item_Frame)
+	{
+		pos = item->read_index + buf->frame_read;
+		len = (unsigned char)buf->pdata[pos & buf->mask];
+		pos++;
+	}
+	else if (packed)			//压缩数据第一次读时整条解压, 之后的部分从swap取
+	{
+		if (buf->chunk_unpacked < 0)
+			buf->chunk_unpacked = RB_CopyItem(buf, (int)(buf->item_read_index & buf->item_mask), swap, buf->codec_max);
+		len = buf->chunk_unpacked;
+	}
+	else
+	{
+		pos = item->read_index;
+		len = item->length;
+	}
+
+	if (offset < 0 || offset > len || SizeofData < 0) return 0;
+
+	n = len - offset;
+	if (n > SizeofData) n = SizeofData;
+
+	if (packed) memcpy(data, &swap[offset], n);
+	else RB_GetBytes(buf, pos + offset, data, n);
+
+	if (offset + n < len) return n;
+
+	/*当前记录/分片读完, 出队(RB_DropItem清零chunk_base)*/
+	base = buf->chunk_base;
+	if (item->flags & RB_Item_Frame)
+	{
+		buf->frame_read += 1 + len;
+		if (buf->frame_read >= item->length) RB_DropItem(buf);
+	}
+	else RB_DropItem(buf);
+
+	if (more) buf->chunk_base = base + len;
+	else *last = 1;
+	return n;
+}
+
+/*
+  从write_index写入(可跨圈), 移动write_index
+*/
+static void RB_PutBytes(struct RB_Buffer * buf, const char * data, int length)
+{
+	long long off = buf->write_index & buf->mask;
+	long long FirstPart = buf->size - off;
+
+	if (FirstPart > length) FirstPart = length;
+	memcpy(&buf->pdata[off], data, FirstPart);
+	memcpy(&buf->pdata[0], &data[FirstPart], length - FirstPart);
+	buf->write_index += length;
+}
+
+/*
+  小记录追加到当前帧, 没有打开的帧时新开一帧
+  return 写入长度, 0--空间不足
+*/
+static int RB_FrameAppend(struct RB_Buffer * buf, const char * data, int length)
+{
+	struct RB_Buffer_Block * frame = RB_ITEM(buf, buf->item_write_index);
+	char hdr = (char)length;
+
+	if (buf->frame_open && frame->length + 1 + length > buf->frame_limit) RB_FlushFrame(buf);
+	if (1 + length > buf->size - RB_USED(buf)) return 0;
+	if (!buf->frame_open && RB_COUNT(buf) >= buf->item_size) return 0;		//记录表已满
+
+	RB_SEQ_BEGIN(buf);
+	if (!buf->frame_open)
+	{
+		frame = RB_ITEM(buf, buf->item_write_index);
+		frame->read_index = buf->write_index;
+		frame->length = 0;
+		frame->flags = RB_Item_Frame;
+		RB_STAMP(frame);
+		buf->frame_open = 1;
+		buf->frame_time = RB_FRAME_UNSTAMPED;
+	}
+
+	RB_PutBytes(buf, &hdr, 1);
+	RB_PutBytes(buf, data, length);
+	frame->length += 1 + length;
+	buf->codec_in += length;
+	buf->codec_out += 1 + length;
+	RB_SEQ_END(buf);
+
+	if (frame->length + 2 > buf->frame_limit) RB_FlushFrame(buf);	//放不下更多记录
+	return length;
+}
+
+/*
+  从队首帧取出一条记录, 帧取完后释放
+*/
+static int RB_FrameRead(struct RB_Buffer * buf, char * data, int SizeofData)
+{
+	struct RB_Buffer_Block * frame = RB_ITEM(buf, buf->item_read_index);
+	unsigned long long pos;
+	int len, n;
+
+	pos = frame->read_index + buf->frame_read;
+	len = (unsigned char)buf->pdata[pos & buf->mask];
+
+	n = (len > SizeofData) ? SizeofData : len;
+	RB_GetBytes(buf, pos + 1, data, n);
+
+	buf->frame_read += 1 + len;
+	if (buf->frame_read >= frame->length) RB_DropItem(buf);
+
+	return n;
+}
+
+void RB_SetCoalesce(struct RB_Buffer * buf, int frame_size, unsigned long timeout)
+{
+	RB_FlushFrame(buf);
+	buf->frame_limit = frame_size;
+	buf->frame_timeout = timeout;
+}
+
+void RB_FlushFrame(struct RB_Buffer * buf)
+{
+	if (!buf->frame_open) return;
+
+	RB_SEQ_BEGIN(buf);
+	buf->frame_open = 0;
+	buf->item_write_index++;
+	RB_SEQ_END(buf);
+}
+
+void RB_PollFrame(struct RB_Buffer * buf, unsigned long now)
+{
+	if (!buf->frame_open) return;
+
+	if (buf->frame_time == RB_FRAME_UNSTAMPED) buf->frame_time = now;
+	else if (now - buf->frame_time >= buf->frame_timeout) RB_FlushFrame(buf);
+}
+
+/*
+  游标区间[pos, end)的数据复制到新空间(size为2的幂)中 游标&(size-1) 的位置
+*/
+static void RB_CopyData(struct RB_Buffer * buf, char * mem, long long size, unsigned long long pos, unsigned long long end)
+{
+	long long len, mask = size - 1;
+
+	for (; pos < end; pos += len)
+	{
+		len = end - pos;
+		if (len > buf->size - (long long)(pos & buf->mask)) len = buf->size - (pos & buf->mask);
+		if (len > size - (long long)(pos & mask)) len = size - (pos & mask);
+		memcpy(&mem[pos & mask], &buf->pdata[pos & buf->mask], len);
+	}
+}
+
+/*
+  记录游标区间[c, end)的记录表项复制到新记录表(item_size为2的幂)
+*/
+static void RB_CopyItems(struct RB_Buffer * buf, struct RB_Buffer_Block * items, int item_size, unsigned long long c, unsigned long long end)
+{
+	for (; c < end; c++) items[c & (item_size - 1)] = *RB_ITEM(buf, c);
+}
+
+void RB_MoveStart(struct RB_Buffer * buf, struct RB_MoveMark * mark)
+{
+	mark->read_index = buf->read_index;
+	mark->write_index = buf->write_index;
+	mark->item_read_index = buf->item_read_index;
+	mark->item_write_index = buf->item_write_index;
+}
+
+/*
+  复制RB_MoveStart时已发布的数据和记录. 可与读写并发:
+  区间内的数据和记录表项在被取出之前不会改变, 取出后被覆盖的部分RB_MoveFinish不再使用
+*/
+void RB_MoveCopy(struct RB_Buffer * buf, char * mem, long long size, struct RB_Buffer_Block * items, int item_size, const struct RB_MoveMark * mark)
+{
+	size = RB_Pow2(size);
+	item_size = (int)RB_Pow2(item_size);
+	if (size <= 0 || item_size <= 0) return;
+
+	RB_CopyData(buf, mem, size, mark->read_index, mark->write_index);
+	RB_CopyItems(buf, items, item_size, mark->item_read_index, mark->item_write_index);	//未发布的帧还在变, 留给RB_MoveFinish
 }
 
+int RB_MoveFinish(struct RB_Buffer * buf, char * mem, long long size, struct RB_Buffer_Block * items, int item_size, const struct RB_MoveMark * mark)
+{
+	unsigned long long pos, c;
+	long long n, mask;
+
+	size = RB_Pow2(size);
+	item_size = (int)RB_Pow2(item_size);
+	n = RB_COUNT(buf) + buf->frame_open;		//未发布的帧也要搬
+	if (size <= 0 || size < RB_USED(buf) || item_size < n || item_size <= 0) return 0;
+
+	/*游标不变, 只补上RB_MoveCopy之后写入的部分(期间已取出的不用再搬)*/
+	pos = (mark->write_index > buf->read_index) ? mark->write_index : buf->read_index;
+	c = (mark->item_write_index > buf->item_read_index) ? mark->item_write_index : buf->item_read_index;
+	mask = size - 1;
+	RB_CopyData(buf, mem, size, pos, buf->write_index);
+	RB_CopyItems(buf, items, item_size, c, buf->item_write_index + buf->frame_open);
 
+	RB_SEQ_BEGIN(buf);
+	buf->pdata = mem;
+	buf->size = size;
+	buf->mask = mask;
+	buf->pitems = items;
+	buf->item_size = item_size;
+	buf->item_mask = item_size - 1;
+	RB_SEQ_END(buf);
+
+	return 1;
+}
+
+int RB_Move(struct RB_Buffer * buf, char * mem, long long size, struct RB_Buffer_Block * items, int item_size)
+{
+	struct RB_MoveMark mark;
+
+	/*什么都还没复制: 一次持锁搬完*/
+	RB_MoveStart(buf, &mark);
+	mark.write_index = mark.read_index;
+	mark.item_write_index = mark.item_read_index;
+	return RB_MoveFinish(buf, mem, size, items, item_size, &mark);
+}
+
+int RB_Resize(struct RB_Buffer * buf, long long new_capacity, int new_items)
+{
+	char * mem;
+	struct RB_Buffer_Block * items;
+	char * old_mem = buf->pdata;
+	struct RB_Buffer_Block * old_items = buf->pitems;
+	char owned = buf->owned;
+
+	if (new_items <= 0) new_items = buf->item_size;
+	new_capacity = RB_Pow2(new_capacity);
+	new_items = (int)RB_Pow2(new_items);
+	if (new_capacity <= 0 || new_capacity < RB_USED(buf) || new_items < RB_COUNT(buf) + buf->frame_open) return 0;
+
+	mem = (char *)RB_MALLOC(new_capacity);
+	items = (struct RB_Buffer_Block *)RB_MALLOC(new_items * sizeof(struct RB_Buffer_Block));
+	if (mem == NULL || items == NULL)
+	{
+		if (mem != NULL) RB_FREE(mem);
+		if (items != NULL) RB_FREE(items);
+		return 0;
+	}
+
+	RB_Move(buf, mem, new_capacity, items, new_items);
+	buf->owned = 3;
+
+	if (owned & 1) RB_FREE(old_mem);
+	if (owned & 2) RB_FREE(old_items);
+	return 1;
+}
@@ -1,48 +1,236 @@
+#ifndef _LIB_RINGBUFFER_H_
+#define _LIB_RINGBUFFER_H_
+
+#define RB_BUFFER_SIZE  128  //(4*1024)  /*数据空间大小, 2的幂*/
+#define RB_Max_Items    4        /*最多可以保存多少条记录(2的幂)，每条记录最大长度RB_BUFFER_SIZE为*/
+#ifndef RB_MALLOC			/*RB_SetCodec/RB_Resize使用的内存分配, 可换成自己的内存池*/
+#include <stdlib.h>
+#define RB_MALLOC(n)    malloc(n)
+#define RB_FREE(p)      free(p)
+#endif
 
-#define RB_BUFFER_SIZE  128  //(4*1024)  /*数据空间大小*/
-#define RB_Max_Items    4        /*最多可以保存多少条记录，每条记录最大长度RB_BUFFER_SIZE为*/
 #define RB_Status_Free  0
 #define RB_Status_Busy  1
+#define RB_CODEC_RECORD_MAX (64*1024)	/*可压缩的最长记录(还不超过ring大小), 更长的按原样保存*/
+
+#define RB_Item_Raw     0
+#define RB_Item_Packed  1	/*记录以压缩形式保存*/
+#define RB_Item_Frame   2	/*合并帧: 多条小记录, 每条为 [1字节长度][数据]*/
+#define RB_Item_More    4	/*分片记录: 后面还有同一条记录的分片*/
+
+#define RB_FRAME_RECORD_MAX 255	/*可合并的小记录最大长度*/
+#define RB_SNAP_RETRIES     1000	/*RB_Snapshot遇到并发修改时最多重试的次数*/
+
+/*#define RB_SOJOURN      1*/	/*统计记录在ring中的停留时间(写入到取出), 需链接src/rb_histogram.c*/
+#ifdef RB_SOJOURN
+#include "src/rb_histogram.h"
+#endif
 /**
 	用于记录整个内存片区的有效数据位置,
+	位置都是64位游标: 只增不减, 物理位置为 游标 & (size-1),
+	已用空间/记录数 = 写游标 - 读游标, 满和空不会混淆
 **/
 
+#define RB_USED(buf)	((long long)((buf)->write_index - (buf)->read_index))	/*已用数据空间*/
+#define RB_COUNT(buf)	((int)((buf)->item_write_index - (buf)->item_read_index))	/*已发布的记录数*/
+
 struct RB_Buffer_Block
 {
-		int read_index;  /*数据开始位置*/
+		unsigned long long read_index;  /*数据开始位置(游标)*/
 		int length;		  /*数据长度*/
+		char flags;		  /*RB_Item_xxx*/
+#ifdef RB_SOJOURN
+		unsigned long long stamp;	  /*写入时间RB_NOW(), 合并帧为开帧时间*/
+#endif
+};
+
+/**
+	可选的记录压缩接口, 返回输出长度
+	compress:   输出超过dstcap时返回0, 该记录按原样保存
+	decompress: 输出超过dstcap时截断, 数据损坏返回-1
+**/
+struct RB_Codec {
+		int (*compress)(const char * src, int srclen, char * dst, int dstcap);
+		int (*decompress)(const char * src, int srclen, char * dst, int dstcap);
+};
+
+/**
+	队列中记录的原地视图(不复制, 不出队), 下次写入/取出之前有效.
+	跨圈的记录分两段: data[0..length) 之后接 wrap[0..wrap_length).
+	Packed为压缩后的数据, Frame为合并帧的原始内容([1字节长度][数据]...)
+**/
+struct RB_View {
+		const char *	data;
+		int		length;
+		const char *	wrap;		/*NULL--不跨圈*/
+		int		wrap_length;
+		char		flags;		/*RB_Item_xxx*/
+};
+
+/*非破坏性遍历的位置*/
+struct RB_Iter {
+		unsigned long long cursor;	/*下一条记录的游标*/
 };
 
 struct RB_Buffer {
-		char 	data[RB_BUFFER_SIZE]; 
-		struct 	RB_Buffer_Block	items [RB_Max_Items];
+		char 	data[RB_BUFFER_SIZE]; 	  /*内置数据空间*/
+		char *	pdata;		  /*实际使用的数据空间, 默认指向data*/
+		struct 	RB_Buffer_Block	items [RB_Max_Items];	  /*内置记录表*/
+		struct 	RB_Buffer_Block * pitems;	  /*实际使用的记录表, 默认指向items*/
 
-		int 	read_index;  /*数据开始位置*/
-		int 	write_index;	  /*数据结束位置*/
-		int 	length;		  /*所有数据长度*/	
+		unsigned long long read_index;  /*数据开始位置(游标)*/
+		unsigned long long write_index;	  /*数据结束位置(游标)*/
 		char 	status;		  /*操作状态*/
-		int     size;		  /*仓库总大小*/
+		long long size;		  /*仓库总大小, 2的幂*/
+		unsigned long long mask;  /*size-1*/
+
+  unsigned long long item_read_index;	   //第一组数据的记录游标
+  unsigned long long item_write_index;	   //下一组数据的记录游标
+  int           item_size;		   //记录表大小, 2的幂
+  unsigned long long item_mask;		   //item_size-1
+  char          owned;			   //bit0: pdata bit1: pitems 由RB_Resize分配
+  struct RB_Buffer * self;		   //初始化后指向buf自身, RB_InitEx据此判断是否要先释放owned
+
+  const struct RB_Codec * codec;	   //NULL--不压缩
+  int           codec_threshold;	   //达到此长度的记录才尝试压缩
+  unsigned long codec_in;		   //写入的原始字节数
+  unsigned long codec_out;		   //实际占用ring的字节数
+  int           codec_max;		   //超过此长度的记录不压缩
+  char *        codec_swap;		   //压缩/解压临时空间: 写入方, 流式读取各codec_max字节, RB_SetCodec分配
+
+  int           frame_limit;		   //合并帧大小, 0--不合并
+  unsigned long frame_timeout;		   //帧最长停留时间(RB_PollFrame的时间单位)
+  unsigned long frame_time;		   //当前帧第一次被RB_PollFrame看到的时间
+  char          frame_open;		   //items[item_write_index]是未发布的帧
+  int           frame_read;		   //队首帧已读出的字节数
+  int           chunk_base;		   //RB_ReadChunk: 队首分片在整条记录中的起始位置
+  int           chunk_unpacked;		   //RB_ReadChunk: 队首压缩记录已解压到流式读取区的长度, -1--未解压
+
+  volatile unsigned long seq;		   //快照序号锁: 低16位--正在修改游标/记录表的个数, 其上--改完的次数
+
+#ifdef RB_SOJOURN
+  struct rb_histogram sojourn;		   //停留时间分布, 每个记录表项(合并帧算一项)取出时计入
+#endif
+};
+
+/**
+	RB_Snapshot的结果: data/items由调用者提供,
+	数据从读游标处展开成连续的一段, 第k条记录位于 data[items[k].read_index - read_index]
+	(未发布的合并帧不在其中)
+**/
+struct RB_Snap {
+		char *			data;		/*调用者提供*/
+		long long		data_cap;
+		struct RB_Buffer_Block *	items;	/*调用者提供*/
+		int			item_cap;
 
-  short int     item_read_index;	   //第一组数据的index
-  short int     item_write_index;	   //最后一组数据的idx
-  short int     item_counts;
+		unsigned long long	read_index;	/*快照时的游标*/
+		unsigned long long	write_index;
+		unsigned long long	item_read_index;
+		unsigned long long	item_write_index;
+		long long		used;		/*数据字节数*/
+		int			count;		/*记录数*/
+};
 
+/*分两步迁移(RB_MoveStart/RB_MoveCopy/RB_MoveFinish)时, 开始时的游标*/
+struct RB_MoveMark {
+		unsigned long long	read_index;
+		unsigned long long	write_index;
+		unsigned long long	item_read_index;
+		unsigned long long	item_write_index;
 };
 
 /*环形buffer初始化*/
 void  RB_init(struct RB_Buffer * buf);
 
-/*数据产生函数->数据加入队列*/
+/*使用外部数据空间初始化(可超过2GB), 只用其中不超过size的最大2的幂. 1--成功 0--失败
+  对已初始化的buf再次初始化时先释放其自有空间(同RB_Destroy), mem不能是这些空间*/
+int   RB_InitEx(struct RB_Buffer * buf, char * mem, long long size);
+
+/*释放RB_Resize分配的数据空间/记录表和RB_SetCodec分配的临时空间. 之后buf不能再用, 除非重新初始化*/
+void  RB_Destroy(struct RB_Buffer * buf);
+
+/*数据产生函数->数据加入队列, 返回写入长度, 0--空间不足*/
 int   RB_write(struct RB_Buffer * buf, const char * data, int length);
 
-/*数据消耗函数->取出队列First in数据*/
+/*数据消耗函数->取出队列First in数据, 超过SizeofData的部分截断*/
 int   RB_ReadItem(struct RB_Buffer * buf,  char *data, int SizeofData);	
 
+/*写入一个分片, more!=0 表示同一条记录还有后续分片; 大于ring的记录分片写入. 返回写入长度, 0--空间不足(稍后重写同一分片)*/
+int   RB_WriteChunk(struct RB_Buffer * buf, const char * data, int length, int more);
+
+/*流式读取队首记录从offset开始的部分(分片记录的offset为整条记录内的位置),
+  读到末尾的分片/记录出队, 整条记录读完时*last=1. 返回复制长度*/
+int   RB_ReadChunk(struct RB_Buffer * buf, int offset, char * data, int SizeofData, int * last);
+
 /*队列中数据个数*/
-short int RB_GetItemsCount(struct RB_Buffer * buf);
+int   RB_GetItemsCount(struct RB_Buffer * buf);
 
+/*原始数据空间; 生产者同时写入时内容可能不一致, 观察者请用RB_Snapshot*/
 char * RB_GetAllData(struct RB_Buffer * buf);
 
+/*不阻塞写入方的一致快照(可在其他线程调用, 但不要与RB_Resize并发: 旧空间会被释放)
+  return 记录数, -1--snap的空间不够(snap->used/count为所需大小), -2--重试次数用完*/
+int   RB_Snapshot(struct RB_Buffer * buf, struct RB_Snap * snap);
+
+/*改变数据空间和记录表大小(都向下取2的幂), 保留未读记录, 顺序和游标
+  new_items<=0 时记录表大小不变. return 1--成功 0--放不下现有数据或分配失败*/
+int   RB_Resize(struct RB_Buffer * buf, long long new_capacity, int new_items);
+
+/*把数据迁移到调用者提供的新空间, 旧空间不释放(由调用者负责). return 1--成功 0--放不下*/
+int   RB_Move(struct RB_Buffer * buf, char * mem, long long size, struct RB_Buffer_Block * items, int item_size);
+
+/*分两步迁移, 大块复制时不必挡住读写:
+  RB_MoveStart  记下游标(与读写互斥, 如持锁)
+  RB_MoveCopy   复制记下的数据和记录, 可与读写并发(不能与另一次迁移并发)
+  RB_MoveFinish 补上之后写入的部分并切换到新空间(与读写互斥). return 1--成功 0--放不下*/
+void  RB_MoveStart(struct RB_Buffer * buf, struct RB_MoveMark * mark);
+void  RB_MoveCopy(struct RB_Buffer * buf, char * mem, long long size, struct RB_Buffer_Block * items, int item_size, const struct RB_MoveMark * mark);
+int   RB_MoveFinish(struct RB_Buffer * buf, char * mem, long long size, struct RB_Buffer_Block * items, int item_size, const struct RB_MoveMark * mark);
+
+/*剩余可写空间*/
+long long RB_GetFreeSize(struct RB_Buffer * buf);
+
+/*复制记录表第slot条记录(游标 & item_mask), 不出队*/
+int   RB_CopyItem(struct RB_Buffer * buf, int slot, char * data, int SizeofData);
+
+/*丢弃队首记录*/
+int   RB_DropItem(struct RB_Buffer * buf);
+
+/*队首记录原样移到队尾(游标变为移动前的item_write_index), 让出队首空间. return 记录占用长度, 0--不能移动*/
+int   RB_Requeue(struct RB_Buffer * buf);
+
+/*查看第n条记录(0为队首, O(1)), 不复制不出队. return 记录占用长度, 0--队列中没有第n条*/
+int   RB_PeekItem(struct RB_Buffer * buf, int n, struct RB_View * view);
+
+/*从队首开始遍历队列中的记录, 不移动游标*/
+void  RB_IterBegin(struct RB_Buffer * buf, struct RB_Iter * it);
+
+/*下一条记录的视图. return 占用长度, 0--遍历结束*/
+int   RB_IterNext(struct RB_Buffer * buf, struct RB_Iter * it, struct RB_View * view);
+
+/*小记录合并: 长度小于frame_size的记录合并到一帧, 帧满/RB_FlushFrame/超时后才可读
+  frame_size为0关闭合并. RB_GetItemsCount按帧计数*/
+void  RB_SetCoalesce(struct RB_Buffer * buf, int frame_size, unsigned long timeout);
+
+/*立即发布未满的帧*/
+void  RB_FlushFrame(struct RB_Buffer * buf);
+
+/*定期调用, now为当前时间; 帧等待超过timeout后发布*/
+void  RB_PollFrame(struct RB_Buffer * buf, unsigned long now);
+
+/*设置压缩接口, 必须在写入数据之前调用. 按当时的ring大小分配临时空间(2*codec_max),
+  codec为NULL时释放. 1--成功 0--分配失败(不压缩)*/
+int   RB_SetCodec(struct RB_Buffer * buf, const struct RB_Codec * codec, int threshold);
+
+/*压缩统计: 原始字节数/占用字节数*/
+void  RB_GetCodecStats(struct RB_Buffer * buf, unsigned long * raw, unsigned long * stored);
+
+#ifdef RB_SOJOURN
+/*停留时间分布快照(RB_NOW的单位), 可用rb_hist_percentile查询*/
+void  RB_GetSojourn(struct RB_Buffer * buf, struct rb_histogram * snap);
+#endif
+
 /**
 //例子：
 struct RB_Buffer RBB;
@@ -52,5 +240,15 @@ RB_write(&RBB,"0123456789",10);
 RB_ReadItem(&RBB,swap,32);
 //RB_GetItemsCount(&RBB);
 
+//预读而不出队:
+//struct RB_View v; struct RB_Iter it;
+//if (RB_PeekItem(&RBB,1,&v)) 查看第二条记录v.data[0..v.length)(跨圈时接v.wrap);
+//for (RB_IterBegin(&RBB,&it); RB_IterNext(&RBB,&it,&v); ) 处理v;
+
+//大记录分片写入, 固定小缓冲读取:
+//for (off=0; off<len; off+=n) { n=min(64,len-off); while(!RB_WriteChunk(&RBB,&blob[off],n,off+n<len)) 等待消费; }
+//for (off=0, last=0; !last; off+=n) { n=RB_ReadChunk(&RBB,off,swap,32,&last); 处理swap[0..n); }
+
 **/
 
+#endif
@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 199309L	/* clock_gettime */
+
+#include <time.h>
+
+#include "rb_histogram.h"
+
+#ifdef __GNUC__
+#define RB_HIST_ADD(p, v)	__sync_fetch_and_add((p), (v))
+#define RB_HIST_CAS(p, o, n)	__sync_bool_compare_and_swap((p), (o), (n))
+#else
+#define RB_HIST_ADD(p, v)	(*(p) += (v))
+#define RB_HIST_CAS(p, o, n)	(*(p) = (n), 1)
+#endif
+
+/* Counters only grow, so a plain (aligned, 64-bit) load of each one is enough for a snapshot */
+#define RB_HIST_LOAD(p)		(*(volatile const rb_u64 *)(p))
+
+
+/**
+ * rb_now - monotonic clock in nanoseconds
+ */
+rb_u64 rb_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (rb_u64)ts.tv_sec * (rb_u64)1000000000 + (rb_u64)ts.tv_nsec;
+}
+
+
+/**
+ * rb_msb - index of the highest set bit of a (non-zero) value
+ */
+static int rb_msb(rb_u64 value)
+{
+#ifdef __GNUC__
+	return 63 - __builtin_clzll(value);
+#else
+	int n = 0;
+
+	while (value >>= 1) {
+		n++;
+	}
+	return n;
+#endif
+}
+
+
+/**
+ * rb_hist_bucket - bucket a value is counted in
+ */
+static int rb_hist_bucket(rb_u64 value)
+{
+	int shift;
+
+	if (value < RB_HIST_SUB_COUNT) {
+		return (int)value;
+	}
+
+	/* value >> shift keeps the top RB_HIST_SUB_BITS + 1 bits: RB_HIST_SUB_COUNT .. 2*RB_HIST_SUB_COUNT-1 */
+	shift = rb_msb(value) - RB_HIST_SUB_BITS;
+
+	return (shift + 1) * RB_HIST_SUB_COUNT + (int)(value >> shift) - RB_HIST_SUB_COUNT;
+}
+
+
+/**
+ * rb_hist_upper - largest value counted in a bucket
+ */
+static rb_u64 rb_hist_upper(int bucket)
+{
+	int shift;
+
+	if (bucket < RB_HIST_SUB_COUNT) {
+		return (rb_u64)bucket;
+	}
+
+	shift = bucket / RB_HIST_SUB_COUNT - 1;
+
+	return (((rb_u64)(bucket % RB_HIST_SUB_COUNT + RB_HIST_SUB_COUNT + 1)) << shift) - 1;
+}
+
+
+/**
+ * rb_hist_init - empty a histogram
+ *
+ * input: histogram
+ * output: none (void)
+ */
+void rb_hist_init(struct rb_histogram * hist)
+{
+	int i;
+
+	for (i = 0; i < RB_HIST_BUCKETS; i++) {
+		hist->count[i] = 0;
+	}
+
+	hist->total = 0;
+	hist->sum = 0;
+	hist->max = 0;
+}
+
+
+/**
+ * rb_hist_record - count one value (lock-free, safe from any thread)
+ *
+ * input: histogram, value (e.g. nanoseconds)
+ * output: none (void)
+ */
+void rb_hist_record(struct rb_histogram * hist, rb_u64 value)
+{
+	rb_u64 max;
+
+	RB_HIST_ADD(&hist->count[rb_hist_bucket(value)], 1);
+	RB_HIST_ADD(&hist->total, 1);
+	RB_HIST_ADD(&hist->sum, value);
+
+	for (max = hist->max; value > max; max = hist->max) {
+		if (RB_HIST_CAS(&hist->max, max, value)) {
+			break;
+		}
+	}
+}
+
+
+/**
+ * rb_hist_snapshot - copy a live histogram for reporting
+ *
+ * Each counter is read atomically while recording carries on.  The total
+ * of the copy is recomputed from its buckets, so percentiles taken from
+ * the snapshot are self-consistent.
+ *
+ * input: live histogram, histogram to fill in
+ * output: none (void)
+ */
+void rb_hist_snapshot(const struct rb_histogram * hist, struct rb_histogram * snap)
+{
+	int i;
+
+	snap->total = 0;
+
+	for (i = 0; i < RB_HIST_BUCKETS; i++) {
+		snap->count[i] = RB_HIST_LOAD(&hist->count[i]);
+		snap->total += snap->count[i];
+	}
+
+	snap->sum = RB_HIST_LOAD(&hist->sum);
+	snap->max = RB_HIST_LOAD(&hist->max);
+}
+
+
+/**
+ * rb_hist_percentile - value below which a given share of the recorded values fall
+ *
+ * input: histogram (normally a snapshot), percentile 0..100
+ * output: upper bound of the bucket holding that percentile, 0 if the histogram is empty
+ */
+rb_u64 rb_hist_percentile(const struct rb_histogram * hist, double percentile)
+{
+	rb_u64 rank, seen = 0;
+	int i;
+
+	if (hist->total == 0) {
+		return 0;
+	}
+
+	rank = (rb_u64)(percentile / 100.0 * (double)hist->total + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+	if (rank > hist->total) {
+		rank = hist->total;
+	}
+
+	for (i = 0; i < RB_HIST_BUCKETS; i++) {
+		seen += hist->count[i];
+		if (seen >= rank) {
+			return (rb_hist_upper(i) < hist->max) ? rb_hist_upper(i) : hist->max;
+		}
+	}
+
+	return hist->max;
+}
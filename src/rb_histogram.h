@@ -0,0 +1,52 @@
+#ifndef _RB_HISTOGRAM_H_
+#define _RB_HISTOGRAM_H_
+
+/**
+ * Log-linear (HDR-style) latency histogram.
+ *
+ * Values below RB_HIST_SUB_COUNT get a bucket each; above that, every power
+ * of two is split into RB_HIST_SUB_COUNT equal buckets, so any recorded value
+ * is known to within 1/RB_HIST_SUB_COUNT of itself across the full 64-bit
+ * range.  Recording is a single atomic add and may run on any number of
+ * threads at once; readers take a snapshot and query that.
+ */
+
+#include "rb_types.h"
+
+#define RB_HIST_SUB_BITS	4
+#define RB_HIST_SUB_COUNT	(1 << RB_HIST_SUB_BITS)
+#define RB_HIST_BUCKETS		((64 - RB_HIST_SUB_BITS + 1) * RB_HIST_SUB_COUNT)
+
+
+/**
+ * Timestamp source for sojourn times: CLOCK_MONOTONIC in nanoseconds.
+ * Build with RB_HIST_TSC for raw TSC ticks on x86 (cheaper, but in ticks),
+ * or define RB_NOW() to supply a clock of your own.
+ */
+#ifndef RB_NOW
+#if defined(RB_HIST_TSC) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RB_NOW()	((rb_u64)__builtin_ia32_rdtsc())
+#else
+#define RB_NOW()	rb_now()
+#endif
+#endif
+
+
+/**
+ * rb_histogram - counts of recorded values per bucket
+ */
+struct rb_histogram {
+	rb_u64 count[RB_HIST_BUCKETS];	/* values recorded in each bucket */
+	rb_u64 total;			/* number of values recorded */
+	rb_u64 sum;				/* sum of values recorded (for the mean) */
+	rb_u64 max;				/* largest value recorded */
+};
+
+
+rb_u64 rb_now(void);
+void rb_hist_init(struct rb_histogram *);
+void rb_hist_record(struct rb_histogram *, rb_u64); /* value */
+void rb_hist_snapshot(const struct rb_histogram *, struct rb_histogram *); /* live histogram, copy to fill in */
+rb_u64 rb_hist_percentile(const struct rb_histogram *, double); /* percentile 0..100; upper bound of its bucket */
+
+#endif
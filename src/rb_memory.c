@@ -0,0 +1,377 @@
+#define _GNU_SOURCE	/* MAP_ANONYMOUS, MAP_HUGETLB, MADV_HUGEPAGE, syscall() */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "rb_memory.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define RB_MPOL_BIND	2	/* MPOL_BIND from <numaif.h>, which may not be installed */
+#define RB_MAX_NODES	1024
+
+
+/**
+ * rb_round_up - round a size up to a multiple of a (power of two) granule
+ */
+static unsigned long rb_round_up(unsigned long size, unsigned long granule)
+{
+	return (size + granule - 1) & ~(granule - 1);
+}
+
+
+/**
+ * rb_region_bind - bind the pages of a region to one NUMA node
+ *
+ * input: region (base, mapped, node filled in)
+ * output: 0 if bound
+ *        -1 if the kernel has no NUMA support or the node does not exist
+ */
+static int rb_region_bind(struct rb_region * region)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	unsigned long mask[RB_MAX_NODES / (8 * sizeof(unsigned long))];
+	unsigned long bits = 8 * sizeof(unsigned long);
+
+	if (region->node < 0 || region->node >= RB_MAX_NODES) {
+		return -1;
+	}
+
+	memset(mask, 0, sizeof(mask));
+	mask[region->node / bits] = 1UL << (region->node % bits);
+
+	if (syscall(SYS_mbind, region->base, region->mapped, RB_MPOL_BIND, mask, RB_MAX_NODES, 0) != 0) {
+		return -1;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+
+/**
+ * rb_region_map - map storage for a ring
+ *
+ * Huge pages that cannot be had (none reserved) fall back to ordinary
+ * pages with transparent huge pages requested instead.  The NUMA policy
+ * is applied before anything touches the pages, so the optional prefault
+ * places every page on the requested node.
+ *
+ * input: region to fill in, size in bytes, RB_MEM_* flags, NUMA node
+ * output: 0 on success (region->flags holds the options that took effect)
+ *        -1 if no memory could be mapped at all
+ */
+int rb_region_map(struct rb_region * region, unsigned long size, int flags, int node)
+{
+	unsigned long page = (unsigned long)sysconf(_SC_PAGESIZE);
+	unsigned long i, lead;
+	char * map = MAP_FAILED;
+
+	region->base = NULL;
+	region->size = size;
+	region->mapped = 0;
+	region->flags = 0;
+	region->node = node;
+	region->chunks = 0;
+	region->trim_delay = 0;
+	region->last_write = 0;
+	region->released = 0;
+
+	if (size == 0) {
+		return -1;
+	}
+
+#ifdef MAP_HUGETLB
+	if (flags & RB_MEM_HUGETLB) {
+		region->mapped = rb_round_up(size, RB_HUGE_PAGE_SIZE);
+		map = mmap(NULL, region->mapped, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (map != MAP_FAILED) {
+			region->flags |= RB_MEM_HUGETLB;
+			page = RB_HUGE_PAGE_SIZE;
+		} else {
+			/* No huge pages reserved: try transparent ones instead */
+			flags |= RB_MEM_THP;
+		}
+	}
+#endif
+
+	if (map == MAP_FAILED) {
+		region->mapped = rb_round_up(size, page);
+
+#ifdef MADV_HUGEPAGE
+		if (flags & RB_MEM_THP) {
+			/* Over-map so the region can be trimmed to a huge page boundary */
+			region->mapped = rb_round_up(size, RB_HUGE_PAGE_SIZE);
+			map = mmap(NULL, region->mapped + RB_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (map != MAP_FAILED) {
+				lead = rb_round_up((unsigned long)map, RB_HUGE_PAGE_SIZE) - (unsigned long)map;
+				if (lead != 0) {
+					munmap(map, lead);
+				}
+				munmap(map + lead + region->mapped, RB_HUGE_PAGE_SIZE - lead);
+				map += lead;
+
+				if (madvise(map, region->mapped, MADV_HUGEPAGE) == 0) {
+					region->flags |= RB_MEM_THP;
+				}
+			}
+		}
+#endif
+
+		if (map == MAP_FAILED) {
+			region->mapped = rb_round_up(size, page);
+			map = mmap(NULL, region->mapped, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		}
+	}
+
+	if (map == MAP_FAILED) {
+		region->mapped = 0;
+		return -1;
+	}
+
+	region->base = map;
+
+	/* Single-node machines (or node out of range) simply stay unbound */
+	if ((flags & RB_MEM_NUMA) && rb_region_bind(region) == 0) {
+		region->flags |= RB_MEM_NUMA;
+	}
+
+	/* Pages are committed by the ring's own writes; idle ones can be trimmed */
+	if (flags & RB_MEM_LAZY) {
+		region->chunk = rb_round_up((region->mapped + RB_TRIM_CHUNKS - 1) / RB_TRIM_CHUNKS, page);
+		region->chunks = (int)((region->mapped + region->chunk - 1) / region->chunk);
+		for (i = 0; i < RB_TRIM_CHUNKS; i++) {
+			region->last_used[i] = 0;
+			region->touched[i] = 0;
+		}
+		region->flags |= RB_MEM_LAZY;
+		flags &= ~RB_MEM_PREFAULT;
+	}
+
+	/* First touch every page now, rather than on the hot path */
+	if (flags & RB_MEM_PREFAULT) {
+		for (i = 0; i < region->mapped; i += page) {
+			((volatile char *)region->base)[i] = 0;
+		}
+		region->flags |= RB_MEM_PREFAULT;
+	}
+
+	return 0;
+}
+
+
+/**
+ * rb_region_unmap - release a region mapped with rb_region_map
+ *
+ * input: region
+ * output: none (void)
+ */
+void rb_region_unmap(struct rb_region * region)
+{
+	if (region->base != NULL) {
+		munmap(region->base, region->mapped);
+	}
+
+	region->base = NULL;
+	region->size = 0;
+	region->mapped = 0;
+	region->flags = 0;
+	region->chunks = 0;
+}
+
+
+/**
+ * rb_region_set_trim - set how long a chunk must hold no live data before
+ *                      rb_region_trim gives it back
+ *
+ * input: region, delay (in the units of the times passed to the trim calls)
+ * output: none (void)
+ */
+void rb_region_set_trim(struct rb_region * region, rb_u64 delay)
+{
+	region->trim_delay = delay;
+}
+
+
+/**
+ * rb_region_mark - stamp the chunks under a span that wraps at a given size
+ */
+static void rb_region_mark(struct rb_region * region, unsigned long offset, unsigned long length,
+		unsigned long wrap, rb_u64 now)
+{
+	unsigned long end;
+	int c, last;
+
+	if (region->chunks == 0 || length == 0 || wrap == 0) {
+		return;
+	}
+
+	if (length >= wrap) {
+		offset = 0;
+		length = wrap;
+	}
+
+	offset %= wrap;
+	end = offset + length - 1;
+
+	/* Wrapped: the part from the start of the region first */
+	if (end >= wrap) {
+		rb_region_mark(region, 0, end - wrap + 1, wrap, now);
+		end = wrap - 1;
+	}
+
+	last = (int)(end / region->chunk);
+	for (c = (int)(offset / region->chunk); c <= last; c++) {
+		region->last_used[c] = now;
+		region->touched[c] = 1;
+	}
+}
+
+
+/**
+ * rb_region_touch - note that a span of the region holds live data
+ *
+ * The span is taken modulo region->size, so data that wraps around the end
+ * of a ring using the whole region can be passed as one span.
+ *
+ * input: region, offset, length, current time
+ * output: none (void)
+ */
+void rb_region_touch(struct rb_region * region, unsigned long offset, unsigned long length, rb_u64 now)
+{
+	rb_region_mark(region, offset, length, region->size, now);
+}
+
+
+/**
+ * rb_region_cursors - note where an RB_Buffer's live data is
+ *
+ * Everything written since the last call counts as touched, even if it has
+ * already been read, so no committed page is missed between calls.
+ *
+ * input: region holding the ring's data, size of the ring (RB_Buffer.size),
+ *        read cursor, write cursor, current time
+ * output: none (void)
+ */
+void rb_region_cursors(struct rb_region * region, unsigned long size,
+		rb_u64 read_index, rb_u64 write_index, rb_u64 now)
+{
+	rb_u64 from = region->last_write;
+
+	/* First call, or the ring was reset: only the unread data is known */
+	if (from > write_index) {
+		from = read_index;
+	}
+
+	/* Written since the last call, then what is still unread */
+	rb_region_mark(region, (unsigned long)(from % size),
+			(unsigned long)(write_index - from < size ? write_index - from : size), size, now);
+	rb_region_mark(region, (unsigned long)(read_index % size),
+			(unsigned long)(write_index - read_index < size ? write_index - read_index : size), size, now);
+
+	region->last_write = write_index;
+}
+
+
+/**
+ * rb_region_trim - give back every chunk that has held no live data for
+ *                  the trim delay
+ *
+ * MADV_DONTNEED drops the pages at once, so RSS falls immediately (MADV_FREE
+ * would leave them until the kernel is short of memory).  The next write to
+ * a released page faults in a fresh zero page.
+ *
+ * input: region, current time
+ * output: bytes given back by this call
+ */
+unsigned long rb_region_trim(struct rb_region * region, rb_u64 now)
+{
+	unsigned long length, released = 0;
+	int c;
+
+	for (c = 0; c < region->chunks; c++) {
+		/* Live at the last report (or within the delay): keep */
+		if (!region->touched[c] || region->last_used[c] + region->trim_delay >= now) {
+			continue;
+		}
+
+		length = region->chunk;
+		if ((c + 1) * region->chunk > region->mapped) {
+			length = region->mapped - c * region->chunk;
+		}
+
+		if (madvise(region->base + c * region->chunk, length, MADV_DONTNEED) == 0) {
+			region->touched[c] = 0;
+			released += length;
+		}
+	}
+
+	region->released += released;
+	return released;
+}
+
+
+/**
+ * rb_region_trim_ring - report an RB_Buffer's cursors and trim in one call
+ *
+ * The chunks holding unread data, and the one the next record goes into,
+ * are stamped live before anything is released.  No producer may write to
+ * the ring from the time the cursors are read until this returns (see the
+ * note in rb_memory.h): a record written meanwhile could land in a chunk
+ * that is about to be zeroed.
+ *
+ * input: region holding the ring's data, size of the ring (RB_Buffer.size),
+ *        read cursor, write cursor, current time
+ * output: bytes given back by this call
+ */
+unsigned long rb_region_trim_ring(struct rb_region * region, unsigned long size,
+		rb_u64 read_index, rb_u64 write_index, rb_u64 now)
+{
+	rb_region_cursors(region, size, read_index, write_index, now);
+	rb_region_mark(region, (unsigned long)(write_index % size), 1, size, now);
+	return rb_region_trim(region, now);
+}
+
+
+/**
+ * rb_region_resident - bytes of the mapping that are resident in memory
+ *                      (region->mapped is what is reserved)
+ *
+ * input: region
+ * output: resident bytes, as reported by mincore
+ */
+unsigned long rb_region_resident(const struct rb_region * region)
+{
+	unsigned char vec[256];
+	unsigned long page = (unsigned long)sysconf(_SC_PAGESIZE);	/* mincore counts base pages, even in huge page mappings */
+	unsigned long offset, length, i, resident = 0;
+
+	for (offset = 0; offset < region->mapped; offset += length) {
+		length = region->mapped - offset;
+		if (length > sizeof(vec) * page) {
+			length = sizeof(vec) * page;
+		}
+
+		if (mincore(region->base + offset, length, (void *)vec) != 0) {
+			break;
+		}
+
+		for (i = 0; i < (length + page - 1) / page; i++) {
+			if (vec[i] & 1) {
+				resident += page;
+			}
+		}
+	}
+
+	return resident;
+}
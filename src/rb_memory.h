@@ -0,0 +1,70 @@
+#ifndef _RB_MEMORY_H_
+#define _RB_MEMORY_H_
+
+#include "rb_types.h"
+
+/**
+ * Backing storage for large rings (POSIX hosts only).
+ *
+ * A region is mapped once and then handed to rb_init_ex (ring_mm) or
+ * RB_InitEx (RB_Buffer).  Every option degrades gracefully: if huge pages
+ * are not reserved or the NUMA node does not exist, the region is still
+ * mapped, and the corresponding bit is cleared from rb_region.flags so the
+ * caller can see what it actually got.
+ *
+ * A region mapped with RB_MEM_LAZY is committed page by page as the ring
+ * first writes to it, and can give idle pages back: the owner reports
+ * where live data is and releases every chunk that has held no live data
+ * for the trim delay (rb_region_trim_ring for RB_Buffer, rb_trim for
+ * ring_mm).  Resident memory then follows queue depth.
+ *
+ * Releasing a chunk zeroes it, so nothing may be written to the ring while
+ * it is trimmed: rb_trim holds the ring_mm lock, and rb_region_trim_ring
+ * must be called with the RB_Buffer's producers held off (holding their
+ * lock, or from the producer thread) and with the cursors read under the
+ * same exclusion.  rb_region_cursors and rb_region_trim used separately
+ * need the producers held off from one call to the other.
+ */
+
+#define RB_MEM_HUGETLB		0x01	/* explicit huge pages (MAP_HUGETLB) */
+#define RB_MEM_THP		0x02	/* transparent huge pages (MADV_HUGEPAGE) */
+#define RB_MEM_NUMA		0x04	/* bind pages to rb_region.node (mbind) */
+#define RB_MEM_PREFAULT		0x08	/* touch every page up front so no faults at runtime */
+#define RB_MEM_LAZY		0x10	/* commit pages on first write, let rb_region_trim give idle ones back (overrides RB_MEM_PREFAULT) */
+
+#define RB_TRIM_CHUNKS		64	/* granularity of idle tracking: the region is split into this many chunks */
+
+#define RB_HUGE_PAGE_SIZE	(2UL * 1024 * 1024)
+
+
+/**
+ * rb_region - a mapping of ring storage
+ */
+struct rb_region {
+	char * base;		/* Start of the mapping */
+	unsigned long size;	/* Bytes requested by the caller */
+	unsigned long mapped;	/* Bytes actually mapped (rounded up to the page size in use) */
+	int flags;		/* RB_MEM_* options that actually took effect */
+	int node;		/* NUMA node the pages are bound to (if RB_MEM_NUMA) */
+
+	/* Idle tracking (RB_MEM_LAZY) */
+	unsigned long chunk;		/* Bytes per chunk, a multiple of the page size */
+	int chunks;			/* Number of chunks covering the mapping */
+	rb_u64 trim_delay;		/* Idle time before a chunk is given back (caller's time units) */
+	rb_u64 last_write;		/* Write cursor seen by the last rb_region_cursors */
+	unsigned long released;		/* Bytes given back so far */
+	rb_u64 last_used		[RB_TRIM_CHUNKS];	/* Time each chunk was last seen holding live data */
+	char touched			[RB_TRIM_CHUNKS];	/* Set if the chunk may have resident pages */
+};
+
+
+int rb_region_map(struct rb_region *, unsigned long, int, int); /* size in bytes, RB_MEM_* flags, NUMA node */
+void rb_region_unmap(struct rb_region *);
+void rb_region_set_trim(struct rb_region *, rb_u64); /* idle time before a chunk is given back */
+void rb_region_touch(struct rb_region *, unsigned long, unsigned long, rb_u64); /* offset, length (may wrap), current time */
+void rb_region_cursors(struct rb_region *, unsigned long, rb_u64, rb_u64, rb_u64); /* RB_Buffer size, read cursor, write cursor, current time */
+unsigned long rb_region_trim(struct rb_region *, rb_u64); /* current time; returns bytes given back */
+unsigned long rb_region_trim_ring(struct rb_region *, unsigned long, rb_u64, rb_u64, rb_u64); /* RB_Buffer size, read cursor, write cursor, current time; returns bytes given back */
+unsigned long rb_region_resident(const struct rb_region *); /* bytes of the mapping resident now (region->mapped is reserved) */
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _RB_TYPES_H_
+#define _RB_TYPES_H_
+
+/**
+ * rb_u64 - unsigned 64-bit integer for cursors, times and counters
+ *
+ * long long only arrived with C99.  Under C89 a 64-bit long is used where
+ * the ABI has one; otherwise the compiler's own 64-bit type, marked as an
+ * extension so -pedantic builds stay quiet.  Write constants as
+ * (rb_u64)n rather than with a ULL suffix.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+typedef unsigned long long rb_u64;
+#elif defined(__LP64__) || defined(_LP64)
+typedef unsigned long rb_u64;
+#elif defined(__GNUC__)
+__extension__ typedef unsigned long long rb_u64;
+#elif defined(_MSC_VER)
+typedef unsigned __int64 rb_u64;
+#else
+#error "rb_u64: no 64-bit integer type known for this compiler"
+#endif
+
+/**
+ * rb_off - signed offset, length or handle within a ring's storage
+ *
+ * As wide as a pointer, so storage beyond 2 GB can be addressed on LLP64
+ * targets too, where long stays 32 bits.  C89 printf has no conversion
+ * for it: cast to long to print.
+ */
+#include <stddef.h>
+
+typedef ptrdiff_t rb_off;
+
+#endif
@@ -1,538 +1,2152 @@
+#define _POSIX_C_SOURCE 200112L	/* pthread_condattr_setclock, clock_gettime (USING_THREADS) */
+
+#include <stdio.h>
+
 #include "ring_buffer.h"
 
-struct mem_block * rb_separate(struct ring_mm * ring_buffer, struct mem_block * block_to_separate, int length);
+#ifdef USING_THREADS
+#include <errno.h>
+#include <time.h>
+#endif
+
+int rb_separate(struct ring_mm * ring_buffer, int block_to_separate, rb_off length);
+rb_off rb_memcpy(struct ring_mm * ring_buffer, int dest_block, const char * start_address, rb_off length);
+rb_off rb_wrap(const struct ring_mm * ring_buffer, rb_off unwrapped_index);
+int rb_collate(struct ring_mm * ring_buffer, int block_to_collate);
+static void rb_release_block(struct ring_mm * ring_buffer, int i);
+static void rb_fifo_sync(struct ring_mm * ring_buffer);
+static void rb_coalesce(struct ring_mm * ring_buffer);
+#ifdef USING_REGION
+static void rb_region_block(struct ring_mm * ring_buffer, int i, rb_u64 now);
+#endif
+static rb_off rb_slab_alloc(struct ring_mm * ring_buffer, rb_off length);
+static int rb_slab_find(const struct ring_mm * ring_buffer, rb_off start_index, int * object);
+static int rb_slab_free(struct ring_mm * ring_buffer, int s, int object);
+static int rb_slab_release(struct ring_mm * ring_buffer, int s, int object);
+static int rb_slab_trim(struct ring_mm * ring_buffer);
+#ifdef USING_THREADS
+static int rb_wait_block(struct ring_mm * ring_buffer, rb_off length, int alignment, long timeout_ms);
+static void rb_wake(struct ring_mm * ring_buffer);
+static void rb_wait_keep(struct ring_mm * ring_buffer);
+#define RB_WAKE(ring)		rb_wake(ring)
+#define RB_WAIT_KEEP(ring)	rb_wait_keep(ring)
+#define RB_WAITING(ring)	((ring)->wait_head != NULL)
+#else
+#define RB_WAKE(ring)
+#define RB_WAIT_KEEP(ring)
+#define RB_WAITING(ring)	0
+#endif
+
+/* Block lifetimes (USING_TIME): stamped when the block is handed out, counted when the last reference goes.
+ * A block reserved by rb_alloc is only stamped by rb_commit; one abandoned before that is not counted. */
+#ifdef USING_TIME
+static void rb_age_link(struct ring_mm * ring_buffer, int i);
+static void rb_age_unlink(struct ring_mm * ring_buffer, int i);
+static void rb_evict(struct ring_mm * ring_buffer, int i);
+#define RB_SOJOURN_DONE(ring, i)	(RB_BIT_TEST((ring)->committed_map, i) ? \
+						rb_hist_record(&(ring)->sojourn, RB_NOW() - (ring)->timestamp[i]) : (void)0)
+#define RB_SLAB_SOJOURN_DONE(ring, slab, object)	rb_hist_record(&(ring)->sojourn, RB_NOW() - (slab)->timestamp[object])
+#else
+#define RB_SOJOURN_DONE(ring, i)
+#define RB_SLAB_SOJOURN_DONE(ring, slab, object)
+#endif
 
 /**
- * rb_init - Initialize a ring buffer
- * 
+ * rb_init - Initialize a ring buffer using its built-in data array
+ *
  * input: a ring buffer struct to be initialized
  * output: none
  */
 void rb_init(struct ring_mm * ring_buffer)
+{
+	rb_init_ex(ring_buffer, ring_buffer->data, BUFFER_SIZE);
+}
+
+/**
+ * rb_init_ex - Initialize a ring buffer on caller-supplied storage
+ *              (e.g. a huge-page or NUMA-bound region from rb_region_map)
+ *
+ * input: ring buffer struct, start of storage, size of storage in bytes
+ * output: 0 on success
+ *        -1 if the storage is unusable
+ */
+int rb_init_ex(struct ring_mm * ring_buffer, char * storage, rb_off size)
 {
 	int i;
 
-	/* Initialize each metablock buffer */
+	if (storage == NULL || size <= 0) {
+		return -1;
+	}
+
+	ring_buffer->base = storage;
+	ring_buffer->size = size;
+
+	/* Initialize the metablock pool: nothing manifested, nothing in use */
+	for (i=0; i < RB_MAP_WORDS; i++)
+	{
+		ring_buffer->manifest_map[i] = 0;
+		ring_buffer->in_use_map[i] = 0;
+		ring_buffer->committed_map[i] = 0;
+		ring_buffer->slab_map[i] = 0;
+	}
+
+	for (i=0; i < RB_SLABS; i++)
+	{
+		ring_buffer->slab[i].block = -1;
+	}
+
 	for (i=0; i < MAX_ITEMS; i++)
 	{
-		ring_buffer->mem_blocks[i].manifest = 0;
-		ring_buffer->mem_blocks[i].in_use = 0;
-		ring_buffer->mem_blocks[i].start_index = 0;
-		ring_buffer->mem_blocks[i].timestamp = 0;
-		ring_buffer->mem_blocks[i].length = 0;
+		ring_buffer->start_index[i] = 0;
+		ring_buffer->length[i] = 0;
+		ring_buffer->refs[i] = 0;
+		ring_buffer->used[i] = 0;
+		ring_buffer->slab_of[i] = -1;
+#ifdef USING_TIME
+		ring_buffer->timestamp[i] = 0;
+		ring_buffer->age_prev[i] = -1;
+		ring_buffer->age_next[i] = RB_AGE_UNLINKED;
+#endif
 	}
-	
+
 	/* Create one large free block the size of entire buffer */
-	ring_buffer->mem_blocks[0].manifest = 1;
-	ring_buffer->mem_blocks[0].start_index = 0;
-	ring_buffer->mem_blocks[0].length = BUFFER_SIZE;
-	
+	RB_BIT_SET(ring_buffer->manifest_map, 0);
+	ring_buffer->start_index[0] = 0;
+	ring_buffer->length[0] = size;
+
 	ring_buffer->swap_in_use = 0;
+
+	RB_LOCK_INIT(&ring_buffer->lock);
+
+	ring_buffer->fifo_ok = 1;
+	ring_buffer->fifo_free = 0;
+
+#ifdef USING_THREADS
+	ring_buffer->wait_head = NULL;
+	ring_buffer->wait_pass = 0;
+	ring_buffer->wait_keep = -1;
+#endif
+
+#ifdef USING_TIME
+	rb_hist_init(&ring_buffer->sojourn);
+	ring_buffer->age_head = -1;
+	ring_buffer->age_tail = -1;
+	ring_buffer->ttl = 0;
+	ring_buffer->evict = 0;
+#endif
+
+#ifdef USING_REGION
+	ring_buffer->region = NULL;
+	ring_buffer->region_now = 0;
+#endif
+
+	return 0;
+}
+
+
+/**
+ * rb_ctz - index of the lowest set bit of a (non-zero) map word
+ */
+static int rb_ctz(unsigned long word)
+{
+#ifdef __GNUC__
+	return __builtin_ctzl(word);
+#else
+	int n = 0;
+
+	while ((word & 1UL) == 0) {
+		word >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+
+/**
+ * rb_next_block - iterate over the metablocks selected by a bitmap
+ *
+ * Scans a map one word at a time, so sparse maps cost one load per
+ * RB_WORD_BITS metablocks.  Start with from = 0, then pass the previous
+ * result + 1.
+ *
+ * input: map (RB_MAP_WORDS words), first metablock to consider
+ * output: next metablock whose bit is set, or -1 if there are none left
+ */
+static int rb_next_block(const unsigned long * map, int from)
+{
+	int w = from / RB_WORD_BITS;
+	unsigned long word;
+
+	if (from >= MAX_ITEMS) {
+		return -1;
+	}
+
+	word = map[w] & (~0UL << (from % RB_WORD_BITS));
+
+	for (;;) {
+		if (word != 0) {
+			from = w * RB_WORD_BITS + rb_ctz(word);
+			return (from < MAX_ITEMS) ? from : -1;
+		}
+		if (++w >= RB_MAP_WORDS) {
+			return -1;
+		}
+		word = map[w];
+	}
+}
+
+
+/**
+ * rb_next_free_block - like rb_next_block, for manifested blocks that are not in use
+ */
+static int rb_next_free_block(const struct ring_mm * ring_buffer, int from)
+{
+	int w = from / RB_WORD_BITS;
+	unsigned long word;
+
+	if (from >= MAX_ITEMS) {
+		return -1;
+	}
+
+	word = (ring_buffer->manifest_map[w] & ~ring_buffer->in_use_map[w]) & (~0UL << (from % RB_WORD_BITS));
+
+	for (;;) {
+		if (word != 0) {
+			from = w * RB_WORD_BITS + rb_ctz(word);
+			return (from < MAX_ITEMS) ? from : -1;
+		}
+		if (++w >= RB_MAP_WORDS) {
+			return -1;
+		}
+		word = ring_buffer->manifest_map[w] & ~ring_buffer->in_use_map[w];
+	}
+}
+
+
+/**
+ * rb_find_block - find the in-use block that begins at a certain index
+ *
+ * Slabs are not blocks in their own right: their first object shares the
+ * slab's start index, so they are skipped here and found by rb_slab_find.
+ * Blocks parked in a magazine stay in use but hold no references; they are
+ * skipped too, so a stale handle cannot read, retain or free them again.
+ *
+ * input: ring buffer, start index of block (the handle returned by rb_write)
+ * output: metablock number, -1 if no block in use starts there
+ */
+int rb_find_block(const struct ring_mm * ring_buffer, rb_off start_index)
+{
+	int i;
+
+	start_index = rb_wrap(ring_buffer, start_index);
+
+	for (i = rb_next_block(ring_buffer->in_use_map, 0); i >= 0; i = rb_next_block(ring_buffer->in_use_map, i + 1)) {
+		if (ring_buffer->start_index[i] == start_index && !RB_BIT_TEST(ring_buffer->slab_map, i)
+				&& ring_buffer->refs[i] > 0) {
+			return i;
+		}
+	}
+
+	return -1;
 }
 
 
 /**
  * rb_status - Print statistics to an output buffer
- * 
+ *
  * input: ring buffer, output buffer to print status
  * output: none (void)
  */
-void rb_status(const struct ring_mm * ring_buffer, const char * out_buffer)
+void rb_status(const struct ring_mm * ring_buffer, char * out_buffer)
 {
-	struct mem_block * curr;
-	int bytes_allocated = 0;
-	int total_bytes = 0;
+	rb_off bytes_allocated = 0;
+	rb_off total_bytes = 0;
 	int manifested_blocks = 0;
 	int blocks_in_use = 0;
 	int free_blocks = 0;
 	int i = 0;
-	
-	for (i=0;i<MAX_ITEMS;i++) {
-		curr = &(ring_buffer->mem_blocks[i]);
-		
-		if (curr->manifest == 1) {
-			manifested_blocks++;
-			total_bytes += curr->length;
-
-
-			if (curr->in_use == 1) {
-				bytes_allocated += curr->length;
-				blocks_in_use++;
-			} else {
-				free_blocks++;
-			}
 
+	RB_LOCK(&((struct ring_mm *)ring_buffer)->lock);
+	for (i = rb_next_block(ring_buffer->manifest_map, 0); i >= 0; i = rb_next_block(ring_buffer->manifest_map, i + 1)) {
+		manifested_blocks++;
+		total_bytes += ring_buffer->length[i];
+
+		if (RB_BIT_TEST(ring_buffer->in_use_map, i)) {
+			bytes_allocated += ring_buffer->length[i];
+			blocks_in_use++;
+		} else {
+			free_blocks++;
 		}
 	}
-	
+	RB_UNLOCK(&((struct ring_mm *)ring_buffer)->lock);
+
 	sprintf(out_buffer, "Ring Buffer Stats: \n"
 			"   metablocks:        %d\n"
 			"   manifested blocks: %d\n"
 			"     -blocks in use:  %d\n"
 			"     -blocks free:    %d\n"
-			"   accessable bytes:  %d\n"
-			"   allocated bytes:   %d\n\n",
-			MAX_ITEMS, manifested_blocks, blocks_in_use, free_blocks, total_bytes, bytes_allocated);
+			"   accessable bytes:  %ld\n"
+			"   allocated bytes:   %ld\n\n",
+			MAX_ITEMS, manifested_blocks, blocks_in_use, free_blocks, (long)total_bytes, (long)bytes_allocated);
 }
 
 /**
- * rb_get_nonmanifest_block - returns a nonmanifested block from the metablock list
- * 
+ * rb_get_nonmanifest_block - returns a nonmanifested block from the metablock pool
+ *
+ * Looks for the first clear bit in manifest_map, a word at a time.
+ *
  * input: ring buffer structure
- * output: struct mm_block object (with no manifestation in the buffer)
- *         returns NULL if there are non remaining
+ * output: metablock number (with no manifestation in the buffer)
+ *         returns -1 if there are non remaining
  */
-struct mm_block * rb_get_nonmanifest_block(struct ring_mm * ring_buffer)
+int rb_get_nonmanifest_block(struct ring_mm * ring_buffer)
 {
-	int i;
-	
-	/* Select first non-manifested block */
-	for (i=0; i < MAX_ITEMS; i++) {
-		if (ring_buffer->mem_blocks[i].manifest == 0) {
-			return (struct mm_block *)&(ring_buffer->mem_blocks[i]);
+	int w, i;
+	unsigned long word;
+
+	for (w=0; w < RB_MAP_WORDS; w++) {
+		word = ~ring_buffer->manifest_map[w];
+
+		if (word != 0) {
+			i = w * RB_WORD_BITS + rb_ctz(word);
+			return (i < MAX_ITEMS) ? i : -1;
 		}
 	}
-	
-	return NULL;
+
+	return -1;
 }
 
 /**
  * rb_separate - take a manifested but unused block and separate into two pieces,
  *               the first piece for the data, the second to remain as free
- * 
- * input: mem_block structure to be separated (written into)
- * output: mem_block stucture that remains free (as the user is expected to maintain the
- *         original pointer
+ *
+ * input: metablock to be separated (written into)
+ * output: metablock that remains free (as the user is expected to maintain the
+ *         original one), -1 if it cannot be separated
  */
-struct mem_block * rb_separate(struct ring_mm * ring_buffer, struct mem_block * block_to_separate, int length)
+int rb_separate(struct ring_mm * ring_buffer, int block_to_separate, rb_off length)
 {
-	struct mem_block * empty_block;
-	int remainder_size;
-	
-	if (block_to_separate->in_use == 1) {
-		return NULL;
+	int empty_block;
+	rb_off remainder_size;
+
+	if (RB_BIT_TEST(ring_buffer->in_use_map, block_to_separate)) {
+		return -1;
 	}
-	
-	if (block_to_separate->length < length) {
-		return NULL;
+
+	if (ring_buffer->length[block_to_separate] < length) {
+		return -1;
 	}
-	
+
 	empty_block = rb_get_nonmanifest_block(ring_buffer);
-	
-	if (empty_block == NULL) {
-		return NULL;
+
+	if (empty_block < 0) {
+		return -1;
 	}
-	
+
 	/* Size of just-manifested block */
-	remainder_size = block_to_separate->length - length;
-	
+	remainder_size = ring_buffer->length[block_to_separate] - length;
+
 	/* New block is not in use (free), but manifested in the ring buffer */
-	empty_block->in_use = 0;
-	empty_block->manifest = 1;
-	
+	RB_BIT_CLEAR(ring_buffer->in_use_map, empty_block);
+	RB_BIT_SET(ring_buffer->manifest_map, empty_block);
+
 	/* Set start index and length of free block */
-	empty_block->start_index = rb_wrap(block_to_separate->start_index + length);
-	empty_block->length = remainder_size;
+	ring_buffer->start_index[empty_block] = rb_wrap(ring_buffer, ring_buffer->start_index[block_to_separate] + length);
+	ring_buffer->length[empty_block] = remainder_size;
+
 
-	
 	/* Collate separated chunk */
 	/* rb_collate(ring_buffer, empty_block); */
-	
+
 	/* Shorten the size of the original block */
-	block_to_separate->length = length;
+	ring_buffer->length[block_to_separate] = length;
+
 
-	
 	/* Return block chopped off the end of the original */
 	return empty_block;
 }
 
 
 /**
- * rb_write - write a block of data to the buffer
- * 
- * input: ring structure, start address of memory to copy, length to copy
- * output: 0 on success, -ERRORVAL on error
- *         -1 not enough memory blocks left in memory manager OR none with enough room
+ * FIFO fast path
+ *
+ * When blocks are freed in the order they were written, all free space is
+ * a single block: allocation carves the front off it and the oldest block,
+ * when freed, sits right behind it.  Both then take a few assignments
+ * instead of a first-fit scan and a collate sweep.  rb_fifo_sync notices
+ * when an out-of-order free has left holes (and when they close again),
+ * and the general allocator handles everything in between.
  */
-int rb_write(struct ring_mm * ring_buffer, const char * start_address, int length)
+
+/**
+ * rb_fifo_sync - re-detect whether all free space is one block (caller holds the lock)
+ */
+static void rb_fifo_sync(struct ring_mm * ring_buffer)
 {
-	struct mem_block * current_block;
-	struct mem_block * open_block;
-	int i, n, bytes_copied = 0;
-	
-	/* Find first block with enough size (naive algorithm) */
-	for (i=0; i < MAX_ITEMS; i++) {
-		current_block = &(ring_buffer->mem_blocks[i]);
-		
-		/*
-		//printf("  current->manifest = %d\n", current_block->manifest);
-		//printf("  current->in_use   = %d\n", current_block->in_use);
-		//printf("  current->length   = %d\n", current_block->length);
-		*/		
+	int w, free_block = -1;
+	unsigned long word;
 
-		/* Find free block with sufficient size */
-		if (current_block->manifest == 1 
-			&& current_block->in_use == 0
-			&& current_block->length >= length){
-			
-						
-			/* If any leftover room at the end, turn it into a new free block
-			 * or merge with adjacent free block */
-			if (length < current_block->length) {
-				/* If there are not enough leftover blocks, return error */
-				if ((open_block=rb_separate(ring_buffer, current_block,length)) == NULL) {
-					return -1;
-				}
-			}						
-						
-						
-			/* Copy data to appropriate block in ring buffer */
-			
-			/* for (n = 0; n < length; n++) { */
-				bytes_copied = rb_memcpy(ring_buffer, current_block,start_address, length); 
-
-				if (bytes_copied != length) {
-					return -2;
-				}
-			/* } */
-			
-			/* Set this block to being used */
-			current_block->in_use = 1;
-			
-			
-			rb_collate(ring_buffer,open_block);
-			
-			/* Now exit */
-			return current_block->start_index;
+	for (w = 0; w < RB_MAP_WORDS; w++) {
+		word = ring_buffer->manifest_map[w] & ~ring_buffer->in_use_map[w];
+
+		if (word == 0) {
+			continue;
 		}
+
+		/* More than one free block: holes, stay on the general path */
+		if (free_block >= 0 || (word & (word - 1)) != 0) {
+			ring_buffer->fifo_ok = 0;
+			return;
+		}
+
+		free_block = w * RB_WORD_BITS + rb_ctz(word);
 	}
-	
-	return -1;
+
+	ring_buffer->fifo_ok = 1;
+	ring_buffer->fifo_free = free_block;
 }
 
+
 /**
- * rb_read - (for now) print out contents of block
- * 
- * input: ring buffer, block in buffer to print
- * output: 0 if ok
- *         -1 if block not in use or not manifested
+ * rb_room - bytes at the front of a free block that an allocation may take
+ *           (caller holds the lock)
+ *
+ * All of it, except for the block kept for the head waiter (rb_wait_keep):
+ * that one only lends what it has beyond the waiter's length.
  */
-int rb_read(const struct ring_mm * ring_buffer, int start_index, const char * dest, int length)
+static rb_off rb_room(const struct ring_mm * ring_buffer, int i)
 {
-	int i, n, found = 0, length_to_copy, wrap_index;
-	struct mem_block * block_to_read = NULL;
-	void * memcpy_status;
-	
-	for (n=0;n<MAX_ITEMS;n++) {
-		block_to_read = &(ring_buffer->mem_blocks[n]);
-		
-		if (block_to_read->start_index == rb_wrap(start_index)) {
-			found = 1;
-			break;
-		}
-	}
-	
-	if (found == 0) {
-		 return -1;
+#ifdef USING_THREADS
+	if (i == ring_buffer->wait_keep) {
+		return ring_buffer->length[i] - ring_buffer->wait_head->length;
 	}
-	
-	if (block_to_read->in_use == 0) {
-		return -1;
-	}
-	
-	if (block_to_read->manifest == 0) {
+#endif
+
+	return ring_buffer->length[i];
+}
+
+
+/**
+ * rb_fifo_alloc - carve a block off the front of the only free block (caller holds the lock)
+ *
+ * input: ring structure, length of block
+ * output: metablock number (in use, one reference)
+ *         -1 if not in FIFO order or there is no room (use the general path)
+ */
+static int rb_fifo_alloc(struct ring_mm * ring_buffer, rb_off length)
+{
+	int block, free_block = ring_buffer->fifo_free;
+
+	if (!ring_buffer->fifo_ok || free_block < 0 || rb_room(ring_buffer, free_block) < length) {
 		return -1;
 	}
-	
-	length_to_copy = block_to_read->length;
-	
-	if (length < length_to_copy) {
-		length_to_copy = length;
-	}
-	
-	if (block_to_read->start_index + block_to_read->length >= BUFFER_SIZE) {
-		wrap_index = BUFFER_SIZE - block_to_read->start_index;
-	} else {
-		wrap_index = 0;
-	}
-	
-#ifdef NATIVE_MEMCPY
-	if (wrap_index != 0) { /* + 1 */
-		memcpy_status = memcpy(dest, ring_buffer->data + start_index, length_to_copy);
-		if (memcpy_status != NULL) {
-			return length_to_copy;
-		}
-		return 0;
-	} else {
-		memcpy(dest,ring_buffer->data + block_to_read->start_index, wrap_index);
-		memcpy(dest + wrap_index,ring_buffer->data, length_to_copy - wrap_index);
-		return length_to_copy;
-	}
-#else
-	if (wrap_index != 0) { /* + 1 */
-		for (i=0; i < length_to_copy; i++) {
-			dest[i] = ring_buffer->data[block_to_read->start_index + i];
-		}
+
+	if (ring_buffer->length[free_block] == length) {
+		/* Exact fit: the free block itself is used and the buffer is full */
+		block = free_block;
+		ring_buffer->fifo_free = -1;
 	} else {
-		/* Copy to end of buffer */
-		for (i=0; i < wrap_index; i++) {
-			dest[i] = ring_buffer->data[block_to_read->start_index + i];
-		}
-		
-		/* Then wrap around and copy front of buffer */
-		for (i=0; i<(length_to_copy-wrap_index); i++) {
-			dest[wrap_index + i] = ring_buffer->data[i];
+		block = rb_get_nonmanifest_block(ring_buffer);
+
+		if (block < 0) {
+			return -1;
 		}
+
+		RB_BIT_SET(ring_buffer->manifest_map, block);
+		ring_buffer->start_index[block] = ring_buffer->start_index[free_block];
+		ring_buffer->length[block] = length;
+
+		ring_buffer->start_index[free_block] = rb_wrap(ring_buffer, ring_buffer->start_index[free_block] + length);
+		ring_buffer->length[free_block] -= length;
 	}
-	
-	return length_to_copy;
-#endif
+
+	RB_BIT_SET(ring_buffer->in_use_map, block);
+	ring_buffer->refs[block] = 1;
+	ring_buffer->used[block] = length;
+
+	return block;
 }
 
 
 /**
- * rb_memcpy - copy memory to a ring buffer from an arbitrary addres, for a 
- *             certain number of bytes
- * 
- * WARNING: you can pass an arbitrary length parameter, but this function will only copy
- *          to the size specified in the destination block.  So, be sure to check that 
- *          the amount of bytes copied is equal to the length you passed to this function.
- * 
- * input: ring buffer (destination), start address of source, number of bytes
- * output: amount of bytes copied
+ * rb_fifo_release - free the oldest block by growing the free block over it (caller holds the lock)
+ *
+ * input: ring structure, metablock to free
+ * output: 0 if freed
+ *         -1 if the block was freed out of order (use the general path)
  */
-int rb_memcpy(struct ring_mm * ring_buffer, struct mem_block * dest_block, char * start_address, int length)
+static int rb_fifo_release(struct ring_mm * ring_buffer, int i)
 {
-#ifdef NATIVE_MEMCPY
+	int free_block = ring_buffer->fifo_free;
 
-	int i, src_wrap_offset, remainder_length, bytes_copied = 0;
-	
-	
-	if (ring_buffer == NULL) {
-		return -1;
-	}
-	
-	if (dest_block == NULL) {
-		return -1;
-	}
-	
-	if (start_address == NULL) {
+	if (!ring_buffer->fifo_ok) {
 		return -1;
 	}
-	
-	/* Return error if destination block not large enough */
-	if (dest_block->length < length) {
-		return -1;
+
+	if (free_block < 0) {
+		/* Buffer was full: this block becomes the free space */
+		RB_BIT_CLEAR(ring_buffer->in_use_map, i);
+		ring_buffer->fifo_free = i;
+		return 0;
 	}
-	
-	if (length <= 0) {
+
+	if (rb_wrap(ring_buffer, ring_buffer->start_index[free_block] + ring_buffer->length[free_block]) != ring_buffer->start_index[i]) {
 		return -1;
 	}
-	
-	/* If this data will need to wrap around end of buffer */
-	if (dest_block->start_index + dest_block->length > BUFFER_SIZE) {
-		src_wrap_offset = BUFFER_SIZE - dest_block->start_index; /* - dest_block->length; */
-		remainder_length = length - src_wrap_offset;
 
-		/**
-		 * WARNING:
-		 * This could be a problem if not word-aligned...
-		 * Though, I have no idea....
-		 */
+	ring_buffer->length[free_block] += ring_buffer->length[i];
+	RB_BIT_CLEAR(ring_buffer->in_use_map, i);
+	RB_BIT_CLEAR(ring_buffer->manifest_map, i);
+
+	return 0;
+}
+
+
+/**
+ * rb_first_fit - take the first free block with room, trimmed to the given length
+ *
+ * input: ring structure, length of block
+ * output: metablock number (in use, one reference)
+ *         -1 not enough memory blocks left in memory manager OR none with enough room
+ */
+static int rb_first_fit(struct ring_mm * ring_buffer, rb_off length)
+{
+	int current_block;
+	int open_block = -1;
+
+	/* Find first free block with enough size (naive algorithm) */
+	for (current_block = rb_next_free_block(ring_buffer, 0);
+		current_block >= 0;
+		current_block = rb_next_free_block(ring_buffer, current_block + 1)) {
 
 		/*
-		printf(" *** [1] Copying from %16X (index=%d) for %d byte(s)...\n", start_address, 0, src_wrap_offset);
-		*/
-		
-		/* NOTE:  memcpy(destination, source, length) */
-		
-		/* Copy to edge of buffer */
-		memcpy(	ring_buffer->data + dest_block->start_index,
-				start_address,
-				src_wrap_offset);
-		
-		/*
-		printf(" *** [2] Copying from %16X (index=%d) for %d byte(s)...\n", start_address, src_wrap_offset, remainder_length);
+		//printf("  current->length   = %d\n", ring_buffer->length[current_block]);
 		*/
-		
-		/* Then wrap around and copy the remainder */		
-		memcpy( ring_buffer->data,
-				start_address + src_wrap_offset /* + 1 */,
-				remainder_length);
-				
-		return length;		
-	} else {
-		
-		/* If data does not need to be wrapped... */
-		src_wrap_offset = remainder_length = 0;
-		
-		memcpy( ring_buffer->data + dest_block->start_index,
-				start_address,
-				length);
-		return length;
-	}
-	
 
-#else
-	int i, bytes_copied = 0;
-	
-	/* Copy byte-by-byte (very slow!) */
-	for (i=0; (i < length) && (i < dest_block->length); i++) {
-		ring_buffer->data[rb_wrap(dest_block->start_index + i)] = start_address[i];
-		bytes_copied++;
+		/* Find free block with sufficient size */
+		if (rb_room(ring_buffer, current_block) >= length){
+
+
+			/* If any leftover room at the end, turn it into a new free block
+			 * or merge with adjacent free block */
+			if (length < ring_buffer->length[current_block]) {
+				/* If there are not enough leftover blocks, return error */
+				if ((open_block=rb_separate(ring_buffer, current_block,length)) < 0) {
+					return -1;
+				}
+			}
+
+			/* Set this block to being used */
+			RB_BIT_SET(ring_buffer->in_use_map, current_block);
+			ring_buffer->refs[current_block] = 1;
+			ring_buffer->used[current_block] = length;
+
+
+			rb_collate(ring_buffer,open_block);
+
+			/* Now exit */
+			return current_block;
+		}
 	}
-	
-	return bytes_copied;	
-	
-#endif /*NATIVE_MEMCPY*/
+
+	return -1;
 }
 
 
 /**
- * rb_wrap - wraps a ring buffer index
- * 
- * input: unwrapped index
- * output: wrapped index (ensures index remains in buffer bounds)
+ * rb_aligned_fit - take a contiguous, aligned block from the first free block that has one
+ *
+ * The block may start part way into a free block: the lead-in before it
+ * (alignment padding, or the part of a wrapping free block before the end
+ * of the buffer) is split off and stays free, as does anything after it.
+ *
+ * input: ring structure, length of block, alignment of its address (power of two)
+ * output: metablock number (in use, one reference)
+ *         -1 no free block has room for an aligned block that does not wrap
  */
-int rb_wrap(int unwrapped_index)
+static int rb_aligned_fit(struct ring_mm * ring_buffer, rb_off length, int alignment)
 {
-	return (unwrapped_index % BUFFER_SIZE);
-}
+	int free_block, block, open_block = -1;
+	rb_off start, lead, pad;
 
+	for (free_block = rb_next_free_block(ring_buffer, 0);
+		free_block >= 0;
+		free_block = rb_next_free_block(ring_buffer, free_block + 1)) {
 
+		start = ring_buffer->start_index[free_block];
 
+		/* Aligned start in the part of the free block before the end of the buffer */
+		pad = (rb_off)((alignment - ((unsigned long)(ring_buffer->base + start) & (alignment - 1))) & (alignment - 1));
+		lead = pad;
 
-/**
- * rb_free - free a block of memory that begins at a certain index
- *           supposed to be identical to stdlib free, where you pass
+		if (start + lead + length > ring_buffer->size) {
+			/* ... otherwise in the part that wrapped around to the front */
+			pad = (rb_off)((alignment - ((unsigned long)ring_buffer->base & (alignment - 1))) & (alignment - 1));
+			lead = ring_buffer->size - start + pad;
+
+			if (start + ring_buffer->length[free_block] <= ring_buffer->size) {
+				continue;
+			}
+		}
+
+		if (lead + length > rb_room(ring_buffer, free_block)) {
+			continue;
+		}
+
+		/* Leave the lead-in free, in the original metablock */
+		block = free_block;
+		if (lead > 0 && (block = rb_separate(ring_buffer, free_block, lead)) < 0) {
+			return -1;
+		}
+
+		/* And the tail after the block */
+		if (length < ring_buffer->length[block]) {
+			if ((open_block = rb_separate(ring_buffer, block, length)) < 0) {
+				if (block != free_block) {
+					rb_collate(ring_buffer, free_block);
+				}
+				return -1;
+			}
+		}
+
+		RB_BIT_SET(ring_buffer->in_use_map, block);
+		ring_buffer->refs[block] = 1;
+		ring_buffer->used[block] = length;
+
+		rb_collate(ring_buffer, open_block);
+
+		return block;
+	}
+
+	return -1;
+}
+
+
+/**
+ * rb_fit - place a block: anywhere (it may wrap) with alignment 0, else contiguous and aligned
+ */
+static int rb_fit(struct ring_mm * ring_buffer, rb_off length, int alignment)
+{
+	if (alignment > 0) {
+		return rb_aligned_fit(ring_buffer, length, alignment);
+	}
+
+	return rb_first_fit(ring_buffer, length);
+}
+
+
+/**
+ * rb_alloc_block - take a free block of exactly the given length (caller holds the lock)
+ *
+ * The block is marked in use with one reference, so it stays put while the
+ * caller fills it after dropping the lock.  If nothing fits, empty slabs
+ * are given back and the search repeated; in eviction mode (rb_set_expiry)
+ * the oldest blocks are then dropped, one at a time, until the length fits.
+ *
+ * A block placed with alignment 0 is committed (readable) at once; an
+ * aligned one is left for rb_commit.
+ *
+ * While callers wait in rb_wait_block, every search made for anyone but
+ * the head waiter first sets a free block aside for it (rb_wait_keep).
+ *
+ * input: ring structure, length of block, alignment (0: may wrap, see rb_fit)
+ * output: metablock number
+ *         -1 not enough memory blocks left in memory manager OR none with enough room
+ */
+static int rb_alloc_block(struct ring_mm * ring_buffer, rb_off length, int alignment)
+{
+	int block = -1;
+
+	RB_WAIT_KEEP(ring_buffer);
+
+	if (alignment == 0) {
+		block = rb_fifo_alloc(ring_buffer, length);
+	}
+
+	if (block < 0) {
+		block = rb_fit(ring_buffer, length, alignment);
+		rb_fifo_sync(ring_buffer);
+	}
+
+	/* Empty slabs kept for the next small write are worth less than this allocation */
+	if (block < 0 && rb_slab_trim(ring_buffer) > 0) {
+		RB_WAIT_KEEP(ring_buffer);
+		block = rb_fit(ring_buffer, length, alignment);
+		rb_fifo_sync(ring_buffer);
+	}
+
+#ifdef USING_TIME
+	while (block < 0 && ring_buffer->evict && ring_buffer->age_head >= 0) {
+		rb_evict(ring_buffer, ring_buffer->age_head);
+		RB_WAIT_KEEP(ring_buffer);
+		block = rb_fit(ring_buffer, length, alignment);
+		rb_fifo_sync(ring_buffer);
+	}
+#endif
+
+	if (block < 0) {
+		return -1;
+	}
+
+#ifdef USING_REGION
+	/* Its pages are about to be written: not to be trimmed before the next rb_trim looks */
+	if (ring_buffer->region != NULL) {
+		rb_region_block(ring_buffer, block, ring_buffer->region_now);
+	}
+#endif
+
+	if (alignment == 0) {
+		RB_BIT_SET(ring_buffer->committed_map, block);
+#ifdef USING_TIME
+		rb_age_link(ring_buffer, block);
+#endif
+	} else {
+		RB_BIT_CLEAR(ring_buffer->committed_map, block);
+	}
+
+	return block;
+}
+
+
+/**
+ * rb_write - write a block of data to the buffer
+ *
+ * Up to RB_SLAB_MAX_SIZE bytes go into a slab object when there is room
+ * for one.  Such an object is used exactly like any other block.
+ *
+ * input: ring structure, start address of memory to copy, length to copy
+ * output: start index of the block on success (pass it to rb_read/rb_free), -ERRORVAL on error
+ *         -1 not enough memory blocks left in memory manager OR none with enough room
+ *            (or the room left is kept for a caller waiting in rb_write_timed/rb_alloc_wait)
+ */
+rb_off rb_write(struct ring_mm * ring_buffer, const char * start_address, rb_off length)
+{
+	int current_block;
+	rb_off object, bytes_copied = 0;
+
+	if (length <= 0) {
+		return -1;
+	}
+
+	if (length <= RB_SLAB_MAX_SIZE) {
+		RB_LOCK(&ring_buffer->lock);
+		object = rb_slab_alloc(ring_buffer, length);
+		RB_UNLOCK(&ring_buffer->lock);
+
+		if (object >= 0) {
+#ifdef NATIVE_MEMCPY
+			memcpy(ring_buffer->base + object, start_address, length);
+#else
+			for (bytes_copied = 0; bytes_copied < length; bytes_copied++) {
+				ring_buffer->base[object + bytes_copied] = start_address[bytes_copied];
+			}
+#endif
+			return object;
+		}
+	}
+
+	RB_LOCK(&ring_buffer->lock);
+	current_block = rb_alloc_block(ring_buffer, length, 0);
+	RB_UNLOCK(&ring_buffer->lock);
+
+	if (current_block < 0) {
+		return -1;
+	}
+
+	/* Copy data to appropriate block in ring buffer (nobody else knows the block yet) */
+
+	bytes_copied = rb_memcpy(ring_buffer, current_block, start_address, length);
+
+	if (bytes_copied != length) {
+		RB_LOCK(&ring_buffer->lock);
+		rb_release_block(ring_buffer, current_block);
+		RB_UNLOCK(&ring_buffer->lock);
+		return -2;
+	}
+
+	return ring_buffer->start_index[current_block];
+}
+
+/**
+ * rb_alloc - reserve a block to build data in place
+ *
+ * The block is contiguous in memory (never split across the end of the
+ * buffer) and its address is a multiple of alignment.  Any padding needed
+ * for that stays in free space.  Until rb_commit the block cannot be read
+ * or viewed; rb_free abandons it.
+ *
+ * input: ring structure, length of block, alignment (power of two, 0 or 1 for none),
+ *        where to store the address of the block
+ * output: start index of the block on success (pass it to rb_commit)
+ *         -1 no room for such a block
+ *         -3 if alignment is not a power of two
+ */
+rb_off rb_alloc(struct ring_mm * ring_buffer, rb_off length, int alignment, char ** ptr)
+{
+	int block;
+
+	if (alignment <= 0) {
+		alignment = 1;
+	}
+
+	if ((alignment & (alignment - 1)) != 0) {
+		return -3;
+	}
+
+	if (length <= 0 || length > ring_buffer->size) {
+		return -1;
+	}
+
+	RB_LOCK(&ring_buffer->lock);
+	block = rb_alloc_block(ring_buffer, length, alignment);
+	RB_UNLOCK(&ring_buffer->lock);
+
+	if (block < 0) {
+		return -1;
+	}
+
+	*ptr = ring_buffer->base + ring_buffer->start_index[block];
+
+	return ring_buffer->start_index[block];
+}
+
+
+/**
+ * rb_commit - make a block reserved with rb_alloc readable
+ *
+ * input: ring structure, start index from rb_alloc, bytes actually written
+ *        (at most the length reserved)
+ * output: 0 if ok
+ *         -1 if no uncommitted block starts there, or length is too large
+ */
+int rb_commit(struct ring_mm * ring_buffer, rb_off start_index, rb_off length)
+{
+	int i;
+
+	RB_LOCK(&ring_buffer->lock);
+	i = rb_find_block(ring_buffer, start_index);
+
+	if (i >= 0 && (RB_BIT_TEST(ring_buffer->committed_map, i)
+			|| length < 0 || length > ring_buffer->length[i])) {
+		i = -1;
+	}
+
+	if (i >= 0) {
+		ring_buffer->used[i] = length;
+		RB_BIT_SET(ring_buffer->committed_map, i);
+#ifdef USING_TIME
+		rb_age_link(ring_buffer, i);
+#endif
+	}
+	RB_UNLOCK(&ring_buffer->lock);
+
+	return (i < 0) ? -1 : 0;
+}
+
+
+/**
+ * rb_read - copy the contents of a block out of the buffer
+ *
+ * input: ring buffer, start index of block, destination, size of destination
+ * output: number of bytes copied
+ *         -1 if no committed block starts at start_index
+ */
+rb_off rb_read(const struct ring_mm * ring_buffer, rb_off start_index, char * dest, rb_off length)
+{
+	int block_to_read, s, object;
+	rb_off length_to_copy, wrap_index;
+	void * memcpy_status;
+
+	/* The lock only covers the lookup: the caller's own reference keeps
+	 * the block in place while it is copied */
+	RB_LOCK(&((struct ring_mm *)ring_buffer)->lock);
+	block_to_read = rb_find_block(ring_buffer, start_index);
+
+	if (block_to_read >= 0 && !RB_BIT_TEST(ring_buffer->committed_map, block_to_read)) {
+		block_to_read = -1;
+	}
+
+	if (block_to_read >= 0) {
+		start_index = ring_buffer->start_index[block_to_read];
+		length_to_copy = ring_buffer->used[block_to_read];
+	} else if ((s = rb_slab_find(ring_buffer, start_index, &object)) >= 0) {
+		block_to_read = ring_buffer->slab[s].block;
+		start_index = ring_buffer->start_index[block_to_read] + (rb_off)object * ring_buffer->slab[s].size;
+		length_to_copy = ring_buffer->slab[s].used[object];
+	}
+	RB_UNLOCK(&((struct ring_mm *)ring_buffer)->lock);
+
+	if (block_to_read < 0) {
+		 return -1;
+	}
+
+	if (length < length_to_copy) {
+		length_to_copy = length;
+	}
+
+	if (start_index + length_to_copy > ring_buffer->size) {
+		wrap_index = ring_buffer->size - start_index;
+	} else {
+		wrap_index = 0;
+	}
+
+#ifdef NATIVE_MEMCPY
+	if (wrap_index == 0) {
+		memcpy_status = memcpy(dest, ring_buffer->base + start_index, length_to_copy);
+		if (memcpy_status != NULL) {
+			return length_to_copy;
+		}
+		return 0;
+	} else {
+		memcpy(dest,ring_buffer->base + start_index, wrap_index);
+		memcpy(dest + wrap_index,ring_buffer->base, length_to_copy - wrap_index);
+		return length_to_copy;
+	}
+#else
+	if (wrap_index == 0) {
+		for (i=0; i < length_to_copy; i++) {
+			dest[i] = ring_buffer->base[start_index + i];
+		}
+	} else {
+		/* Copy to end of buffer */
+		for (i=0; i < wrap_index; i++) {
+			dest[i] = ring_buffer->base[start_index + i];
+		}
+
+		/* Then wrap around and copy front of buffer */
+		for (i=0; i<(length_to_copy-wrap_index); i++) {
+			dest[wrap_index + i] = ring_buffer->base[i];
+		}
+	}
+
+	return length_to_copy;
+#endif
+}
+
+
+/**
+ * rb_memcpy - copy memory to a ring buffer from an arbitrary addres, for a
+ *             certain number of bytes
+ *
+ * WARNING: you can pass an arbitrary length parameter, but this function will only copy
+ *          to the size specified in the destination block.  So, be sure to check that
+ *          the amount of bytes copied is equal to the length you passed to this function.
+ *
+ * input: ring buffer (destination), destination metablock, start address of source, number of bytes
+ * output: amount of bytes copied
+ */
+rb_off rb_memcpy(struct ring_mm * ring_buffer, int dest_block, const char * start_address, rb_off length)
+{
+#ifdef NATIVE_MEMCPY
+
+	rb_off src_wrap_offset, remainder_length, dest_index;
+
+
+	if (ring_buffer == NULL) {
+		return -1;
+	}
+
+	if (dest_block < 0) {
+		return -1;
+	}
+
+	if (start_address == NULL) {
+		return -1;
+	}
+
+	/* Return error if destination block not large enough */
+	if (ring_buffer->length[dest_block] < length) {
+		return -1;
+	}
+
+	if (length <= 0) {
+		return -1;
+	}
+
+	dest_index = ring_buffer->start_index[dest_block];
+
+	/* If this data will need to wrap around end of buffer */
+	if (dest_index + length > ring_buffer->size) {
+		src_wrap_offset = ring_buffer->size - dest_index;
+		remainder_length = length - src_wrap_offset;
+
+		/**
+		 * WARNING:
+		 * This could be a problem if not word-aligned...
+		 * Though, I have no idea....
+		 */
+
+		/* NOTE:  memcpy(destination, source, length) */
+
+		/* Copy to edge of buffer */
+		memcpy(	ring_buffer->base + dest_index,
+				start_address,
+				src_wrap_offset);
+
+		/* Then wrap around and copy the remainder */
+		memcpy( ring_buffer->base,
+				start_address + src_wrap_offset,
+				remainder_length);
+
+		return length;
+	} else {
+
+		/* If data does not need to be wrapped... */
+		memcpy( ring_buffer->base + dest_index,
+				start_address,
+				length);
+		return length;
+	}
+
+
+#else
+	rb_off i, bytes_copied = 0;
+
+	/* Copy byte-by-byte (very slow!) */
+	for (i=0; (i < length) && (i < ring_buffer->length[dest_block]); i++) {
+		ring_buffer->base[rb_wrap(ring_buffer, ring_buffer->start_index[dest_block] + i)] = start_address[i];
+		bytes_copied++;
+	}
+
+	return bytes_copied;
+
+#endif /*NATIVE_MEMCPY*/
+}
+
+
+/**
+ * rb_wrap - wraps a ring buffer index
+ *
+ * input: ring buffer, unwrapped index
+ * output: wrapped index (ensures index remains in buffer bounds)
+ */
+rb_off rb_wrap(const struct ring_mm * ring_buffer, rb_off unwrapped_index)
+{
+	return (unwrapped_index % ring_buffer->size);
+}
+
+
+
+
+/**
+ * rb_free - free a block of memory that begins at a certain index
+ *           supposed to be identical to stdlib free, where you pass
  *           a pointer.
- * 
+ *
+ * This drops the reference rb_write gave to the writer.  If other holders
+ * took references (rb_retain, rb_view), the block stays readable and is
+ * only reclaimed when the last of them calls rb_release.
+ *
  * intput: ring buffer, index where data block starts
- * output: 0 if free successful
+ * output: 0 if free successful (or deferred until the last reference is dropped)
+ *         -1 error (no block found with this start address)
+ */
+int rb_free(struct ring_mm * ring_buffer, rb_off start_index)
+{
+	return rb_release(ring_buffer, start_index);
+}
+
+
+/**
+ * rb_retain - take an extra reference on a block, so that it can be
+ *             handed to another consumer without copying
+ *
+ * input: ring buffer, index where data block starts
+ * output: 0 if ok
+ *         -1 error (no block found with this start address, or its last
+ *            reference is already gone)
+ */
+int rb_retain(struct ring_mm * ring_buffer, rb_off start_index)
+{
+	int i, s, object;
+
+	RB_LOCK(&ring_buffer->lock);
+	i = rb_find_block(ring_buffer, start_index);
+
+	if (i >= 0) {
+		RB_ATOMIC_INC(&ring_buffer->refs[i]);
+	} else if ((s = rb_slab_find(ring_buffer, start_index, &object)) >= 0) {
+		RB_ATOMIC_INC(&ring_buffer->slab[s].refs[object]);
+		i = 0;
+	}
+	RB_UNLOCK(&ring_buffer->lock);
+
+	return (i < 0) ? -1 : 0;
+}
+
+
+/**
+ * rb_release - drop a reference on a block; the last one returns the
+ *              block to free space
+ *
+ * input: ring buffer, index where data block starts
+ * output: 0 if ok
  *         -1 error (no block found with this start address)
  */
-int rb_free(struct ring_mm * ring_buffer, int start_index)
-{
-	struct mem_block * current_block;
-	int i, return_value;
-	
-	for (i=0; i < MAX_ITEMS; i++) {
-		current_block = &(ring_buffer->mem_blocks[i]);
-		
-		if (current_block->start_index == start_index
-			&& current_block->in_use == 1) {
-			current_block->in_use = 0;
-			
-			return_value = 0;
+int rb_release(struct ring_mm * ring_buffer, rb_off start_index)
+{
+	int i, s, object;
+
+	RB_LOCK(&ring_buffer->lock);
+	i = rb_find_block(ring_buffer, start_index);
+
+	if (i < 0 && (s = rb_slab_find(ring_buffer, start_index, &object)) >= 0) {
+		i = rb_slab_release(ring_buffer, s, object);
+	} else if (i >= 0 && RB_ATOMIC_DEC(&ring_buffer->refs[i]) == 0) {
+		RB_SOJOURN_DONE(ring_buffer, i);
+		rb_release_block(ring_buffer, i);
+	}
+	RB_UNLOCK(&ring_buffer->lock);
+
+	return (i < 0) ? -1 : 0;
+}
+
+
+/**
+ * rb_free_many - free a batch of blocks, coalescing free space once
+ *
+ * Each handle is dropped as by rb_free, but blocks that are freed out of
+ * order are only marked free; the free neighbourhoods are merged in a
+ * single pass by address at the end, instead of a full sweep per block.
+ *
+ * input: ring buffer, start indexes of blocks, number of them,
+ *        status of each (0 ok, -1 no block found), or NULL
+ * output: number of handles freed
+ */
+int rb_free_many(struct ring_mm * ring_buffer, const rb_off * start_index, int count, int * status)
+{
+	int k, i, s, object, freed = 0, holes = 0;
+
+	RB_LOCK(&ring_buffer->lock);
+	for (k = 0; k < count; k++) {
+		i = rb_find_block(ring_buffer, start_index[k]);
+
+		if (i < 0 && (s = rb_slab_find(ring_buffer, start_index[k], &object)) >= 0) {
+			i = rb_slab_release(ring_buffer, s, object);
+		} else if (i >= 0 && RB_ATOMIC_DEC(&ring_buffer->refs[i]) == 0) {
+			RB_SOJOURN_DONE(ring_buffer, i);
+#ifdef USING_TIME
+			rb_age_unlink(ring_buffer, i);
+#endif
+			if (rb_fifo_release(ring_buffer, i) != 0) {
+				/* A hole: the FIFO path stays off until rb_fifo_sync has looked again */
+				RB_BIT_CLEAR(ring_buffer->in_use_map, i);
+				ring_buffer->fifo_ok = 0;
+				holes = 1;
+			}
+		}
+
+		if (status != NULL) {
+			status[k] = (i < 0) ? -1 : 0;
+		}
+		if (i >= 0) {
+			freed++;
+		}
+	}
+
+	if (holes) {
+		rb_coalesce(ring_buffer);
+		rb_fifo_sync(ring_buffer);
+	}
+	RB_WAKE(ring_buffer);
+	RB_UNLOCK(&ring_buffer->lock);
+
+	return freed;
+}
+
+
+/**
+ * rb_coalesce - merge every run of adjacent free blocks (caller holds the lock)
+ *
+ * The manifested blocks tile the buffer, so sorted by start index each one
+ * is followed by its neighbour; a run of free blocks folds into its first
+ * block, and a run at the end of the buffer into one at the start.
+ *
+ * input: ring buffer
+ * output: none (void)
+ */
+static void rb_coalesce(struct ring_mm * ring_buffer)
+{
+	int order[MAX_ITEMS];
+	int n = 0, k, j, i, run = -1;
+
+	/* Insertion sort by address: there are at most MAX_ITEMS blocks */
+	for (i = rb_next_block(ring_buffer->manifest_map, 0); i >= 0; i = rb_next_block(ring_buffer->manifest_map, i + 1)) {
+		for (j = n++; j > 0 && ring_buffer->start_index[order[j - 1]] > ring_buffer->start_index[i]; j--) {
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+	}
+
+	for (k = 0; k < n; k++) {
+		i = order[k];
+
+		if (RB_BIT_TEST(ring_buffer->in_use_map, i)) {
+			run = -1;
+		} else if (run < 0) {
+			run = i;
+		} else {
+			ring_buffer->length[run] += ring_buffer->length[i];
+			RB_BIT_CLEAR(ring_buffer->manifest_map, i);
+		}
+	}
+
+	/* The last run wraps around onto a free first block */
+	i = order[0];
+	if (run >= 0 && run != i && !RB_BIT_TEST(ring_buffer->in_use_map, i)) {
+		ring_buffer->length[run] += ring_buffer->length[i];
+		RB_BIT_CLEAR(ring_buffer->manifest_map, i);
+	}
+}
+
+
+/**
+ * rb_release_block - return an in-use block to free space and merge it with its neighbours
+ *                    (caller holds the lock)
+ *
+ * input: ring buffer, metablock number
+ * output: none (void)
+ */
+static void rb_release_block(struct ring_mm * ring_buffer, int i)
+{
+#ifdef USING_TIME
+	rb_age_unlink(ring_buffer, i);
+#endif
+
+	if (rb_fifo_release(ring_buffer, i) != 0) {
+		RB_BIT_CLEAR(ring_buffer->in_use_map, i);
+
+		/* This could be ugly/inefficient, but go through and try to collate all free blocks.
+		 * A block may absorb several neighbours, so repeat until it stops growing. */
+		for (i = rb_next_free_block(ring_buffer, 0); i >= 0; i = rb_next_free_block(ring_buffer, i + 1)) {
+			while (rb_collate(ring_buffer, i) == 1) {
+				;
+			}
+		}
+
+		rb_fifo_sync(ring_buffer);
+	}
+
+	RB_WAKE(ring_buffer);
+}
+
+
+/**
+ * rb_view - look at a block in place, without copying it out
+ *
+ * The view holds a reference on the block until the matching rb_unview,
+ * so rb_free will not hand its bytes to another rb_write while the spans
+ * are in use.
+ *
+ * input: ring buffer, start index of block, first span, second span
+ *        (second->length is 0 unless the block wraps around the buffer end)
+ * output: length of the block
+ *         -1 if no committed block starts at start_index
+ */
+rb_off rb_view(struct ring_mm * ring_buffer, rb_off start_index, struct rb_span * first, struct rb_span * second)
+{
+	int i, s, object;
+	rb_off first_length;
+
+	RB_LOCK(&ring_buffer->lock);
+	i = rb_find_block(ring_buffer, start_index);
+
+	if (i >= 0 && !RB_BIT_TEST(ring_buffer->committed_map, i)) {
+		i = -1;
+	}
+
+	if (i >= 0) {
+		RB_ATOMIC_INC(&ring_buffer->refs[i]);
+	} else if ((s = rb_slab_find(ring_buffer, start_index, &object)) >= 0) {
+		/* Slabs are aligned to their object size, so an object never wraps */
+		RB_ATOMIC_INC(&ring_buffer->slab[s].refs[object]);
+		first->data = ring_buffer->base + ring_buffer->start_index[ring_buffer->slab[s].block] + (rb_off)object * ring_buffer->slab[s].size;
+		first->length = ring_buffer->slab[s].used[object];
+		second->data = ring_buffer->base;
+		second->length = 0;
+		RB_UNLOCK(&ring_buffer->lock);
+		return first->length;
+	}
+	RB_UNLOCK(&ring_buffer->lock);
+
+	if (i < 0) {
+		return -1;
+	}
+
+	first_length = ring_buffer->size - ring_buffer->start_index[i];
+	if (first_length > ring_buffer->used[i]) {
+		first_length = ring_buffer->used[i];
+	}
+
+	first->data = ring_buffer->base + ring_buffer->start_index[i];
+	first->length = first_length;
+	second->data = ring_buffer->base;
+	second->length = ring_buffer->used[i] - first_length;
+
+	return ring_buffer->used[i];
+}
+
+
+/**
+ * rb_unview - drop a view taken with rb_view
+ *
+ * input: ring buffer, start index of viewed block
+ * output: 0 if ok (block reclaimed if nobody else holds it)
+ *         -1 if no block in use starts there
+ */
+int rb_unview(struct ring_mm * ring_buffer, rb_off start_index)
+{
+	return rb_release(ring_buffer, start_index);
+}
+
+
+/**
+ * rb_collate - Merge the given block into the following block, if it is free
+ *
+ * input: ring buffer structure, metablock to collate
+ * output:
+ *         0 if cannot collate (ok),
+ *         1 if it merged with next block (ok and good!)
+ *        -1 if block_to_collate isn't free (not good, but shouldn't cause problem)
+ *        -2 if no following block (can indicate serious problem if working with non-empty ring buffer
+ *        -3 if parameter is invalid
+ */
+int rb_collate(struct ring_mm * ring_buffer, int block_to_collate)
+{
+	int following_block;
+	rb_off following_block_start_index;
+
+	if (block_to_collate < 0 || block_to_collate >= MAX_ITEMS) {
+		return -3;
+	}
+
+	/* Return -1 (error).  Cannot collate block in use */
+	if (RB_BIT_TEST(ring_buffer->in_use_map, block_to_collate)) {
+		return -1;
+	}
+
+	if (!RB_BIT_TEST(ring_buffer->manifest_map, block_to_collate)) {
+		return -1;
+	}
+
+	following_block_start_index = rb_wrap(ring_buffer, ring_buffer->start_index[block_to_collate] + ring_buffer->length[block_to_collate]);
+
+	/* If following block index = block_to_collate start index, this probably means we have an empty buffer, and return -2 */
+	if (following_block_start_index == ring_buffer->start_index[block_to_collate]) {
+		return -2;
+	}
+
+	/* Find following block among the manifested ones */
+	for (following_block = rb_next_block(ring_buffer->manifest_map, 0);
+		following_block >= 0;
+		following_block = rb_next_block(ring_buffer->manifest_map, following_block + 1)) {
+
+		/* Skip over itself */
+		if (following_block == block_to_collate) {
+			continue;
+		}
+
+		if (ring_buffer->start_index[following_block] == following_block_start_index) {
+			/* At this point following_block == the actual folling block, now check if it's free */
+
+			/* Cannot collate if following block in use */
+			if (RB_BIT_TEST(ring_buffer->in_use_map, following_block)) {
+				return 0;
+			}
+
+			/* Merge block_to_collate with the following free block, creating a larger free block */
+			ring_buffer->length[block_to_collate] += ring_buffer->length[following_block];
+
+			/* Following block is no longer manifested in the ring buffer */
+			RB_BIT_CLEAR(ring_buffer->manifest_map, following_block);
+
+			/* Return status code that collate successful */
+			return 1;
+		}
+	}
+
+	/* -2 is status code indicating it cannot find a following block.
+	 * This is a big problem (unless buffer consists of just one empty block). */
+	return -2;
+}
+
+
+/**
+ * rb_size_class - magazine class for a length
+ *
+ * input: length in bytes
+ * output: class number, -1 if the length is too large to be cached
+ */
+static int rb_size_class(rb_off length)
+{
+	int c;
+
+	for (c = 0; c < RB_MAG_CLASSES; c++) {
+		if (length <= (RB_MAG_MIN_SIZE << c)) {
+			return c;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+ * rb_magazine_init - start a thread's magazine empty
+ *
+ * input: magazine
+ * output: none (void)
+ */
+void rb_magazine_init(struct rb_magazine * mag)
+{
+	int c;
+
+	for (c = 0; c < RB_MAG_CLASSES; c++) {
+		mag->count[c] = 0;
+	}
+}
+
+
+/**
+ * rb_write_cached - write a small block, reusing one from the thread's magazine
+ *
+ * Lengths up to the largest class get a block of their class size.  A hit
+ * in the magazine takes no lock at all; a miss allocates the class size from
+ * the shared pool.  If the pool is exhausted, the magazine is drained back
+ * into it and the allocation retried once.
+ *
+ * input: ring structure, magazine of the calling thread, source, length
+ * output: start index of the block on success (free it with rb_free_cached or rb_free)
+ *         -1 not enough room
+ */
+rb_off rb_write_cached(struct ring_mm * ring_buffer, struct rb_magazine * mag, const char * start_address, rb_off length)
+{
+	int c, block;
+
+	c = rb_size_class(length);
+
+	if (length <= 0 || c < 0) {
+		return rb_write(ring_buffer, start_address, length);
+	}
+
+	if (mag->count[c] > 0) {
+		block = mag->block[c][--mag->count[c]];
+		ring_buffer->used[block] = length;
+		RB_ATOMIC_INC(&ring_buffer->refs[block]);	/* 0 -> 1: visible to rb_find_block again */
+#ifdef USING_TIME
+		RB_LOCK(&ring_buffer->lock);
+		rb_age_link(ring_buffer, block);
+		RB_UNLOCK(&ring_buffer->lock);
+#endif
+	} else {
+		RB_LOCK(&ring_buffer->lock);
+		block = rb_alloc_block(ring_buffer, RB_MAG_MIN_SIZE << c, 0);
+		RB_UNLOCK(&ring_buffer->lock);
+
+		if (block < 0) {
+			rb_magazine_drain(ring_buffer, mag);
+
+			RB_LOCK(&ring_buffer->lock);
+			block = rb_alloc_block(ring_buffer, RB_MAG_MIN_SIZE << c, 0);
+			RB_UNLOCK(&ring_buffer->lock);
+
+			if (block < 0) {
+				return -1;
+			}
+		}
+		ring_buffer->used[block] = length;
+	}
+
+	rb_memcpy(ring_buffer, block, start_address, length);
+
+	return ring_buffer->start_index[block];
+}
+
+
+/**
+ * rb_free_cached - drop the writer's reference, keeping a small block for reuse
+ *
+ * The block goes into the calling thread's magazine when it is exactly a
+ * class size, the magazine has room and nobody waits for room; otherwise
+ * it returns to the shared pool as with rb_free.  A parked block keeps its metablock but no
+ * references, so rb_find_block no longer finds it under the old handle.
+ *
+ * input: ring structure, magazine of the calling thread, start index of block
+ * output: 0 if ok
+ *         -1 error (no block found with this start address)
+ */
+int rb_free_cached(struct ring_mm * ring_buffer, struct rb_magazine * mag, rb_off start_index)
+{
+	int i, c;
+
+	RB_LOCK(&ring_buffer->lock);
+	i = rb_find_block(ring_buffer, start_index);
+
+	if (i < 0) {
+		RB_UNLOCK(&ring_buffer->lock);
+		return rb_free(ring_buffer, start_index);	/* a slab object, or no block at all */
+	}
+
+	if (RB_ATOMIC_DEC(&ring_buffer->refs[i]) != 0) {
+		RB_UNLOCK(&ring_buffer->lock);
+		return 0;
+	}
+
+	RB_SOJOURN_DONE(ring_buffer, i);
+#ifdef USING_TIME
+	rb_age_unlink(ring_buffer, i);
+#endif
+
+	c = rb_size_class(ring_buffer->length[i]);
+
+	if (c < 0 || ring_buffer->length[i] != (RB_MAG_MIN_SIZE << c) || mag->count[c] >= RB_MAG_DEPTH
+			|| RB_WAITING(ring_buffer)) {
+		rb_release_block(ring_buffer, i);
+		c = -1;
+	}
+	RB_UNLOCK(&ring_buffer->lock);
+
+	if (c >= 0) {
+		mag->block[c][mag->count[c]++] = i;
+	}
+
+	return 0;
+}
+
+
+/**
+ * rb_magazine_drain - return every block cached in a magazine to the shared pool
+ *                     (when the thread exits, or the ring is short of space)
+ *
+ * input: ring structure, magazine
+ * output: none (void)
+ */
+void rb_magazine_drain(struct ring_mm * ring_buffer, struct rb_magazine * mag)
+{
+	int c;
+
+	RB_LOCK(&ring_buffer->lock);
+	for (c = 0; c < RB_MAG_CLASSES; c++) {
+		while (mag->count[c] > 0) {
+			rb_release_block(ring_buffer, mag->block[c][--mag->count[c]]);
+		}
+	}
+	RB_UNLOCK(&ring_buffer->lock);
+}
+
+
+/**
+ * rb_slab_alloc - take a free object for a small write (caller holds the lock)
+ *
+ * Uses a slab of the length's class with a free object, carving a new
+ * slab out of free space if there is none.  Rings used as a cache
+ * (rb_set_expiry) do not use slabs, since objects are not on the age list.
+ *
+ * input: ring structure, length (at most RB_SLAB_MAX_SIZE)
+ * output: start index of the object
+ *         -1 if there is no slab with room and no room for a new slab
+ */
+static rb_off rb_slab_alloc(struct ring_mm * ring_buffer, rb_off length)
+{
+	struct rb_slab * slab = NULL;
+	int s, size, object, block;
+
+#ifdef USING_TIME
+	if (ring_buffer->ttl != 0 || ring_buffer->evict) {
+		return -1;
+	}
+#endif
+
+	for (size = RB_SLAB_MIN_SIZE; size < length; size <<= 1) {
+		;
+	}
+
+	for (s = 0; s < RB_SLABS; s++) {
+		if (ring_buffer->slab[s].block >= 0 && ring_buffer->slab[s].size == size
+				&& ring_buffer->slab[s].free_map != 0) {
+			slab = &ring_buffer->slab[s];
 			break;
 		}
-		return_value = 1;
 	}
-	
-	if (return_value == 0) {
-		/* This could be ugly/inefficient, but go through and try to collate all free blocks */
-		for (i=0;i<MAX_ITEMS;i++) {
-			current_block = &(ring_buffer->mem_blocks[i]);
-			rb_collate(ring_buffer, current_block);
+
+	if (slab == NULL) {
+		for (s = 0; s < RB_SLABS && ring_buffer->slab[s].block >= 0; s++) {
+			;
+		}
+
+		if (s == RB_SLABS) {
+			return -1;
+		}
+
+		/* Contiguous and aligned to the object size; never committed, so
+		 * it is not aged and cannot be read as a block */
+		block = rb_alloc_block(ring_buffer, (rb_off)size * RB_SLAB_OBJECTS, size);
+		if (block < 0) {
+			return -1;
 		}
+
+		RB_BIT_SET(ring_buffer->slab_map, block);
+		ring_buffer->slab_of[block] = s;
+		slab = &ring_buffer->slab[s];
+		slab->block = block;
+		slab->size = size;
+		slab->free_map = ~0UL;
 	}
-	
-	return return_value;
+
+	object = rb_ctz(slab->free_map);
+	slab->free_map &= ~(1UL << object);
+	slab->used[object] = (unsigned char)length;
+	slab->refs[object] = 1;
+#ifdef USING_TIME
+	slab->timestamp[object] = RB_NOW();
+#endif
+
+	return ring_buffer->start_index[slab->block] + (rb_off)object * size;
 }
 
 
 /**
- * rb_collate - Merge the given block into the following block, if it is free
- * 
- * input: ring buffer structure, block to collate
- * output: 
- *         0 if cannot collate (ok), 
- *         1 if it merged with next block (ok and good!)
- *        -1 if block_to_collate isn't free (not good, but shouldn't cause problem)
- *        -2 if no following block (can indicate serious problem if working with non-empty ring buffer
- *        -3 if parameter is null
+ * rb_slab_find - find the slab object that begins at a certain index
+ *                (caller holds the lock)
+ *
+ * Only metablocks holding slabs are looked at, a word of slab_map at a time.
+ *
+ * input: ring structure, start index of object, where to store the object number
+ * output: slab number, -1 if no object in use starts there
  */
-int rb_collate(struct ring_mm * ring_buffer, struct mem_block * block_to_collate)
+static int rb_slab_find(const struct ring_mm * ring_buffer, rb_off start_index, int * object)
 {
-	struct mem_block * following_block;
-	int i, following_block_start_index;
-	
-	if (block_to_collate == NULL) {
-		return -3;
+	const struct rb_slab * slab;
+	rb_off offset;
+	int i, s;
+
+	start_index = rb_wrap(ring_buffer, start_index);
+
+	for (i = rb_next_block(ring_buffer->slab_map, 0); i >= 0; i = rb_next_block(ring_buffer->slab_map, i + 1)) {
+		offset = start_index - ring_buffer->start_index[i];
+		if (offset < 0 || offset >= ring_buffer->length[i]) {
+			continue;
+		}
+
+		s = ring_buffer->slab_of[i];
+		slab = &ring_buffer->slab[s];
+		if (offset % slab->size != 0) {
+			return -1;
+		}
+
+		*object = (int)(offset / slab->size);
+		return ((slab->free_map >> *object) & 1UL) ? -1 : s;
 	}
-	
-	/* Return -1 (error).  Cannot collate block in use */
-	if (block_to_collate->in_use == 1) {
-		return -1;
+
+	return -1;
+}
+
+
+/**
+ * rb_slab_free - give an object back to its slab (caller holds the lock)
+ *
+ * A slab that empties is returned to free space, unless it is the only
+ * slab of its class and nobody waits for room: keeping that one stops a
+ * write/free loop from carving and collating a slab every time round.
+ * rb_slab_trim takes it back when a larger allocation needs the room.
+ *
+ * input: ring structure, slab number, object number
+ * output: 0
+ */
+static int rb_slab_free(struct ring_mm * ring_buffer, int s, int object)
+{
+	struct rb_slab * slab = &ring_buffer->slab[s];
+	int other;
+
+	slab->free_map |= 1UL << object;
+
+	if (slab->free_map != ~0UL) {
+		return 0;
 	}
-	
-	if (block_to_collate->manifest == 0) {
-		return -1;
+
+	for (other = 0; other < RB_SLABS; other++) {
+		if (other != s && ring_buffer->slab[other].block >= 0 && ring_buffer->slab[other].size == slab->size) {
+			break;
+		}
 	}
-	
-	following_block_start_index = rb_wrap(block_to_collate->start_index + block_to_collate->length);
-	
-	/* If following block index = block_to_collate start index, this probably means we have an empty buffer, and return -2 */
-	if (following_block_start_index == block_to_collate->start_index) {
-		return -2;
+
+	if (other < RB_SLABS || RB_WAITING(ring_buffer)) {
+		RB_BIT_CLEAR(ring_buffer->slab_map, slab->block);
+		ring_buffer->slab_of[slab->block] = -1;
+		ring_buffer->refs[slab->block] = 0;
+		rb_release_block(ring_buffer, slab->block);
+		slab->block = -1;
 	}
 
-	
-	/* following_block_start_index = rb_wrap(block_to_collate->start_index + block_to_collate->length); */
-	
-	
-	/* Find following block */
-	for (i=0;i<MAX_ITEMS;i++) {
-		/* At this point we are not sure if following_block == the actual block following block_to_collate */
-		following_block = &(ring_buffer->mem_blocks[i]);
-		
-		/*
-		//printf("  COLLATE: comparng block (index = %d) to metablock %d\n",block_to_collate->start_index, i);
-		//printf("           wrap(index + length) = %d, metablock[%d].start = %d\n",
-		//				following_block_start_index, i, following_block->start_index);		
-		*/		
+	return 0;
+}
 
-		/* Skip over itself */
-		if (following_block == block_to_collate) {
+
+/**
+ * rb_slab_release - drop a reference on an object; the last one gives it
+ *                   back to its slab (caller holds the lock)
+ *
+ * input: ring structure, slab number, object number
+ * output: 0
+ */
+static int rb_slab_release(struct ring_mm * ring_buffer, int s, int object)
+{
+	struct rb_slab * slab = &ring_buffer->slab[s];
+
+	if (RB_ATOMIC_DEC(&slab->refs[object]) != 0) {
+		return 0;
+	}
+
+	RB_SLAB_SOJOURN_DONE(ring_buffer, slab, object);
+	return rb_slab_free(ring_buffer, s, object);
+}
+
+
+/**
+ * rb_slab_trim - return every empty slab to free space (caller holds the lock)
+ *
+ * Includes the one slab per class that rb_slab_free keeps for reuse; the
+ * next small write of that class carves a new slab if there is room.
+ *
+ * input: ring structure
+ * output: number of slabs given back
+ */
+static int rb_slab_trim(struct ring_mm * ring_buffer)
+{
+	struct rb_slab * slab;
+	int s, trimmed = 0;
+
+	for (s = 0; s < RB_SLABS; s++) {
+		slab = &ring_buffer->slab[s];
+		if (slab->block < 0 || slab->free_map != ~0UL) {
 			continue;
 		}
-		
-		/* Cannot merge with block in use */
-		if (following_block->in_use == 1) {
-			continue;
+
+		RB_BIT_CLEAR(ring_buffer->slab_map, slab->block);
+		ring_buffer->slab_of[slab->block] = -1;
+		ring_buffer->refs[slab->block] = 0;
+		rb_release_block(ring_buffer, slab->block);
+		slab->block = -1;
+		trimmed++;
+	}
+
+	return trimmed;
+}
+
+
+#ifdef USING_TIME
+/**
+ * rb_sojourn - snapshot of how long blocks lived, from rb_write until
+ *              their last reference was dropped (in RB_NOW units)
+ *
+ * input: ring structure, histogram to fill in
+ * output: none (void)
+ */
+void rb_sojourn(const struct ring_mm * ring_buffer, struct rb_histogram * snap)
+{
+	rb_hist_snapshot(&ring_buffer->sojourn, snap);
+}
+#endif
+
+
+#ifdef USING_TIME
+/**
+ * rb_age_link - stamp a block and append it to the young end of the age list
+ *               (caller holds the lock)
+ */
+static void rb_age_link(struct ring_mm * ring_buffer, int i)
+{
+	ring_buffer->timestamp[i] = RB_NOW();
+
+	ring_buffer->age_prev[i] = ring_buffer->age_tail;
+	ring_buffer->age_next[i] = -1;
+
+	if (ring_buffer->age_tail >= 0) {
+		ring_buffer->age_next[ring_buffer->age_tail] = i;
+	} else {
+		ring_buffer->age_head = i;
+	}
+	ring_buffer->age_tail = i;
+}
+
+
+/**
+ * rb_age_unlink - take a block off the age list, if it is on it
+ *                 (caller holds the lock)
+ */
+static void rb_age_unlink(struct ring_mm * ring_buffer, int i)
+{
+	int prev = ring_buffer->age_prev[i];
+	int next = ring_buffer->age_next[i];
+
+	if (next == RB_AGE_UNLINKED) {
+		return;
+	}
+
+	if (prev >= 0) {
+		ring_buffer->age_next[prev] = next;
+	} else {
+		ring_buffer->age_head = next;
+	}
+
+	if (next >= 0) {
+		ring_buffer->age_prev[next] = prev;
+	} else {
+		ring_buffer->age_tail = prev;
+	}
+
+	ring_buffer->age_prev[i] = -1;
+	ring_buffer->age_next[i] = RB_AGE_UNLINKED;
+}
+
+
+/**
+ * rb_evict - drop the writer's reference on a listed block (caller holds the lock)
+ *
+ * The block leaves the age list at once; its space is reclaimed when
+ * readers holding rb_retain/rb_view references let go.
+ */
+static void rb_evict(struct ring_mm * ring_buffer, int i)
+{
+	rb_age_unlink(ring_buffer, i);
+
+	if (RB_ATOMIC_DEC(&ring_buffer->refs[i]) == 0) {
+		RB_SOJOURN_DONE(ring_buffer, i);
+		rb_release_block(ring_buffer, i);
+	}
+}
+
+
+/**
+ * rb_set_expiry - use the ring as a bounded cache of recent blocks
+ *
+ * Blocks older than ttl are dropped by rb_expire; with evict set, rb_write
+ * drops the oldest blocks whenever it cannot otherwise find room.  Either
+ * way the ring takes over the writer's reference, so a block written to a
+ * cache must not also be passed to rb_free: readers use rb_retain/rb_view
+ * to keep it while they need it.
+ *
+ * input: ring structure, time to live (RB_NOW units, 0 = no expiry), evict flag
+ * output: none (void)
+ */
+void rb_set_expiry(struct ring_mm * ring_buffer, rb_u64 ttl, int evict)
+{
+	RB_LOCK(&ring_buffer->lock);
+	ring_buffer->ttl = ttl;
+	ring_buffer->evict = evict;
+	RB_UNLOCK(&ring_buffer->lock);
+}
+
+
+/**
+ * rb_expire - drop every block that has outlived the ring's ttl
+ *
+ * Walks the age list from the oldest end and stops at the first block
+ * still within its ttl, so the cost is proportional to what is dropped.
+ *
+ * input: ring structure, current time (RB_NOW units)
+ * output: number of blocks dropped
+ */
+int rb_expire(struct ring_mm * ring_buffer, rb_u64 now)
+{
+	int i, dropped = 0;
+
+	if (ring_buffer->ttl == 0) {
+		return 0;
+	}
+
+	RB_LOCK(&ring_buffer->lock);
+	for (i = ring_buffer->age_head; i >= 0; i = ring_buffer->age_head) {
+		if (ring_buffer->timestamp[i] + ring_buffer->ttl > now) {
+			break;
 		}
-		
-		/* Skip over nonmanifested blocks */
-		if (following_block->manifest == 0) {
-			continue;
+		rb_evict(ring_buffer, i);
+		dropped++;
+	}
+	RB_UNLOCK(&ring_buffer->lock);
+
+	return dropped;
+}
+#endif
+
+
+#ifdef USING_REGION
+/**
+ * rb_region_block - report a block's span to the region as live (caller holds the lock)
+ */
+static void rb_region_block(struct ring_mm * ring_buffer, int i, rb_u64 now)
+{
+	rb_off start = ring_buffer->start_index[i];
+	rb_off length = ring_buffer->length[i];
+
+	/* A block that wraps is two spans of the region */
+	if (start + length > ring_buffer->size) {
+		rb_region_touch(ring_buffer->region, 0, (unsigned long)(start + length - ring_buffer->size), now);
+		length = ring_buffer->size - start;
+	}
+	rb_region_touch(ring_buffer->region, (unsigned long)start, (unsigned long)length, now);
+}
+
+
+/**
+ * rb_trim - give idle pages of the ring's storage back to the OS
+ *
+ * Every block in use (slabs included) is reported live, then the region
+ * releases the chunks that have held nothing live for its trim delay.
+ * Blocks handed out between two calls are reported as they are allocated,
+ * stamped with the time of the previous call, so short-lived blocks are
+ * not missed.  The first call cannot know what was written before it and
+ * counts the whole ring as just used.  The lock is held throughout, so no
+ * block can be handed out in a chunk being released.
+ *
+ * input: ring structure, the RB_MEM_LAZY region passed to rb_init_ex, current time
+ * output: bytes given back
+ */
+unsigned long rb_trim(struct ring_mm * ring_buffer, struct rb_region * region, rb_u64 now)
+{
+	unsigned long released;
+	int i;
+
+	RB_LOCK(&ring_buffer->lock);
+	if (ring_buffer->region != region) {
+		ring_buffer->region = region;
+		rb_region_touch(region, 0, (unsigned long)ring_buffer->size, now);
+	}
+	ring_buffer->region_now = now;
+
+	for (i = rb_next_block(ring_buffer->in_use_map, 0); i >= 0; i = rb_next_block(ring_buffer->in_use_map, i + 1)) {
+		rb_region_block(ring_buffer, i, now);
+	}
+
+	released = rb_region_trim(region, now);
+	RB_UNLOCK(&ring_buffer->lock);
+
+	return released;
+}
+#endif
+
+
+#ifdef USING_THREADS
+/**
+ * rb_wake - let the first waiter retry (caller holds the lock)
+ *
+ * Called whenever space is freed.  Only the head of the queue is woken, so
+ * waiters are served in order.  It is woken even if no free block looks
+ * long enough: its retry also gives back empty slabs and, with alignment,
+ * may fit where a length test would not.  Costs one test when nobody waits.
+ */
+static void rb_wake(struct ring_mm * ring_buffer)
+{
+	if (ring_buffer->wait_head != NULL) {
+		pthread_cond_signal(&ring_buffer->wait_head->cond);
+	}
+}
+
+
+/**
+ * rb_wait_keep - set the largest free block aside for the head waiter
+ *                (caller holds the lock)
+ *
+ * Called before each search made for anyone else.  Others may take the
+ * front of that block only while what stays is still as long as the
+ * waiter's request (rb_room); other free blocks are theirs.  Nothing is
+ * kept while the head waiter allocates for itself.
+ */
+static void rb_wait_keep(struct ring_mm * ring_buffer)
+{
+	int i, keep = -1;
+
+	if (ring_buffer->wait_head != NULL && !ring_buffer->wait_pass) {
+		for (i = rb_next_free_block(ring_buffer, 0); i >= 0; i = rb_next_free_block(ring_buffer, i + 1)) {
+			if (keep < 0 || ring_buffer->length[i] > ring_buffer->length[keep]) {
+				keep = i;
+			}
 		}
-		
-		if (following_block->start_index == following_block_start_index) {
-			/* At this point following_block == the actual folling block, now check if it's free */
-			
-			/* Cannot collate if following block in use */
-			if (following_block->in_use == 1) {
-				return 0;
+	}
+
+	ring_buffer->wait_keep = keep;
+}
+
+
+/**
+ * rb_wait_block - queue for a block until there is room or the timeout passes
+ *                 (caller holds the lock)
+ *
+ * The caller joins the back of the queue and sleeps until it is at the head
+ * and rb_wake says space was freed.  The lock is dropped while sleeping.
+ * On the way out the next waiter is given its turn.  A length the buffer
+ * could not hold even when empty is refused before queueing, as it would
+ * hold up everyone behind it for good.
+ *
+ * input: ring structure, length of block, alignment (as for rb_alloc_block),
+ *        timeout in milliseconds (<0 waits forever)
+ * output: metablock number
+ *         -1 if the timeout passed first, or the length can never fit
+ */
+static int rb_wait_block(struct ring_mm * ring_buffer, rb_off length, int alignment, long timeout_ms)
+{
+	struct rb_waiter self, ** link;
+	pthread_condattr_t attr;
+	struct timespec deadline;
+	rb_off limit = ring_buffer->size;
+	int block = -1, timed_out = 0;
+
+	/* An aligned block does not wrap: it starts at the first aligned address at the earliest */
+	if (alignment > 1) {
+		limit -= (rb_off)((alignment - ((unsigned long)ring_buffer->base & (alignment - 1))) & (alignment - 1));
+	}
+
+	if (length <= 0 || length > limit) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	if (timeout_ms > 0) {
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&self.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	self.length = length;
+	self.next = NULL;
+
+	for (link = &ring_buffer->wait_head; *link != NULL; link = &(*link)->next) {
+		;
+	}
+	*link = &self;
+
+	for (;;) {
+		/* Space may have been freed since the caller last looked: the head tries before sleeping */
+		if (ring_buffer->wait_head == &self) {
+			ring_buffer->wait_pass = 1;
+			block = rb_alloc_block(ring_buffer, length, alignment);
+			ring_buffer->wait_pass = 0;
+
+			if (block >= 0) {
+				break;
 			}
+		}
 
-			/* Merge block_to_collate with the following free block, creating a larger free block */
-			block_to_collate->length += following_block->length;
-
-			/* Following block is not longer in use */
-			following_block->in_use = 0;
-			
-			/* ... and no longer manifested in the ring buffer */
-			following_block->manifest = 0;
-			
-			block_to_collate->manifest = 1;
-			
-			/* Return status code that collate successful */
-			return 1;
+		if (timed_out) {
+			break;
+		}
+
+		if (timeout_ms < 0) {
+			pthread_cond_wait(&self.cond, &ring_buffer->lock);
+		} else if (pthread_cond_timedwait(&self.cond, &ring_buffer->lock, &deadline) == ETIMEDOUT) {
+			timed_out = 1;
 		}
 	}
 
-	/* -2 is status code indicating it cannot find a following block.
-	 * This is a big problem (unless buffer consists of just one empty block). */
-	return -2;
+	for (link = &ring_buffer->wait_head; *link != &self; link = &(*link)->next) {
+		;
+	}
+	*link = self.next;
+	pthread_cond_destroy(&self.cond);
+
+	/* What is left may already be enough for the next in line */
+	rb_wake(ring_buffer);
+
+	return block;
+}
+
+
+/**
+ * rb_write_timed - rb_write that waits for room instead of failing at once
+ *
+ * Tries rb_write first; with room to spare (and nobody waiting) that is
+ * all it does.  Otherwise the caller waits in line behind earlier waiters
+ * until rb_free and friends release enough space.  While anyone waits,
+ * the largest free block is kept for the oldest waiter (rb_wait_keep), so
+ * it is not starved by writers that never queue; they may still use the
+ * other free blocks and what the kept one has to spare.
+ *
+ * input: ring structure, start address of memory to copy, length to copy,
+ *        timeout in milliseconds (0: do not wait, <0: wait forever)
+ * output: start index of the block on success, as for rb_write
+ *         -1 no room before the timeout passed (or length can never fit)
+ *         -2 copy failed
+ */
+rb_off rb_write_timed(struct ring_mm * ring_buffer, const char * start_address, rb_off length, long timeout_ms)
+{
+	int current_block;
+	rb_off bytes_copied, handle;
+
+	handle = rb_write(ring_buffer, start_address, length);
+
+	if (handle != -1 || timeout_ms == 0) {
+		return handle;
+	}
+
+	RB_LOCK(&ring_buffer->lock);
+	current_block = rb_wait_block(ring_buffer, length, 0, timeout_ms);
+	RB_UNLOCK(&ring_buffer->lock);
+
+	if (current_block < 0) {
+		return -1;
+	}
+
+	bytes_copied = rb_memcpy(ring_buffer, current_block, start_address, length);
+
+	if (bytes_copied != length) {
+		RB_LOCK(&ring_buffer->lock);
+		rb_release_block(ring_buffer, current_block);
+		RB_UNLOCK(&ring_buffer->lock);
+		return -2;
+	}
+
+	return ring_buffer->start_index[current_block];
 }
 
+
+/**
+ * rb_alloc_wait - rb_alloc that waits for room instead of failing at once
+ *
+ * Queues like rb_write_timed.  The wait is for a free block at least
+ * length bytes long; if alignment padding or the end of the buffer keeps
+ * the block from fitting there, the caller stays at the head of the queue
+ * until more is freed.
+ *
+ * input: ring structure, length of block, alignment (power of two, 0 or 1 for none),
+ *        where to store the address of the block,
+ *        timeout in milliseconds (0: do not wait, <0: wait forever)
+ * output: start index of the block on success (pass it to rb_commit)
+ *         -1 no room before the timeout passed (or length can never fit)
+ *         -3 if alignment is not a power of two
+ */
+rb_off rb_alloc_wait(struct ring_mm * ring_buffer, rb_off length, int alignment, char ** ptr, long timeout_ms)
+{
+	int block;
+	rb_off handle;
+
+	handle = rb_alloc(ring_buffer, length, alignment, ptr);
+
+	if (handle != -1 || timeout_ms == 0) {
+		return handle;
+	}
+
+	if (alignment <= 0) {
+		alignment = 1;
+	}
+
+	RB_LOCK(&ring_buffer->lock);
+	block = rb_wait_block(ring_buffer, length, alignment, timeout_ms);
+	RB_UNLOCK(&ring_buffer->lock);
+
+	if (block < 0) {
+		return -1;
+	}
+
+	*ptr = ring_buffer->base + ring_buffer->start_index[block];
+
+	return ring_buffer->start_index[block];
+}
+#endif
@@ -19,6 +19,8 @@
 
 
 /*#define USING_TIME	1*/
+/*#define USING_THREADS	1*/
+/*#define USING_REGION	1*/
 #define NATIVE_MEMCPY	1
 
 
@@ -26,48 +28,248 @@
 #include <string.h>
 #endif
 
+#include "rb_types.h"
+
+#ifdef USING_TIME
+#include "rb_histogram.h"
+#endif
+
+#ifdef USING_REGION
+#include "rb_memory.h"
+#endif
+
+
+/**
+ * Allocator lock
+ *  With USING_THREADS, a mutex guards the metablock pool.  It is held only
+ *  while blocks are found, split and merged; data is copied outside it.
+ *  Without it the lock compiles away and the ring is single-threaded.
+ *  The shared pool has only this one lock, so allocations that miss the
+ *  magazines do not scale with the number of threads.
+ */
+#ifdef USING_THREADS
+#include <pthread.h>
+#define RB_LOCK_T		pthread_mutex_t
+#define RB_LOCK_INIT(l)		pthread_mutex_init((l), NULL)
+#define RB_LOCK(l)		pthread_mutex_lock(l)
+#define RB_UNLOCK(l)		pthread_mutex_unlock(l)
+#else
+#define RB_LOCK_T		int
+#define RB_LOCK_INIT(l)		(*(l) = 0)
+#define RB_LOCK(l)		((void)0)
+#define RB_UNLOCK(l)		((void)0)
+#endif
+
 
 /**
- * mem_block - Memory Block
- *  This structure is a metablock for a chunk of data in a ring buffer
+ * rb_waiter - caller parked in rb_write_timed/rb_alloc_wait (USING_THREADS)
+ *   Lives on the waiting thread's stack.  Waiters queue in arrival order and
+ *   only the one at the head tries to allocate, so a large request is not
+ *   passed over by a stream of small ones.
  */
-struct mem_block {
-	int manifest;		/* 0 if this buffer has no manifestation in ring buffer (ie: not yet used)*/
-	int in_use;		/* 0 if this buffer is free, 1 if the data in the block is used (usually containing packet) */
-	int start_index;	/* start index of this block of data in the buffer */
-	int timestamp;		/* time this data was entered into buffer, used for establishing priority */
-	int length;		/* length of data in the buffer */
+#ifdef USING_THREADS
+struct rb_waiter {
+	pthread_cond_t cond;		/* signalled when the waiter is at the head and may fit */
+	rb_off length;			/* bytes it is waiting for */
+	struct rb_waiter * next;	/* next in line, NULL at the tail */
 };
+#endif
+
+
+/**
+ * Magazine size classes
+ *  Small blocks freed through a magazine keep their class size and are
+ *  handed straight back by the next rb_write_cached of that class.
+ */
+#define RB_MAG_MIN_SIZE		16	/* smallest class, classes double from here */
+#define RB_MAG_CLASSES		4	/* 16, 32, 64, 128 bytes */
+#define RB_MAG_DEPTH		8	/* blocks cached per class */
+
+
+/**
+ * Age list (USING_TIME)
+ *  Blocks holding data are kept in allocation order, oldest first, so that
+ *  expiry and eviction only ever look at the blocks they drop.
+ */
+#define RB_AGE_UNLINKED		(-2)
+
+
+/**
+ * Metablock pool bitmaps
+ *  Metablock i is described by bit i of each map (word i / RB_WORD_BITS),
+ *  so free metablocks are found a whole word at a time.
+ */
+#define RB_WORD_BITS	((int)(8 * sizeof(unsigned long)))	/* int: compared with metablock numbers */
+#define RB_MAP_WORDS	((MAX_ITEMS + RB_WORD_BITS - 1) / RB_WORD_BITS)
+
+#define RB_BIT_TEST(map, i)	(((map)[(i) / RB_WORD_BITS] >> ((i) % RB_WORD_BITS)) & 1UL)
+#define RB_BIT_SET(map, i)	((map)[(i) / RB_WORD_BITS] |= (1UL << ((i) % RB_WORD_BITS)))
+#define RB_BIT_CLEAR(map, i)	((map)[(i) / RB_WORD_BITS] &= ~(1UL << ((i) % RB_WORD_BITS)))
+
+
+/**
+ * Slabs
+ *  Writes of up to RB_SLAB_MAX_SIZE bytes are packed into slabs: a single
+ *  metablock cut into RB_SLAB_OBJECTS objects of one class size, with a
+ *  bitmap word of the free ones.  An object costs a bit, a length byte and
+ *  a reference count rather than a metablock, and is taken and given back
+ *  without splitting or collating blocks.  Empty slabs are given back to
+ *  free space when an allocation would otherwise fail.
+ *  Every slab takes a metablock, so the slab table grows with MAX_ITEMS;
+ *  slab_of maps a metablock straight to its slab.
+ */
+#define RB_SLAB_MIN_SIZE	8	/* smallest class, classes double from here */
+#define RB_SLAB_CLASSES		4	/* 8, 16, 32, 64 bytes */
+#define RB_SLAB_MAX_SIZE	(RB_SLAB_MIN_SIZE << (RB_SLAB_CLASSES - 1))
+#define RB_SLAB_OBJECTS		RB_WORD_BITS	/* objects per slab, one per bit of the free map */
+#define RB_SLABS		((MAX_ITEMS + 1) / 2)	/* slabs per ring: up to half the metablocks */
+
+
+/**
+ * Block reference counts may be taken and dropped from several threads
+ */
+#ifdef __GNUC__
+#define RB_ATOMIC_INC(p)	__sync_add_and_fetch((p), 1)
+#define RB_ATOMIC_DEC(p)	__sync_sub_and_fetch((p), 1)
+#else
+#define RB_ATOMIC_INC(p)	(++*(p))
+#define RB_ATOMIC_DEC(p)	(--*(p))
+#endif
 
 
+/**
+ * rb_slab - a block of equal sized small objects
+ */
+struct rb_slab {
+	int block;			/* metablock holding the slab, -1 if this slab is not in use */
+	int size;			/* size of each object (a class size) */
+	unsigned long free_map;		/* bit set for each free object */
+	unsigned char used [RB_SLAB_OBJECTS];	/* bytes of data in each object in use */
+	int refs [RB_SLAB_OBJECTS];		/* references held on each object in use (rb_write, rb_retain, rb_view) */
+#ifdef USING_TIME
+	rb_u64 timestamp [RB_SLAB_OBJECTS];	/* time each object was written (RB_NOW), for sojourn times */
+#endif
+};
+
 /**
  * ring_mm -  Ring Memory Manager
  *   Used in the dynamic allocation of data chunks to a ring buffer
  */
 struct ring_mm {
-	char data[BUFFER_SIZE];	/* The buffer where everything is stored. */
-	struct mem_block mem_blocks	[MAX_ITEMS];	/* Each block in the buffer has a metadata structure in this array. */
+	char data[BUFFER_SIZE];	/* Built-in storage, used by rb_init */
+	char * base;		/* The buffer where everything is stored (data, or storage given to rb_init_ex) */
+	rb_off size;		/* Size of the buffer at base */
+
+	/* Each block in the buffer has a metablock, stored as a structure of arrays */
+	unsigned long manifest_map	[RB_MAP_WORDS];	/* bit set if the metablock has a manifestation in the buffer */
+	unsigned long in_use_map	[RB_MAP_WORDS];	/* bit set if the data in the block is used (usually containing packet) */
+	unsigned long committed_map	[RB_MAP_WORDS];	/* bit set once a block in use is readable (rb_write, or rb_alloc then rb_commit) */
+	rb_off start_index		[MAX_ITEMS];	/* start index of each block of data in the buffer */
+	rb_off length			[MAX_ITEMS];	/* length of each block of data in the buffer */
+	int refs			[MAX_ITEMS];	/* references held on each block in use (rb_write, rb_retain, rb_view) */
+	rb_off used			[MAX_ITEMS];	/* bytes of data in each block in use (less than length for class-sized blocks) */
+#ifdef USING_TIME
+	rb_u64 timestamp	[MAX_ITEMS];	/* time the data was entered into buffer (RB_NOW), used for establishing priority */
+	int age_prev			[MAX_ITEMS];	/* age list: next older block, -1 at the head */
+	int age_next			[MAX_ITEMS];	/* age list: next younger block, -1 at the tail, RB_AGE_UNLINKED if not listed */
+#endif
+
 	char swap 			[SWAP_SPACE];	/* Space for temporary buffering and swaps */
 	int swap_in_use;							/* Set to 1 if swap space is in use */
+
+	RB_LOCK_T lock;		/* Guards the metablock pool (USING_THREADS) */
+
+	struct rb_slab slab		[RB_SLABS];	/* slabs of small objects */
+	unsigned long slab_map		[RB_MAP_WORDS];	/* bit set if the metablock holds a slab rather than one block */
+	int slab_of			[MAX_ITEMS];	/* slab held by each metablock, -1 if none */
+
+	int fifo_ok;		/* Set while all free space is one block (or none): blocks are being freed in order */
+	int fifo_free;		/* That free block, -1 if the buffer is full */
+
+#ifdef USING_THREADS
+	struct rb_waiter * wait_head;	/* oldest caller waiting for room, NULL if none */
+	int wait_pass;			/* set while that caller allocates for itself */
+	int wait_keep;			/* free block kept for that caller during others' searches, -1 if none */
+#endif
+
+#ifdef USING_TIME
+	struct rb_histogram sojourn;	/* time from rb_write until the last reference is dropped */
+
+	int age_head;			/* oldest block holding data, -1 if none */
+	int age_tail;			/* youngest block holding data, -1 if none */
+	rb_u64 ttl;		/* age at which rb_expire drops a block (RB_NOW units), 0 = never */
+	int evict;			/* set: rb_write drops the oldest blocks when it runs out of room */
+#endif
+
+#ifdef USING_REGION
+	struct rb_region * region;	/* storage region being trimmed, NULL until the first rb_trim */
+	rb_u64 region_now;	/* time of the last rb_trim, stamped on blocks handed out since */
+#endif
+};
+
+/**
+ * rb_magazine - per-thread cache of free class-sized blocks
+ *   Owned by one thread and never shared.  Cached blocks stay marked in use
+ *   in the ring, so the shared pool does not see them until the magazine is
+ *   drained.  A block may be freed into any thread's magazine, not only the
+ *   one of the thread that wrote it.
+ */
+struct rb_magazine {
+	int block	[RB_MAG_CLASSES][RB_MAG_DEPTH];	/* cached metablocks per class */
+	int count	[RB_MAG_CLASSES];		/* number of cached metablocks per class */
+};
+
+/**
+ * rb_span - read-only window onto (part of) a block, as returned by rb_view.
+ *   A block that wraps around the end of the buffer is seen as two spans.
+ */
+struct rb_span {
+	const char * data;	/* first byte of the span, inside ring_mm->base */
+	rb_off length;		/* number of bytes, 0 for an unused second span */
 };
 
 /** FIX ALL THIS WHEN THE C FILE IS DONE **/
 
 /*** Outward facing functions ***/
 void rb_init(struct ring_mm *);
-int rb_write(struct ring_mm *, const char *, int); /* source address of data, length to copy */
-int rb_read(const struct ring_mm *, int, const char *, int); /* destination address to copy to, start index in buffer containing data */
-int rb_free(struct ring_mm*, int); /* index of start of block to free */
-void rb_status(const struct ring_mm *, const char *);
+int rb_init_ex(struct ring_mm *, char *, rb_off); /* storage to manage, size of storage */
+rb_off rb_write(struct ring_mm *, const char *, rb_off); /* source address of data, length to copy */
+rb_off rb_alloc(struct ring_mm *, rb_off, int, char **); /* length, alignment, where to store the block address */
+int rb_commit(struct ring_mm *, rb_off, rb_off); /* start index from rb_alloc, bytes written */
+rb_off rb_read(const struct ring_mm *, rb_off, char *, rb_off); /* start index in buffer containing data, destination address to copy to, size of destination */
+int rb_free(struct ring_mm*, rb_off); /* index of start of block to free */
+int rb_free_many(struct ring_mm *, const rb_off *, int, int *); /* start indexes of blocks to free, how many, status of each (or NULL) */
+int rb_retain(struct ring_mm *, rb_off); /* index of start of block to take a reference on */
+int rb_release(struct ring_mm *, rb_off); /* index of start of block to drop a reference on */
+rb_off rb_view(struct ring_mm *, rb_off, struct rb_span *, struct rb_span *); /* start index of block, first span, second span (wrapped part) */
+int rb_unview(struct ring_mm *, rb_off); /* start index of block passed to rb_view */
+void rb_status(const struct ring_mm *, char *);
+int rb_find_block(const struct ring_mm *, rb_off); /* start index of block; returns metablock number */
+void rb_magazine_init(struct rb_magazine *);
+rb_off rb_write_cached(struct ring_mm *, struct rb_magazine *, const char *, rb_off); /* like rb_write, reusing cached blocks */
+int rb_free_cached(struct ring_mm *, struct rb_magazine *, rb_off); /* like rb_free, caching small blocks */
+void rb_magazine_drain(struct ring_mm *, struct rb_magazine *); /* return all cached blocks to the ring */
+#ifdef USING_THREADS
+rb_off rb_write_timed(struct ring_mm *, const char *, rb_off, long); /* like rb_write, waiting up to a timeout (ms, <0 forever) for room */
+rb_off rb_alloc_wait(struct ring_mm *, rb_off, int, char **, long); /* like rb_alloc, waiting up to a timeout (ms, <0 forever) for room */
+#endif
+#ifdef USING_TIME
+void rb_sojourn(const struct ring_mm *, struct rb_histogram *); /* histogram to fill with a snapshot of block lifetimes */
+void rb_set_expiry(struct ring_mm *, rb_u64, int); /* time to live (RB_NOW units, 0 = forever), evict oldest when full */
+int rb_expire(struct ring_mm *, rb_u64); /* current time (RB_NOW); returns number of blocks dropped */
+#endif
+#ifdef USING_REGION
+unsigned long rb_trim(struct ring_mm *, struct rb_region *, rb_u64); /* RB_MEM_LAZY region given to rb_init_ex, current time; returns bytes given back */
+#endif
 
 
 /*** Private functions ***/
 #if 0
-//int rb_collate(struct ring_mm *, struct mem_block *);		/* Merges adjacent free blocks to form larger free blocks */
-//struct mem_block * rb_separate(struct ring_mm *, struct mem_block *, int);
-//struct mem_block * rm_get_nonmanifest_block(struct ring_mm *);
-//int rb_memcpy(struct ring_mm *, struct mem_block *, char *, int);
-//int rb_wrap(int);
+//int rb_collate(struct ring_mm *, int);		/* Merges adjacent free blocks to form larger free blocks */
+//int rb_separate(struct ring_mm *, int, rb_off);
+//int rb_get_nonmanifest_block(struct ring_mm *);
+//rb_off rb_memcpy(struct ring_mm *, int, const char *, rb_off);
+//rb_off rb_wrap(const struct ring_mm *, rb_off);
 #endif
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+
+/**
+ * Minimal assertions for the test programs
+ *  CHECK reports a failed condition and carries on, so one run lists every
+ *  failure.  check_done prints the summary; main returns its result.
+ */
+static int check_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			check_failures++; \
+		} \
+	} while (0)
+
+static int check_done(const char * name)
+{
+	printf("%s: %s\n", name, check_failures ? "FAILED" : "ok");
+	return check_failures ? 1 : 0;
+}
+
+#endif
@@ -1,11 +1,13 @@
 
 
+#include <stdio.h>
+
 #include "../src/ring_buffer.h"
 
 
 void print_buffer(struct ring_mm * ring_buffer)
 {
-	int i, j, k;
+	int i, j;
 	int found = 0;
 	
 	for (i=0; i < BUFFER_SIZE; i++) {
@@ -21,13 +23,13 @@ void print_buffer(struct ring_mm * ring_buffer)
 		for (i=0; i < BUFFER_SIZE; i++) {
 			found = 0;	
 			for (j=0; j < MAX_ITEMS; j++) {
-				if (ring_buffer->mem_blocks[j].manifest == 1
-					&& ring_buffer->mem_blocks[j].start_index == i) {
+				if (RB_BIT_TEST(ring_buffer->manifest_map, j)
+					&& ring_buffer->start_index[j] == i) {
 
-					if (ring_buffer->mem_blocks[j].in_use == 0) {
-						printf("*%02d", ring_buffer->mem_blocks[j].length);
+					if (!RB_BIT_TEST(ring_buffer->in_use_map, j)) {
+						printf("*%02ld", (long)ring_buffer->length[j]);
 					} else {
-						printf("^%02d", ring_buffer->mem_blocks[j].length);
+						printf("^%02ld", (long)ring_buffer->length[j]);
 					}
 					found = 1;
 				}
@@ -41,10 +43,13 @@ void print_buffer(struct ring_mm * ring_buffer)
 	}
 }
 
-int main(int argc, char ** argv)
+int main(void)
 {
 
 	struct ring_mm ring_buffer;
+	struct rb_span first, second;
+	struct rb_magazine mag;
+	rb_off h;
 	
 	rb_init(&ring_buffer);
 	
@@ -70,6 +75,28 @@ int main(int argc, char ** argv)
 	
 	print_buffer(&ring_buffer);
 	
+	/* Zero-copy view of the block that wraps around the end of the buffer */
+	if (rb_view(&ring_buffer, 24, &first, &second) > 0) {
+		printf("view: %.*s + %.*s\n", (int)first.length, first.data, (int)second.length, second.data);
+		
+		rb_free(&ring_buffer, 24);
+		print_buffer(&ring_buffer);
+		
+		rb_unview(&ring_buffer, 24);
+		print_buffer(&ring_buffer);
+	}
+	
+	/* A block freed into the magazine is reused without going back to the ring */
+	rb_free(&ring_buffer, 6);
+	rb_magazine_init(&mag);
+	h = rb_write_cached(&ring_buffer, &mag, "small", 5);
+	print_buffer(&ring_buffer);
+	rb_free_cached(&ring_buffer, &mag, h);
+	printf("reused: %d\n", rb_write_cached(&ring_buffer, &mag, "again", 5) == h);
+	rb_free_cached(&ring_buffer, &mag, h);
+	rb_magazine_drain(&ring_buffer, &mag);
+	print_buffer(&ring_buffer);
+	
 	return 0;
 }
 
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include "../lib_RBBroadcast.h"
+#include "check.h"
+
+#define RECORDS		200000
+#define CONSUMERS	3
+
+static struct RB_Broadcast bc;
+static char mem[1 << 14];
+static struct RB_Buffer_Block items[256];
+static int ids[CONSUMERS];
+static int bad[CONSUMERS];
+
+static void test_layout(void)
+{
+	int i;
+
+	/*每个游标独占一个cache line*/
+	CHECK(sizeof(struct RB_BcCursor) == RB_CACHE_LINE);
+	CHECK(offsetof(struct RB_Broadcast, head) % RB_CACHE_LINE == 0);
+	CHECK(((unsigned long)&bc.head) % RB_CACHE_LINE == 0);
+	for (i = 0; i < RB_BC_MAX_CONSUMERS; i++)
+		CHECK(((unsigned long)&bc.cursor[i]) % RB_CACHE_LINE == 0);
+}
+
+static void test_basic(void)
+{
+	char out[64];
+	int a, b, old, i;
+
+	/*内置空间*/
+	CHECK(RB_BcInit(&bc, NULL, 0, NULL, 0, 0) == 1);
+	CHECK(bc.buf.size == RB_BUFFER_SIZE);
+
+	/*调用者的空间; 没有记录表不行*/
+	CHECK(RB_BcInit(&bc, mem, sizeof(mem), NULL, 0, 0) == 0);
+	CHECK(RB_BcInit(&bc, mem, sizeof(mem), items, 256, 0) == 1);
+	CHECK(bc.buf.size == sizeof(mem) && bc.buf.item_size == 256);
+
+	a = RB_BcAttach(&bc);
+	b = RB_BcAttach(&bc);
+	CHECK(a >= 0 && b >= 0 && a != b);
+	CHECK(RB_BcRead(&bc, a, out, sizeof(out)) == 0);
+
+	/*两个消费者各读到全部记录*/
+	CHECK(RB_BcPublish(&bc, "first", 5) == 5);
+	CHECK(RB_BcPublish(&bc, "second", 6) == 6);
+	CHECK(RB_BcRead(&bc, a, out, sizeof(out)) == 5 && memcmp(out, "first", 5) == 0);
+	CHECK(RB_BcRead(&bc, a, out, sizeof(out)) == 6 && memcmp(out, "second", 6) == 0);
+	CHECK(RB_BcRead(&bc, a, out, sizeof(out)) == 0);
+	CHECK(RB_BcRead(&bc, b, out, sizeof(out)) == 5 && memcmp(out, "first", 5) == 0);
+
+	/*最慢的消费者没读完之前记录不回收: 记录表满*/
+	for (i = 0; i < 256; i++)
+	{
+		if (RB_BcPublish(&bc, "x", 1) == 0) break;
+		RB_BcRead(&bc, a, out, sizeof(out));
+	}
+	CHECK(i == 256 - 1);	//b还没读"second"
+	CHECK(RB_BcRead(&bc, b, out, sizeof(out)) == 6);
+	CHECK(RB_BcPublish(&bc, "y", 1) == 1);
+
+	/*后注册的消费者从下一条记录开始; 同一位置的旧id失效*/
+	CHECK(RB_BcDetach(&bc, b) == 0);
+	CHECK(RB_BcDetach(&bc, b) == -1);
+	CHECK(RB_BcRead(&bc, b, out, sizeof(out)) == -1);
+	old = b;
+	b = RB_BcAttach(&bc);
+	CHECK(b != old && b % RB_BC_MAX_CONSUMERS == old % RB_BC_MAX_CONSUMERS);
+	CHECK(RB_BcRead(&bc, b, out, sizeof(out)) == 0);
+	CHECK(RB_BcPublish(&bc, "z", 1) == 1);
+	CHECK(RB_BcRead(&bc, old, out, sizeof(out)) == -1);
+	CHECK(RB_BcDetach(&bc, old) == -1);
+	CHECK(RB_BcRead(&bc, b, out, sizeof(out)) == 1 && out[0] == 'z');
+
+	/*无效的id*/
+	CHECK(RB_BcRead(&bc, -1, out, sizeof(out)) == -1);
+	CHECK(RB_BcRead(&bc, 1 << 30, out, sizeof(out)) == -1);
+	CHECK(RB_BcDetach(&bc, -5) == -1);
+}
+
+static void test_laggard(void)
+{
+	char out[64];
+	int a, b, i;
+
+	RB_BcInit(&bc, NULL, 0, NULL, 0, 3);
+	a = RB_BcAttach(&bc);
+	b = RB_BcAttach(&bc);
+
+	/*b不读: ring满时被摘除, a不受影响*/
+	for (i = 0; i < 10; i++)
+	{
+		CHECK(RB_BcPublish(&bc, "x", 1) == 1);
+		CHECK(RB_BcRead(&bc, a, out, sizeof(out)) == 1);
+	}
+	CHECK(RB_BcRead(&bc, b, out, sizeof(out)) == -1);
+	CHECK(RB_BcRead(&bc, a, out, sizeof(out)) == 0);
+}
+
+static void * consumer(void * arg)
+{
+	int k = (int)(long)arg;
+	unsigned int expect = 0, got;
+	int n;
+
+	while (expect < RECORDS)
+	{
+		n = RB_BcRead(&bc, ids[k], (char *)&got, sizeof(got));
+		if (n == 0)
+		{
+			sched_yield();
+			continue;
+		}
+		if (n != sizeof(got) || got != expect) bad[k]++;
+		expect++;
+	}
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	pthread_t t[CONSUMERS];
+	unsigned int i;
+	int k;
+
+	RB_BcInit(&bc, mem, sizeof(mem), items, 256, 0);
+	for (k = 0; k < CONSUMERS; k++) ids[k] = RB_BcAttach(&bc);
+	for (k = 0; k < CONSUMERS; k++) pthread_create(&t[k], NULL, consumer, (void *)(long)k);
+
+	for (i = 0; i < RECORDS; i++)
+	{
+		while (RB_BcPublish(&bc, (const char *)&i, sizeof(i)) == 0)
+			sched_yield();
+	}
+
+	for (k = 0; k < CONSUMERS; k++)
+	{
+		pthread_join(t[k], NULL);
+		CHECK(bad[k] == 0);
+	}
+}
+
+int main(void)
+{
+	test_layout();
+	test_basic();
+	test_laggard();
+	test_threads();
+
+	return check_done("test_broadcast");
+}
@@ -0,0 +1,14 @@
+#ifndef _TEST_CLOCK_H_
+#define _TEST_CLOCK_H_
+
+/**
+ * Pulled in ahead of everything (gcc -include) by builds that time blocks:
+ * RB_NOW() reads a clock the test sets, so ages and sojourn times are exact.
+ */
+#include "../src/rb_types.h"
+
+extern rb_u64 rb_test_clock;
+
+#define RB_NOW()	rb_test_clock
+
+#endif
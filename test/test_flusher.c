@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../lib_RBFlusher.h"
+#include "check.h"
+
+#define LOG_PATH	"test_flusher.log"
+
+/*读回整个日志文件, 返回长度*/
+static long read_log(char * out, long cap)
+{
+	FILE * f = fopen(LOG_PATH, "rb");
+	long n;
+
+	if (f == NULL) return -1;
+	n = (long)fread(out, 1, cap, f);
+	fclose(f);
+	return n;
+}
+
+static void test_write_sync(void)
+{
+	struct RB_Buffer buf;
+	struct RB_Flusher fl;
+	char line[32], big[200], expect[4096], got[8192];
+	int i, n, len = 0;
+
+	unlink(LOG_PATH);
+	RB_init(&buf);
+	CHECK(RB_FlusherStart(&fl, &buf, LOG_PATH, RB_FLUSH_SYNCRANGE) == 0);
+
+	for (i = 0; i < 100; i++)
+	{
+		n = sprintf(line, "line %d\n", i);
+		CHECK(RB_FlusherWrite(&fl, line, n) == n);
+		memcpy(&expect[len], line, n);
+		len += n;
+	}
+
+	/*比ring长的记录永远写不进去, 不能等*/
+	memset(big, 'x', sizeof(big));
+	CHECK(RB_FlusherWrite(&fl, big, sizeof(big)) == 0);
+	CHECK(RB_FlusherWrite(&fl, big, 0) == 0);
+
+	CHECK(RB_FlusherSync(&fl) == 0);
+	CHECK(read_log(got, sizeof(got)) == len);
+	CHECK(memcmp(got, expect, len) == 0);
+	RB_FlusherStop(&fl);
+
+	/*再次打开时追加在后面*/
+	CHECK(RB_FlusherStart(&fl, &buf, LOG_PATH, 0) == 0);
+	CHECK(RB_FlusherWrite(&fl, "tail\n", 5) == 5);
+	RB_FlusherStop(&fl);
+	memcpy(&expect[len], "tail\n", 5);
+	len += 5;
+	CHECK(read_log(got, sizeof(got)) == len);
+	CHECK(memcmp(got, expect, len) == 0);
+}
+
+static void test_coalesced(void)
+{
+	struct RB_Buffer buf;
+	struct RB_Flusher fl;
+	char got[256];
+	int i;
+
+	unlink(LOG_PATH);
+	RB_init(&buf);
+	RB_SetCoalesce(&buf, 64, 1000000);	//超时很长: 只有barrier会发布帧
+	CHECK(RB_FlusherStart(&fl, &buf, LOG_PATH, 0) == 0);
+
+	for (i = 0; i < 5; i++) CHECK(RB_FlusherWrite(&fl, "ab", 2) == 2);
+	CHECK(RB_FlusherFlush(&fl) == 0);
+	CHECK(read_log(got, sizeof(got)) == 10);
+	CHECK(memcmp(got, "ababababab", 10) == 0);
+
+	CHECK(RB_FlusherWrite(&fl, "cd", 2) == 2);
+	CHECK(RB_FlusherSync(&fl) == 0);
+	CHECK(read_log(got, sizeof(got)) == 12);
+
+	/*停止时未发布的帧也要写出*/
+	CHECK(RB_FlusherWrite(&fl, "ef", 2) == 2);
+	RB_FlusherStop(&fl);
+	CHECK(read_log(got, sizeof(got)) == 14);
+	CHECK(memcmp(got, "abababababcdef", 14) == 0);
+}
+
+#define RESIZE_LINES	20000
+
+static void * resize_writer(void * arg)
+{
+	struct RB_Flusher * fl = (struct RB_Flusher *)arg;
+	char line[32];
+	int i, n;
+
+	for (i = 0; i < RESIZE_LINES; i++)
+	{
+		n = sprintf(line, "%d\n", i);
+		CHECK(RB_FlusherWrite(fl, line, n) == n);
+	}
+	return NULL;
+}
+
+static void test_resize(void)
+{
+	static char got[RESIZE_LINES * 8];
+	struct RB_Buffer buf;
+	struct RB_Flusher fl;
+	pthread_t th;
+	char * p;
+	long len;
+	int i, n;
+
+	/*写入方不停写, 其间反复改变ring大小: 日志一条不少, 顺序不变*/
+	unlink(LOG_PATH);
+	RB_init(&buf);
+	CHECK(RB_FlusherStart(&fl, &buf, LOG_PATH, 0) == 0);
+	CHECK(pthread_create(&th, NULL, resize_writer, &fl) == 0);
+	for (i = 0; i < 200; i++)
+	{
+		RB_FlusherResize(&fl, (i & 1) ? 4096 : 512, (i & 1) ? 256 : 32);
+		usleep(100);
+	}
+	pthread_join(th, NULL);
+	CHECK(RB_FlusherSync(&fl) == 0);
+	RB_FlusherStop(&fl);
+
+	len = read_log(got, sizeof(got) - 1);
+	CHECK(len > 0);
+	got[len > 0 ? len : 0] = 0;
+	for (i = 0, p = got; i < RESIZE_LINES && *p; i++, p += n)
+	{
+		CHECK(atoi(p) == i);
+		n = strchr(p, '\n') + 1 - p;
+	}
+	CHECK(i == RESIZE_LINES && *p == 0);
+}
+
+static void test_io_error(void)
+{
+	struct RB_Buffer buf;
+	struct RB_Flusher fl;
+
+	if (access("/dev/full", W_OK) != 0) return;
+
+	RB_init(&buf);
+	CHECK(RB_FlusherStart(&fl, &buf, "/dev/full", 0) == 0);
+	CHECK(RB_FlusherWrite(&fl, "lost\n", 5) == 5);
+	CHECK(RB_FlusherFlush(&fl) == -1);
+	RB_FlusherStop(&fl);
+}
+
+int main(void)
+{
+	alarm(60);	//卡住即失败
+
+	test_write_sync();
+	test_coalesced();
+	test_resize();
+	test_io_error();
+
+	unlink(LOG_PATH);
+	return check_done("test_flusher");
+}
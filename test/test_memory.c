@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/ring_buffer.h"
+#include "../src/rb_memory.h"
+#include "../lib_RingBuffer.h"
+#include "check.h"
+
+#define MB	(1024UL * 1024)
+
+static void test_map(void)
+{
+	struct rb_region region;
+	unsigned long page = (unsigned long)sysconf(_SC_PAGESIZE);
+
+	CHECK(rb_region_map(&region, 0, 0, 0) == -1);
+
+	/*普通页: 按页大小取整, 用得上*/
+	CHECK(rb_region_map(&region, MB + 1, 0, 0) == 0);
+	CHECK(region.base != NULL);
+	CHECK(region.size == MB + 1);
+	CHECK(region.mapped >= region.size && region.mapped % page == 0);
+	CHECK(((unsigned long)region.base) % page == 0);
+	CHECK(region.flags == 0);
+	memset(region.base, 0x5a, region.size);
+	CHECK(region.base[MB] == 0x5a);
+	rb_region_unmap(&region);
+	CHECK(region.base == NULL && region.mapped == 0);
+
+	/*要不到大页时退回普通页/透明大页, flags为实际生效的选项*/
+	CHECK(rb_region_map(&region, 3 * MB, RB_MEM_HUGETLB, 0) == 0);
+	CHECK(region.base != NULL);
+	CHECK((region.flags & ~(RB_MEM_HUGETLB | RB_MEM_THP)) == 0);
+	if (region.flags & (RB_MEM_HUGETLB | RB_MEM_THP))
+	{
+		CHECK(region.mapped % RB_HUGE_PAGE_SIZE == 0);
+		CHECK(((unsigned long)region.base) % RB_HUGE_PAGE_SIZE == 0);
+	}
+	region.base[region.size - 1] = 1;
+	rb_region_unmap(&region);
+
+	/*不存在的NUMA节点: 仍然映射, 只是不绑定*/
+	CHECK(rb_region_map(&region, MB, RB_MEM_NUMA, 100000) == 0);
+	CHECK(region.base != NULL);
+	CHECK(!(region.flags & RB_MEM_NUMA));
+	rb_region_unmap(&region);
+
+	/*预先触碰: 全部常驻*/
+	CHECK(rb_region_map(&region, MB, RB_MEM_PREFAULT, 0) == 0);
+	CHECK(region.flags & RB_MEM_PREFAULT);
+	CHECK(rb_region_resident(&region) == region.mapped);
+	rb_region_unmap(&region);
+}
+
+static void test_rings_on_region(void)
+{
+	struct rb_region region;
+	struct ring_mm * mm;
+	struct RB_Buffer buf;
+	char out[64];
+	rb_off h;
+
+	/*RB_Buffer: 只用不超过size的最大2的幂*/
+	CHECK(rb_region_map(&region, 3 * MB, RB_MEM_PREFAULT, 0) == 0);
+	CHECK(RB_InitEx(&buf, region.base, region.size) == 1);
+	CHECK(buf.size == 2 * MB);
+	CHECK(buf.pdata == region.base);
+	CHECK(RB_write(&buf, "on a region", 11) == 11);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 11);
+	CHECK(memcmp(out, "on a region", 11) == 0);
+	rb_region_unmap(&region);
+
+	/*ring_mm: 管理整块区域*/
+	mm = (struct ring_mm *)malloc(sizeof(*mm));
+	CHECK(rb_region_map(&region, MB, 0, 0) == 0);
+	CHECK(rb_init_ex(mm, region.base, (rb_off)region.size) == 0);
+	h = rb_write(mm, "0123456789012345678901234567890123456789", 40);
+	CHECK(h >= 0);
+	CHECK(rb_read(mm, h, out, sizeof(out)) == 40);
+	CHECK(memcmp(out, "0123456789012345678901234567890123456789", 40) == 0);
+	CHECK(rb_free(mm, h) == 0);
+	rb_region_unmap(&region);
+	free(mm);
+}
+
+static void test_trim(void)
+{
+	struct rb_region region;
+	struct RB_Buffer buf;
+	char rec[1000], out[1000];
+	unsigned long released;
+	int i;
+
+	CHECK(rb_region_map(&region, MB, RB_MEM_LAZY, 0) == 0);
+	CHECK(region.flags & RB_MEM_LAZY);
+	CHECK(rb_region_resident(&region) == 0);
+	rb_region_set_trim(&region, 10);
+	CHECK(RB_InitEx(&buf, region.base, region.size) == 1);
+	for (i = 0; i < (int)sizeof(rec); i++) rec[i] = (char)(i * 31 + 7);
+
+	/*写读到第4个chunk中间, 时间0时报告: 都算刚用过*/
+	while (buf.write_index < 3 * region.chunk + region.chunk / 2)
+	{
+		CHECK(RB_write(&buf, rec, sizeof(rec)) == sizeof(rec));
+		CHECK(RB_ReadItem(&buf, out, sizeof(out)) == sizeof(rec));
+	}
+	CHECK(rb_region_trim_ring(&region, buf.size, buf.read_index, buf.write_index, 0) == 0);
+	CHECK(rb_region_resident(&region) >= 3 * region.chunk);
+
+	/*之后写入的记录落在闲置已久的chunk里: 同时报告游标, 它不会被清零*/
+	CHECK(RB_write(&buf, rec, sizeof(rec)) == sizeof(rec));
+	released = rb_region_trim_ring(&region, buf.size, buf.read_index, buf.write_index, 50);
+	CHECK(released == 3 * region.chunk);
+	CHECK(region.released == released);
+	CHECK(rb_region_resident(&region) <= region.chunk);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == sizeof(rec));
+	CHECK(memcmp(out, rec, sizeof(rec)) == 0);
+
+	/*空ring: 写游标所在的chunk留着, 其余全部释放*/
+	CHECK(rb_region_trim_ring(&region, buf.size, buf.read_index, buf.write_index, 55) == 0);
+	CHECK(rb_region_trim_ring(&region, buf.size, buf.read_index, buf.write_index, 100) == 0);
+	CHECK(RB_write(&buf, rec, sizeof(rec)) == sizeof(rec));
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == sizeof(rec));
+	CHECK(memcmp(out, rec, sizeof(rec)) == 0);
+	rb_region_unmap(&region);
+}
+
+static void test_large(void)
+{
+	struct rb_region region;
+	struct ring_mm * mm;
+	struct RB_Buffer buf;
+	char out[64], * p;
+	rb_off big, h;
+
+	/*超过2GB的区域: 只有写到的页才占内存, 映射不了就跳过*/
+	if (rb_region_map(&region, 3UL << 30, RB_MEM_LAZY, 0) != 0) return;
+
+	/*RB_Buffer: 2^31字节, 空闲空间和位置都超出int*/
+	CHECK(RB_InitEx(&buf, region.base, region.size) == 1);
+	CHECK(buf.size == 1LL << 31);
+	CHECK(RB_GetFreeSize(&buf) == 1LL << 31);
+	buf.read_index = buf.write_index = (5ULL << 31) - 20;
+	CHECK(RB_write(&buf, "0123456789012345678901234567890123456789", 40) == 40);
+	CHECK(RB_GetFreeSize(&buf) == (1LL << 31) - 40);
+	CHECK(memcmp(&region.base[(1UL << 31) - 20], "01234567890123456789", 20) == 0);
+	CHECK(memcmp(region.base, "01234567890123456789", 20) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 40);
+	CHECK(memcmp(out, "0123456789012345678901234567890123456789", 40) == 0);
+
+	/*ring_mm: rb_off偏移, 第一块之后的块从2^31之后开始*/
+	mm = (struct ring_mm *)malloc(sizeof(*mm));
+	CHECK(rb_init_ex(mm, region.base, (rb_off)region.size) == 0);
+	big = rb_alloc(mm, ((rb_off)1 << 31) + 4096, 0, &p);
+	CHECK(big == 0);
+	CHECK(rb_commit(mm, big, ((rb_off)1 << 31) + 4096) == 0);
+	h = rb_write(mm, "past two gigabytes, still a long offset", 40);
+	CHECK(h == ((rb_off)1 << 31) + 4096);
+	CHECK(rb_read(mm, h, out, sizeof(out)) == 40);
+	CHECK(memcmp(out, "past two gigabytes", 18) == 0);
+	CHECK(rb_read(mm, big, out, 1) == 1);
+	CHECK(rb_free(mm, h) == 0);
+	CHECK(rb_free(mm, big) == 0);
+	free(mm);
+
+	rb_region_unmap(&region);
+}
+
+int main(void)
+{
+	test_map();
+	test_rings_on_region();
+	test_trim();
+	test_large();
+
+	return check_done("test_memory");
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include "../lib_RBMux.h"
+#include "check.h"
+
+static struct RB_Buffer buf;
+static struct RB_Mux mux;
+
+static void test_channels(void)
+{
+	char out[32];
+	int ch = -1;
+
+	RB_init(&buf);
+	CHECK(RB_MuxInit(&mux, &buf, 1000, 64) == 1);
+	CHECK(buf.item_size >= 1000 * RB_MUX_ITEMS_PER_CHANNEL);
+
+	CHECK(RB_MuxWrite(&mux, 7, "0123456789", 10) == 10);
+	CHECK(RB_MuxWrite(&mux, 3, "abc", 3) == 3);
+	CHECK(RB_MuxWrite(&mux, 7, "xyz", 3) == 3);
+	CHECK(RB_MuxWrite(&mux, 1000, "bad", 3) == -1);
+	CHECK(RB_MuxWrite(&mux, -1, "bad", 3) == -1);
+	CHECK(RB_MuxWrite(&mux, 3, "bad", 0) == -1);
+	CHECK(RB_MuxWrite(&mux, 3, "bad", (int)buf.size + 1) == -1);
+	CHECK(RB_MuxPending(&mux, 7) == 2 && RB_MuxPending(&mux, 3) == 1);
+
+	/*不必先取出通道7的记录*/
+	CHECK(RB_MuxRead(&mux, 3, out, sizeof(out)) == 3 && memcmp(out, "abc", 3) == 0);
+	CHECK(RB_MuxRead(&mux, 3, out, sizeof(out)) == 0);
+	CHECK(RB_MuxReadAny(&mux, &ch, out, sizeof(out)) == 10 && ch == 7);
+	CHECK(RB_MuxReadAny(&mux, &ch, out, sizeof(out)) == 3 && ch == 7 && memcmp(out, "xyz", 3) == 0);
+	CHECK(RB_MuxReadAny(&mux, &ch, out, sizeof(out)) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 0 && mux.done == 0);
+
+	/*配额按ring中的占用计*/
+	RB_MuxSetQuota(&mux, 5, 8);
+	CHECK(RB_MuxWrite(&mux, 5, "12345", 5) == 5);
+	CHECK(RB_MuxWrite(&mux, 5, "12345", 5) == -1);
+	CHECK(RB_MuxWrite(&mux, 6, "12345", 5) == 5);
+	RB_MuxFree(&mux);
+
+	/*已有记录或开启合并时不能建立通道*/
+	RB_init(&buf);
+	RB_write(&buf, "x", 1);
+	CHECK(RB_MuxInit(&mux, &buf, 4, 0) == 0);
+	RB_init(&buf);
+	RB_SetCoalesce(&buf, 64, 10);
+	CHECK(RB_MuxInit(&mux, &buf, 4, 0) == 0);
+}
+
+static void test_idle(void)
+{
+	char rec[20], out[32];
+	static char big[RB_BUFFER_SIZE + 1];
+	unsigned long long head;
+	int i, k, ok = 1;
+
+	/*通道0的记录一直不取, 通道1反复写取: 空间和记录表项不能被通道0挡住*/
+	RB_init(&buf);
+	CHECK(RB_MuxInit(&mux, &buf, 4, 0) == 1);
+	CHECK(RB_MuxWrite(&mux, 0, "idle-record", 11) == 11);
+	CHECK(RB_MuxWrite(&mux, 2, "second-idle", 11) == 11);
+	for (i = 0; i < 200; i++)
+	{
+		sprintf(rec, "busy-%05d-record", i);
+		if (RB_MuxWrite(&mux, 1, rec, 17) != 17) ok = 0;
+		if (RB_MuxRead(&mux, 1, out, sizeof(out)) != 17 || memcmp(out, rec, 17) != 0) ok = 0;
+	}
+	CHECK(ok);
+	CHECK(RB_GetItemsCount(&buf) - mux.done == 2 && buf.write_index > 200 * 17);
+
+	/*放不进ring的记录直接失败, 不移动队首记录*/
+	k = mux.done;
+	head = buf.item_read_index;
+	CHECK(RB_MuxWrite(&mux, 1, big, sizeof(big)) == -1);
+	CHECK(mux.done == k && buf.item_read_index == head);
+
+	/*通道内顺序不变*/
+	CHECK(RB_MuxWrite(&mux, 0, "idle-2", 6) == 6);
+	for (i = 0; i < 10 && ok; i++)
+	{
+		sprintf(rec, "busy-%05d-record", i);
+		if (RB_MuxWrite(&mux, 1, rec, 17) != 17) ok = 0;
+		if (RB_MuxRead(&mux, 1, out, sizeof(out)) != 17) ok = 0;
+	}
+	CHECK(ok);
+	CHECK(RB_MuxRead(&mux, 0, out, sizeof(out)) == 11 && memcmp(out, "idle-record", 11) == 0);
+	CHECK(RB_MuxRead(&mux, 0, out, sizeof(out)) == 6 && memcmp(out, "idle-2", 6) == 0);
+	CHECK(RB_MuxRead(&mux, 2, out, sizeof(out)) == 11 && memcmp(out, "second-idle", 11) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 0 && mux.done == 0);
+
+	/*全是未取出的记录时仍然写不下*/
+	while (RB_MuxWrite(&mux, 3, "fill-fill", 9) == 9)
+		;
+	CHECK(RB_MuxWrite(&mux, 1, "fill-fill", 9) == 0);
+	CHECK(mux.done == 0);
+	RB_MuxFree(&mux);
+}
+
+static void test_many(void)
+{
+	static char mem[16384];
+	char rec[8], out[8];
+	int i, ok = 1;
+
+	/*几千个通道, 每个通道一条记录, 倒序取出*/
+	CHECK(RB_InitEx(&buf, mem, sizeof(mem)) == 1);
+	CHECK(RB_MuxInit(&mux, &buf, 3000, 0) == 1);
+	for (i = 0; i < 3000; i++)
+	{
+		sprintf(rec, "%04d", i);
+		if (RB_MuxWrite(&mux, i, rec, 4) != 4) ok = 0;
+	}
+	CHECK(ok);
+	for (i = 2999; i >= 0; i--)
+	{
+		sprintf(rec, "%04d", i);
+		if (RB_MuxRead(&mux, i, out, sizeof(out)) != 4 || memcmp(out, rec, 4) != 0) ok = 0;
+	}
+	CHECK(ok);
+	CHECK(RB_GetItemsCount(&buf) == 0);
+	RB_MuxFree(&mux);
+}
+
+int main(void)
+{
+	test_channels();
+	test_idle();
+	test_many();
+
+	return check_done("test_mux");
+}
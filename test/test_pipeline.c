@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../lib_RBPipeline.h"
+#include "check.h"
+
+#define RECORDS	20000
+
+struct collect {
+		int	count;
+		int	last;		/*上一条收到的值*/
+		int	in_order;
+};
+
+/*阶段0: 过滤掉奇数, 偶数原样输出*/
+static int even_only(void * ctx, const char * in, int inlen, char * out, int outcap)
+{
+	int v;
+
+	(void)ctx;
+	CHECK(inlen == sizeof(int));
+	memcpy(&v, in, sizeof(int));
+	if (v & 1) return 0;
+	if (outcap < inlen) return -1;
+	memcpy(out, in, inlen);
+	return inlen;
+}
+
+/*阶段1: 10的倍数出错丢弃, 其余变成文本*/
+static int to_text(void * ctx, const char * in, int inlen, char * out, int outcap)
+{
+	int v;
+
+	(void)ctx;
+	(void)inlen;
+	memcpy(&v, in, sizeof(int));
+	if (v % 10 == 0) return -1;
+	return snprintf(out, outcap, "%d", v);
+}
+
+/*3的倍数谎报超过outcap的长度, 其余原样输出*/
+static int overlong(void * ctx, const char * in, int inlen, char * out, int outcap)
+{
+	int v;
+
+	(void)ctx;
+	memcpy(&v, in, sizeof(int));
+	if (v % 3 == 0) return outcap + 1;
+	memcpy(out, in, inlen);
+	return inlen;
+}
+
+/*最后阶段: 计数*/
+static int count_only(void * ctx, const char * in, int inlen, char * out, int outcap)
+{
+	(void)in;
+	(void)inlen;
+	(void)out;
+	(void)outcap;
+	(*(int *)ctx)++;
+	return 0;
+}
+
+/*最后阶段: 检查顺序*/
+static int collect(void * ctx, const char * in, int inlen, char * out, int outcap)
+{
+	struct collect * c = (struct collect *)ctx;
+	char text[16];
+	int v;
+
+	CHECK(out == NULL && outcap == 0);
+	memcpy(text, in, inlen);
+	text[inlen] = 0;
+	v = atoi(text);
+	if (v <= c->last || (v & 1) || v % 10 == 0) c->in_order = 0;
+	c->last = v;
+	c->count++;
+	return 0;
+}
+
+static void test_pipeline(void)
+{
+	struct RB_Buffer a, b, c;
+	struct RB_Pipeline pipe;
+	struct RB_PipeStats st;
+	struct collect got = { 0, -1, 1 };
+	char big[RB_BUFFER_SIZE + 1];
+	int i;
+
+	RB_init(&a);
+	RB_init(&b);
+	RB_init(&c);
+	RB_PipeInit(&pipe);
+	CHECK(RB_PipeAddStage(&pipe, &a, even_only, NULL, -1) == 0);
+	CHECK(RB_PipeAddStage(&pipe, &b, to_text, NULL, -1) == 1);
+	CHECK(RB_PipeAddStage(&pipe, &c, collect, &got, -1) == 2);
+	CHECK(RB_PipeStart(&pipe) == 0);
+
+	/*小ring, 反压一直传到RB_PipePush*/
+	for (i = 0; i < RECORDS; i++) CHECK(RB_PipePush(&pipe, (const char *)&i, sizeof(int)) == sizeof(int));
+	memset(big, 'x', sizeof(big));
+	CHECK(RB_PipePush(&pipe, big, sizeof(big)) == 0);	//比第一个ring长
+	RB_PipeStop(&pipe);
+
+	/*停止时全部排空, 顺序不变*/
+	CHECK(got.in_order);
+	CHECK(got.count == RECORDS / 2 - RECORDS / 10);
+
+	RB_PipeGetStats(&pipe, 0, &st);
+	CHECK(st.records == RECORDS);
+	CHECK(st.bytes == RECORDS * sizeof(int));
+	CHECK(st.out == RECORDS / 2);
+	CHECK(st.errors == 0);
+	CHECK(st.batches > 0 && st.batches <= st.records);
+	CHECK(st.batch >= 1 && st.batch <= RB_PIPE_BATCH_MAX);
+	RB_PipeGetStats(&pipe, 1, &st);
+	CHECK(st.records == RECORDS / 2);
+	CHECK(st.errors == RECORDS / 10);
+	CHECK(st.out == (unsigned long long)got.count);
+	RB_PipeGetStats(&pipe, 2, &st);
+	CHECK(st.records == (unsigned long long)got.count);
+	CHECK(st.out == 0);
+
+	/*停止后不再接收*/
+	CHECK(RB_PipePush(&pipe, "late", 4) == 0);
+}
+
+/*不停写入, 直到流水线停止*/
+static void * pusher(void * arg)
+{
+	struct RB_Pipeline * pipe = (struct RB_Pipeline *)arg;
+	int i = 0;
+
+	while (RB_PipePush(pipe, (const char *)&i, sizeof(int)) == sizeof(int)) i++;
+	return NULL;
+}
+
+static void test_stop_while_pushing(void)
+{
+	struct RB_Buffer a;
+	struct RB_Pipeline pipe;
+	pthread_t th;
+	int n = 0;
+
+	/*RB_PipeStop让正在等待的RB_PipePush返回0, 等它离开后才销毁锁*/
+	RB_init(&a);
+	RB_PipeInit(&pipe);
+	CHECK(RB_PipeAddStage(&pipe, &a, count_only, &n, -1) == 0);
+	CHECK(RB_PipeStart(&pipe) == 0);
+	CHECK(pthread_create(&th, NULL, pusher, &pipe) == 0);
+	usleep(10000);
+	RB_PipeStop(&pipe);
+	pthread_join(th, NULL);
+	CHECK(pipe.pushers == 0);
+	CHECK(RB_PipePush(&pipe, "late", 4) == 0);
+}
+
+static void test_overlong(void)
+{
+	struct RB_Buffer a, b;
+	struct RB_Pipeline pipe;
+	struct RB_PipeStats st;
+	int i, n = 0;
+
+	/*超过outcap的输出算出错, 不往下传*/
+	RB_init(&a);
+	RB_init(&b);
+	RB_PipeInit(&pipe);
+	CHECK(RB_PipeAddStage(&pipe, &a, overlong, NULL, -1) == 0);
+	CHECK(RB_PipeAddStage(&pipe, &b, count_only, &n, -1) == 1);
+	CHECK(RB_PipeStart(&pipe) == 0);
+	for (i = 0; i < 300; i++) CHECK(RB_PipePush(&pipe, (const char *)&i, sizeof(int)) == sizeof(int));
+	RB_PipeStop(&pipe);
+
+	CHECK(n == 200);
+	CHECK(RB_PipeGetStats(&pipe, 0, &st) == 0);
+	CHECK(st.errors == 100 && st.out == 200);
+}
+
+static void test_limits(void)
+{
+	struct RB_Buffer buf[RB_PIPE_MAX_STAGES + 1];
+	struct RB_Pipeline pipe;
+	struct RB_PipeStats st;
+	int i;
+
+	/*阶段数有上限; 没有阶段不能启动*/
+	RB_PipeInit(&pipe);
+	CHECK(RB_PipePush(&pipe, "x", 1) == 0);
+	for (i = 0; i <= RB_PIPE_MAX_STAGES; i++)
+	{
+		RB_init(&buf[i]);
+		CHECK(RB_PipeAddStage(&pipe, &buf[i], collect, NULL, -1) == (i < RB_PIPE_MAX_STAGES ? i : -1));
+	}
+
+	RB_PipeInit(&pipe);
+	CHECK(RB_PipeStart(&pipe) == -1);
+	CHECK(RB_PipeAddStage(&pipe, NULL, collect, NULL, -1) == -1);
+
+	/*没有这个阶段*/
+	CHECK(RB_PipeAddStage(&pipe, &buf[0], collect, NULL, -1) == 0);
+	CHECK(RB_PipeGetStats(&pipe, -1, &st) == -1);
+	CHECK(RB_PipeGetStats(&pipe, 1, &st) == -1);
+	CHECK(RB_PipeGetStats(&pipe, 0, &st) == 0 && st.records == 0);
+}
+
+int main(void)
+{
+	alarm(60);	//卡住即失败
+
+	test_pipeline();
+	test_overlong();
+	test_stop_while_pushing();
+	test_limits();
+
+	return check_done("test_pipeline");
+}
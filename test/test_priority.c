@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string.h>
+#include "../lib_RBPriority.h"
+#include "check.h"
+
+static struct RB_Priority pq;
+
+static void test_strict(void)
+{
+	char out[32];
+	int lane = -1;
+
+	RB_PrioInit(&pq, RB_PRIO_STRICT, NULL);
+	CHECK(RB_PrioRead(&pq, out, sizeof(out), &lane) == 0);
+
+	CHECK(RB_PrioWrite(&pq, 3, "bulk1", 5) == 5);
+	CHECK(RB_PrioWrite(&pq, 3, "bulk2", 5) == 5);
+	CHECK(RB_PrioWrite(&pq, 1, "norm", 4) == 4);
+	CHECK(RB_PrioWrite(&pq, 0, "ctrl", 4) == 4);
+	CHECK(RB_PrioWrite(&pq, RB_PRIO_LANES, "bad", 3) == 0);
+	CHECK(RB_PrioWrite(&pq, -1, "bad", 3) == 0);
+	CHECK(RB_PrioGetItemsCount(&pq) == 4);
+
+	/*编号小的通道总是先取, 同一通道内先进先出*/
+	CHECK(RB_PrioRead(&pq, out, sizeof(out), &lane) == 4 && lane == 0 && memcmp(out, "ctrl", 4) == 0);
+	CHECK(RB_PrioRead(&pq, out, sizeof(out), &lane) == 4 && lane == 1);
+	CHECK(RB_PrioWrite(&pq, 2, "late", 4) == 4);
+	CHECK(RB_PrioRead(&pq, out, sizeof(out), &lane) == 4 && lane == 2);
+	CHECK(RB_PrioRead(&pq, out, sizeof(out), NULL) == 5 && memcmp(out, "bulk1", 5) == 0);
+	CHECK(RB_PrioRead(&pq, out, sizeof(out), &lane) == 5 && lane == 3 && memcmp(out, "bulk2", 5) == 0);
+	CHECK(RB_PrioRead(&pq, out, sizeof(out), &lane) == 0);
+	CHECK(pq.nonempty == 0);
+
+	/*一个通道满不影响其他通道*/
+	while (RB_PrioWrite(&pq, 3, "x", 1) == 1)
+		;
+	CHECK(RB_PrioGetItemsCount(&pq) == RB_Max_Items);
+	CHECK(RB_PrioWrite(&pq, 0, "y", 1) == 1);
+}
+
+static void test_weighted(void)
+{
+	int w[RB_PRIO_LANES] = {3, 1, 0, 0};
+	char out[32];
+	int order[8], lane, i, n;
+
+	RB_PrioInit(&pq, RB_PRIO_WRR, w);
+	for (i = 0; i < 4; i++)
+	{
+		CHECK(RB_PrioWrite(&pq, 0, "a", 1) == 1);
+		CHECK(RB_PrioWrite(&pq, 1, "b", 1) == 1);
+	}
+
+	/*每轮lane0取3条, lane1取1条*/
+	for (n = 0; n < 8 && RB_PrioRead(&pq, out, sizeof(out), &lane) > 0; n++) order[n] = lane;
+	CHECK(n == 8);
+	CHECK(order[0] == 0 && order[1] == 0 && order[2] == 0 && order[3] == 1);
+	CHECK(order[4] == 0 && order[5] == 1 && order[6] == 1 && order[7] == 1);
+
+	/*权重为0的通道在其他通道空时也能取出*/
+	CHECK(RB_PrioWrite(&pq, 2, "z", 1) == 1);
+	CHECK(RB_PrioRead(&pq, out, sizeof(out), &lane) == 1 && lane == 2);
+	CHECK(RB_PrioRead(&pq, out, sizeof(out), &lane) == 0);
+}
+
+int main(void)
+{
+	test_strict();
+	test_weighted();
+
+	return check_done("test_priority");
+}
@@ -0,0 +1,699 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "../lib_RingBuffer.h"
+#include "../lib_RBCodec.h"
+#include "check.h"
+
+static char mem[1 << 16];
+
+/*可压缩的记录: 重复的JSON片段*/
+static int make_json(char * out, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++) out[i] = "{\"id\":12,\"ok\":true},"[i % 20];
+	return length;
+}
+
+/*记下解压次数的LZ*/
+static int unpack_calls;
+
+static int counting_decompress(const char * src, int srclen, char * dst, int dstcap)
+{
+	unpack_calls++;
+	return RB_LZDecompress(src, srclen, dst, dstcap);
+}
+
+static const struct RB_Codec counting_codec = { RB_LZCompress, counting_decompress };
+
+static void test_codec(void)
+{
+	struct RB_Buffer buf;
+	char rec[4000], out[4000], part[100];
+	unsigned long raw, stored;
+	int len, n, off, last;
+
+	/*大ring上超过RB_BUFFER_SIZE的记录也压缩*/
+	CHECK(RB_InitEx(&buf, mem, sizeof(mem)) == 1);
+	CHECK(RB_SetCodec(&buf, &RB_LZCodec, 32) == 1);
+	len = make_json(rec, sizeof(rec));
+	CHECK(RB_write(&buf, rec, len) == len);
+	CHECK(buf.pitems[0].flags & RB_Item_Packed);
+	RB_GetCodecStats(&buf, &raw, &stored);
+	CHECK(raw == (unsigned long)len);
+	CHECK(stored < raw / 4);
+	CHECK(RB_GetFreeSize(&buf) == (long long)sizeof(mem) - (long long)stored);
+
+	/*不出队复制, 再整条读出*/
+	memset(out, 0, sizeof(out));
+	CHECK(RB_CopyItem(&buf, 0, out, sizeof(out)) == len);
+	CHECK(memcmp(out, rec, len) == 0);
+	memset(out, 0, sizeof(out));
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == len);
+	CHECK(memcmp(out, rec, len) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 0);
+
+	/*短于阈值的记录和不可压缩的记录按原样保存*/
+	CHECK(RB_write(&buf, rec, 20) == 20);
+	CHECK(!(buf.pitems[1].flags & RB_Item_Packed));
+	for (n = 0; n < 100; n++) rec[n] = (char)(n * 73 + 11);
+	CHECK(RB_write(&buf, rec, 100) == 100);
+	CHECK(!(buf.pitems[2].flags & RB_Item_Packed));
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 20);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 100);
+	CHECK(memcmp(out, rec, 100) == 0);
+
+	/*压缩记录的流式读取, 读取缓冲比记录小; 只解压一次*/
+	CHECK(RB_SetCodec(&buf, &counting_codec, 32) == 1);
+	len = make_json(rec, 1000);
+	CHECK(RB_write(&buf, rec, len) == len);
+	unpack_calls = 0;
+	for (off = 0, last = 0; !last && off <= len; off += n)
+	{
+		n = RB_ReadChunk(&buf, off, part, sizeof(part), &last);
+		CHECK(n > 0);
+		CHECK(memcmp(part, &rec[off], n) == 0);
+	}
+	CHECK(off == len);
+	CHECK(unpack_calls == 1);
+	CHECK(RB_GetItemsCount(&buf) == 0);
+
+	/*下一条压缩记录重新解压*/
+	CHECK(RB_write(&buf, rec, len) == len);
+	CHECK(RB_ReadChunk(&buf, 0, part, sizeof(part), &last) == (int)sizeof(part) && !last);
+	CHECK(RB_ReadChunk(&buf, sizeof(part), part, sizeof(part), &last) == (int)sizeof(part));
+	CHECK(memcmp(part, &rec[sizeof(part)], sizeof(part)) == 0);
+	CHECK(unpack_calls == 2);
+	CHECK(RB_DropItem(&buf) > 0);
+	CHECK(RB_write(&buf, rec, len) == len);
+	CHECK(RB_ReadChunk(&buf, 0, part, sizeof(part), &last) == (int)sizeof(part));
+	CHECK(unpack_calls == 3);
+	CHECK(RB_DropItem(&buf) > 0);
+
+	/*读取缓冲不够时截断*/
+	CHECK(RB_write(&buf, rec, len) == len);
+	CHECK(RB_ReadItem(&buf, out, 50) == 50);
+	CHECK(memcmp(out, rec, 50) == 0);
+
+	/*关闭压缩后释放临时空间*/
+	CHECK(RB_SetCodec(&buf, NULL, 0) == 1);
+	CHECK(buf.codec_swap == NULL);
+	CHECK(RB_write(&buf, rec, len) == len);
+	CHECK(!(buf.pitems[buf.item_read_index & buf.item_mask].flags & RB_Item_Packed));
+
+	/*默认ring: 比ring长的记录不压缩*/
+	RB_init(&buf);
+	CHECK(RB_SetCodec(&buf, &RB_LZCodec, 32) == 1);
+	CHECK(buf.codec_max == RB_BUFFER_SIZE);
+	len = make_json(rec, 100);
+	CHECK(RB_write(&buf, rec, len) == len);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == len);
+	CHECK(memcmp(out, rec, len) == 0);
+
+	/*压缩后会跨圈的记录按原样保存, 读取方总能直接从ring解压*/
+	while ((buf.write_index & buf.mask) < 110)
+	{
+		CHECK(RB_write(&buf, rec, 20) == 20);
+		CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 20);
+	}
+	CHECK(RB_write(&buf, rec, len) == len);
+	CHECK(!(buf.pitems[buf.item_read_index & buf.item_mask].flags & RB_Item_Packed));
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == len);
+	CHECK(memcmp(out, rec, len) == 0);
+
+	/*再次初始化/RB_Destroy释放临时空间*/
+	CHECK(RB_InitEx(&buf, mem, sizeof(mem)) == 1);
+	CHECK(buf.codec_swap == NULL && buf.codec == NULL);
+	CHECK(RB_SetCodec(&buf, &RB_LZCodec, 32) == 1);
+	RB_Destroy(&buf);
+	CHECK(buf.codec_swap == NULL && buf.codec == NULL);
+}
+
+static struct RB_Buffer codec_buf;
+static char codec_rec[1000];
+
+/*和主线程同时复制同一条压缩记录*/
+static void * codec_reader(void * arg)
+{
+	char out[sizeof(codec_rec)];
+	int i, * ok = (int *)arg;
+
+	for (i = 0; i < 2000; i++)
+		if (RB_CopyItem(&codec_buf, 0, out, sizeof(out)) != (int)sizeof(out) || memcmp(out, codec_rec, sizeof(out)) != 0) *ok = 0;
+	return NULL;
+}
+
+static void test_codec_readers(void)
+{
+	struct RB_Buffer_Block items[16];
+	static char big[1024];
+	char out[sizeof(codec_rec)];
+	pthread_t th;
+	int i, ok = 1, len = make_json(codec_rec, sizeof(codec_rec));
+
+	/*多个读取方同时解压: 不共用临时空间*/
+	CHECK(RB_InitEx(&codec_buf, mem, 4096) == 1);
+	CHECK(RB_SetCodec(&codec_buf, &RB_LZCodec, 32) == 1);
+	CHECK(RB_write(&codec_buf, codec_rec, len) == len);
+	CHECK(codec_buf.pitems[0].flags & RB_Item_Packed);
+	CHECK(pthread_create(&th, NULL, codec_reader, &ok) == 0);
+	codec_reader(&ok);
+	pthread_join(th, NULL);
+	CHECK(ok);
+	CHECK(RB_ReadItem(&codec_buf, out, sizeof(out)) == len);
+
+	/*迁移到更小的ring之后跨圈的压缩记录也能读出*/
+	while (codec_buf.write_index < 1000)
+	{
+		i = (codec_buf.write_index + 20 <= 1000) ? 20 : (int)(1000 - codec_buf.write_index);
+		CHECK(RB_write(&codec_buf, codec_rec, i) == i);
+		CHECK(RB_ReadItem(&codec_buf, out, sizeof(out)) == i);
+	}
+	CHECK(RB_write(&codec_buf, codec_rec, len) == len);
+	i = (int)(codec_buf.item_read_index & 15);
+	CHECK(RB_Move(&codec_buf, big, sizeof(big), items, 16) == 1);
+	CHECK(codec_buf.pitems[i].flags & RB_Item_Packed);
+	CHECK((long long)(codec_buf.read_index & codec_buf.mask) + codec_buf.pitems[i].length > codec_buf.size);
+	memset(out, 0, sizeof(out));
+	CHECK(RB_CopyItem(&codec_buf, i, out, sizeof(out)) == len);
+	CHECK(memcmp(out, codec_rec, len) == 0);
+	memset(out, 0, sizeof(out));
+	CHECK(RB_ReadItem(&codec_buf, out, sizeof(out)) == len);
+	CHECK(memcmp(out, codec_rec, len) == 0);
+	RB_Destroy(&codec_buf);
+}
+
+static void test_coalesce(void)
+{
+	struct RB_Buffer buf;
+	char out[64];
+	int i;
+
+	CHECK(RB_InitEx(&buf, mem, 1024) == 1);
+	RB_SetCoalesce(&buf, 16, 5);
+
+	/*小记录先攒在未发布的帧里*/
+	CHECK(RB_write(&buf, "ab", 2) == 2);
+	CHECK(RB_write(&buf, "cde", 3) == 3);
+	CHECK(RB_write(&buf, "", 0) == 0);	//空记录不进帧
+	CHECK(RB_write(&buf, "x", -1) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 0);
+	RB_FlushFrame(&buf);
+	CHECK(buf.pitems[buf.item_read_index & buf.item_mask].length == 2 + 1 + 3 + 1);
+	CHECK(RB_GetItemsCount(&buf) == 1);
+	CHECK(buf.pitems[0].flags & RB_Item_Frame);
+
+	/*一帧中的记录逐条取出*/
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 2 && memcmp(out, "ab", 2) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 1);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 3 && memcmp(out, "cde", 3) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 0);
+	CHECK(RB_USED(&buf) == 0);
+
+	/*帧满自动发布*/
+	for (i = 0; i < 5; i++) CHECK(RB_write(&buf, "xy", 2) == 2);
+	CHECK(RB_GetItemsCount(&buf) == 1);	//5*3=15字节, 放不下第6条
+	CHECK(buf.frame_open == 0);
+
+	/*大记录先发布未满的帧, 顺序不变*/
+	CHECK(RB_write(&buf, "s", 1) == 1);
+	CHECK(RB_write(&buf, "a record longer than a frame", 28) == 28);
+	CHECK(RB_GetItemsCount(&buf) == 3);
+	CHECK(!(buf.pitems[(buf.item_write_index - 1) & buf.item_mask].flags & RB_Item_Frame));
+	for (i = 0; i < 5; i++) CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 2);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 1 && out[0] == 's');
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 28);
+
+	/*超时发布: 第一次RB_PollFrame只记下时间*/
+	CHECK(RB_write(&buf, "t", 1) == 1);
+	RB_PollFrame(&buf, 100);
+	RB_PollFrame(&buf, 104);
+	CHECK(RB_GetItemsCount(&buf) == 0);
+	RB_PollFrame(&buf, 105);
+	CHECK(RB_GetItemsCount(&buf) == 1);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 1 && out[0] == 't');
+
+	/*关闭合并时发布当前帧*/
+	CHECK(RB_write(&buf, "u", 1) == 1);
+	RB_SetCoalesce(&buf, 0, 0);
+	CHECK(RB_GetItemsCount(&buf) == 1);
+	CHECK(RB_write(&buf, "v", 1) == 1);
+	CHECK(RB_GetItemsCount(&buf) == 2);
+}
+
+static void test_chunks(void)
+{
+	struct RB_Buffer buf;
+	char rec[1000], got[1000], part[40];
+	int woff, roff, n, last, done;
+
+	/*比ring(128字节)大得多的记录, 分片写入, 边写边读*/
+	RB_init(&buf);
+	make_json(rec, sizeof(rec));
+	for (woff = 0, roff = 0, done = 0; !done; )
+	{
+		if (woff < (int)sizeof(rec))
+		{
+			n = sizeof(rec) - woff;
+			if (n > 48) n = 48;
+			if (RB_WriteChunk(&buf, &rec[woff], n, woff + n < (int)sizeof(rec)) == n)
+			{
+				woff += n;
+				continue;
+			}
+		}
+		n = RB_ReadChunk(&buf, roff, part, sizeof(part), &last);
+		CHECK(n > 0);
+		if (n <= 0) break;
+		memcpy(&got[roff], part, n);
+		roff += n;
+		done = last;
+	}
+	CHECK(woff == (int)sizeof(rec) && roff == (int)sizeof(rec));
+	CHECK(memcmp(got, rec, sizeof(rec)) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 0);
+	CHECK(buf.chunk_base == 0);
+
+	/*下一条普通记录从0开始读*/
+	CHECK(RB_write(&buf, "plain", 5) == 5);
+	CHECK(RB_ReadChunk(&buf, 0, part, 3, &last) == 3 && !last);
+	CHECK(RB_ReadChunk(&buf, 3, part, 3, &last) == 2 && last);
+	CHECK(memcmp(part, "in", 2) == 0);
+
+	/*offset越界或队列空*/
+	CHECK(RB_write(&buf, "abc", 3) == 3);
+	CHECK(RB_ReadChunk(&buf, 4, part, sizeof(part), &last) == 0 && !last);
+	CHECK(RB_ReadChunk(&buf, 0, part, sizeof(part), &last) == 3 && last);
+	CHECK(RB_ReadChunk(&buf, 0, part, sizeof(part), &last) == 0 && !last);
+
+	/*分片记录的offset是整条记录内的位置*/
+	CHECK(RB_WriteChunk(&buf, "head", 4, 1) == 4);
+	CHECK(RB_WriteChunk(&buf, "tail", 4, 0) == 4);
+	CHECK(RB_GetItemsCount(&buf) == 2);
+	CHECK(RB_ReadChunk(&buf, 0, part, sizeof(part), &last) == 4 && !last);
+	CHECK(buf.chunk_base == 4);
+	CHECK(RB_ReadChunk(&buf, 4, part, sizeof(part), &last) == 4 && last);
+	CHECK(memcmp(part, "tail", 4) == 0);
+
+	/*分片被RB_ReadItem/RB_DropItem取走后, 下一条记录从0开始读*/
+	CHECK(RB_WriteChunk(&buf, "one", 3, 1) == 3);
+	CHECK(RB_WriteChunk(&buf, "two", 3, 1) == 3);
+	CHECK(RB_WriteChunk(&buf, "end", 3, 0) == 3);
+	CHECK(RB_ReadChunk(&buf, 0, part, sizeof(part), &last) == 3 && buf.chunk_base == 3);
+	CHECK(RB_ReadItem(&buf, part, sizeof(part)) == 3 && buf.chunk_base == 0);
+	CHECK(RB_DropItem(&buf) == 3);
+	CHECK(RB_WriteChunk(&buf, "a", 1, 1) == 1);
+	CHECK(RB_WriteChunk(&buf, "b", 1, 0) == 1);
+	CHECK(RB_ReadChunk(&buf, 0, part, sizeof(part), &last) == 1 && buf.chunk_base == 1);
+	CHECK(RB_DropItem(&buf) == 1 && buf.chunk_base == 0);
+	CHECK(RB_write(&buf, "xyz", 3) == 3);
+	CHECK(RB_ReadChunk(&buf, 0, part, sizeof(part), &last) == 3 && last);
+
+	/*分片太大或记录表满时不写入*/
+	CHECK(RB_WriteChunk(&buf, rec, RB_BUFFER_SIZE + 1, 1) == 0);
+	for (n = 0; n < RB_Max_Items; n++) CHECK(RB_WriteChunk(&buf, "x", 1, 1) == 1);
+	CHECK(RB_WriteChunk(&buf, "x", 1, 0) == 0);
+}
+
+static void test_cursors(void)
+{
+	struct RB_Buffer buf;
+	char out[64];
+	int i;
+
+	/*游标过了2^32, 再过2^64回绕: 已用空间和记录数照样是差值*/
+	for (i = 0; i < 2; i++)
+	{
+		RB_init(&buf);
+		buf.read_index = buf.write_index = i ? ~0ULL - 50 : (1ULL << 32) - 50;
+		buf.item_read_index = buf.item_write_index = i ? ~0ULL - 1 : (1ULL << 32) - 1;
+
+		CHECK(RB_write(&buf, "0123456789012345678901234567890123456789", 40) == 40);
+		CHECK(RB_write(&buf, "abcdefghijklmnopqrstuvwxyzabcdefghijklmn", 40) == 40);
+		CHECK(RB_USED(&buf) == 80);
+		CHECK(RB_GetFreeSize(&buf) == RB_BUFFER_SIZE - 80);
+		CHECK(RB_GetItemsCount(&buf) == 2);
+		CHECK(RB_write(&buf, "0123456789012345678901234567890123456789", 40) == 40);
+		CHECK(RB_write(&buf, "x", 9) == 0);		//满
+		CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 40);
+		CHECK(memcmp(out, "0123456789012345678901234567890123456789", 40) == 0);
+		CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 40);
+		CHECK(memcmp(out, "abcdefghijklmnopqrstuvwxyzabcdefghijklmn", 40) == 0);
+		CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 40);
+		CHECK(RB_GetItemsCount(&buf) == 0 && RB_USED(&buf) == 0);
+		if (i) CHECK(buf.write_index < 100 && buf.item_write_index == 1);
+	}
+}
+
+static struct RB_Buffer shared;
+static volatile int churning;
+
+/*生产者兼消费者: 每条记录的每个字节都是它的长度*/
+static void * churn(void * arg)
+{
+	char rec[100], out[100];
+	int i, len;
+
+	(void)arg;
+	for (i = 0; churning; i++)
+	{
+		len = 1 + i % 60;
+		memset(rec, len, len);
+		while (RB_write(&shared, rec, len) == 0) RB_ReadItem(&shared, out, sizeof(out));
+	}
+	return NULL;
+}
+
+/*只取不写: 和churn_writer各在一个线程, 两方都会改序号*/
+static void * churn_reader(void * arg)
+{
+	char out[100];
+
+	(void)arg;
+	while (churning) RB_ReadItem(&shared, out, sizeof(out));
+	return NULL;
+}
+
+static void * churn_writer(void * arg)
+{
+	char rec[100];
+	int i, len;
+
+	(void)arg;
+	for (i = 0; churning; i++)
+	{
+		len = 1 + i % 60;
+		memset(rec, len, len);
+		while (churning && RB_write(&shared, rec, len) == 0) sched_yield();
+	}
+	return NULL;
+}
+
+static void test_snapshot(void)
+{
+	struct RB_Buffer buf;
+	struct RB_Buffer_Block items[16];
+	struct RB_Snap snap;
+	char data[RB_BUFFER_SIZE], out[64];
+	pthread_t th, th2;
+	int i, k, n, ok, rounds;
+
+	snap.data = data;
+	snap.data_cap = sizeof(data);
+	snap.items = items;
+	snap.item_cap = 16;
+
+	/*绕回的数据展开成连续的一段, 原ring不变*/
+	RB_init(&buf);
+	CHECK(RB_Snapshot(&buf, &snap) == 0 && snap.used == 0);
+	for (i = 0; i < 3; i++) CHECK(RB_write(&buf, "0123456789012345678901234567890123456789", 40) == 40);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 40);
+	CHECK(RB_write(&buf, "abcdefghijklmnopqrstuvwxyzabcdefghijklmn", 40) == 40);
+	CHECK(RB_Snapshot(&buf, &snap) == 3);
+	CHECK(snap.used == 120 && snap.count == 3);
+	CHECK(snap.read_index == buf.read_index && snap.write_index == buf.write_index);
+	CHECK(memcmp(&data[items[2].read_index - snap.read_index], "abcdefghijklmnopqrstuvwxyzabcdefghijklmn", 40) == 0);
+	CHECK(memcmp(&data[items[0].read_index - snap.read_index], "0123456789012345678901234567890123456789", 40) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 3 && RB_USED(&buf) == 120);
+
+	/*空间不够: -1, used/count为所需大小*/
+	snap.item_cap = 2;
+	CHECK(RB_Snapshot(&buf, &snap) == -1);
+	CHECK(snap.count == 3 && snap.used == 120);
+	snap.item_cap = 16;
+	snap.data_cap = 100;
+	CHECK(RB_Snapshot(&buf, &snap) == -1);
+	snap.data_cap = sizeof(data);
+
+	/*一直有人在改(低位不为0): 重试用完返回-2*/
+	buf.seq++;
+	CHECK(RB_Snapshot(&buf, &snap) == -2);
+	buf.seq--;
+	CHECK(RB_Snapshot(&buf, &snap) == 3);
+
+	/*未发布的合并帧不在快照中*/
+	RB_init(&buf);
+	RB_SetCoalesce(&buf, 32, 1000);
+	CHECK(RB_write(&buf, "ab", 2) == 2);
+	CHECK(RB_Snapshot(&buf, &snap) == 0 && snap.count == 0);
+	RB_FlushFrame(&buf);
+	CHECK(RB_Snapshot(&buf, &snap) == 1 && (items[0].flags & RB_Item_Frame));
+
+	/*另一个线程不停读写: 每份快照里的记录都完整*/
+	RB_init(&shared);
+	churning = 1;
+	CHECK(pthread_create(&th, NULL, churn, NULL) == 0);
+	for (rounds = 0, ok = 1; rounds < 20000 && ok; rounds++)
+	{
+		n = RB_Snapshot(&shared, &snap);
+		if (n == -2) continue;
+		CHECK(n >= 0 && n <= RB_Max_Items);
+		for (k = 0; k < n; k++)
+		{
+			char * p = &data[items[k].read_index - snap.read_index];
+			for (i = 0; i < items[k].length; i++)
+				if (p[i] != items[k].length) ok = 0;
+		}
+	}
+	churning = 0;
+	pthread_join(th, NULL);
+	CHECK(ok);
+
+	/*写入方和取出方各一个线程: 快照仍完整, 停下后没有残留的修改计数*/
+	RB_init(&shared);
+	churning = 1;
+	CHECK(pthread_create(&th, NULL, churn_writer, NULL) == 0);
+	CHECK(pthread_create(&th2, NULL, churn_reader, NULL) == 0);
+	for (rounds = 0, ok = 1; rounds < 20000 && ok; rounds++)
+	{
+		n = RB_Snapshot(&shared, &snap);
+		if (n == -2) continue;
+		for (k = 0; k < n; k++)
+		{
+			char * p = &data[items[k].read_index - snap.read_index];
+			for (i = 0; i < items[k].length; i++)
+				if (p[i] != items[k].length) ok = 0;
+		}
+		if (rounds % 64 == 0) sched_yield();
+	}
+	churning = 0;
+	pthread_join(th, NULL);
+	pthread_join(th2, NULL);
+	CHECK(ok);
+	CHECK((shared.seq & 0xffff) == 0 && shared.seq != 0);
+}
+
+static void test_peek(void)
+{
+	struct RB_Buffer buf;
+	struct RB_View v;
+	struct RB_Iter it;
+	char out[64], joined[64];
+	int n;
+
+	/*第n条记录原地查看, 不出队*/
+	RB_init(&buf);
+	CHECK(RB_PeekItem(&buf, 0, &v) == 0);
+	CHECK(RB_write(&buf, "0123456789012345678901234567890123456789", 40) == 40);
+	CHECK(RB_write(&buf, "abcdefghijklmnopqrstuvwxyzabcdefghijklmn", 40) == 40);
+	CHECK(RB_PeekItem(&buf, 1, &v) == 40);
+	CHECK(v.data == &buf.pdata[40] && v.wrap == NULL && v.flags == RB_Item_Raw);
+	CHECK(memcmp(v.data, "abcdefghij", 10) == 0);
+	CHECK(RB_PeekItem(&buf, 2, &v) == 0);
+	CHECK(RB_PeekItem(&buf, -1, &v) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 2);
+
+	/*跨圈的记录分两段*/
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 40);
+	CHECK(RB_write(&buf, "ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJKLMN", 40) == 40);
+	CHECK(RB_write(&buf, "+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-", 40) == 40);
+	CHECK(RB_PeekItem(&buf, 2, &v) == 40);
+	CHECK(v.length == 8 && v.wrap == buf.pdata && v.wrap_length == 32);
+	memcpy(joined, v.data, v.length);
+	memcpy(&joined[v.length], v.wrap, v.wrap_length);
+	CHECK(memcmp(joined, "+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-", 40) == 0);
+
+	/*遍历全部, 不移动游标*/
+	for (RB_IterBegin(&buf, &it), n = 0; RB_IterNext(&buf, &it, &v) == 40; n++) ;
+	CHECK(n == 3);
+	CHECK(RB_IterNext(&buf, &it, &v) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 3);
+
+	/*遍历中途有记录出队: 从新的队首继续; 新写入的记录也会遍历到*/
+	RB_IterBegin(&buf, &it);
+	CHECK(RB_IterNext(&buf, &it, &v) == 40 && v.data[0] == 'a');
+	CHECK(RB_DropItem(&buf) == 40);
+	CHECK(RB_DropItem(&buf) == 40);
+	CHECK(RB_IterNext(&buf, &it, &v) == 40 && v.data[0] == '+');
+	CHECK(RB_write(&buf, "tail", 4) == 4);
+	CHECK(RB_IterNext(&buf, &it, &v) == 4 && memcmp(v.data, "tail", 4) == 0);
+	CHECK(RB_IterNext(&buf, &it, &v) == 0);
+
+	/*压缩记录和合并帧按保存的样子查看*/
+	RB_init(&buf);
+	RB_SetCoalesce(&buf, 16, 1000);
+	CHECK(RB_write(&buf, "ab", 2) == 2);
+	CHECK(RB_write(&buf, "c", 1) == 1);
+	CHECK(RB_PeekItem(&buf, 0, &v) == 0);	//未发布
+	RB_FlushFrame(&buf);
+	CHECK(RB_PeekItem(&buf, 0, &v) == 5);
+	CHECK(v.flags & RB_Item_Frame);
+	CHECK(memcmp(v.data, "\2ab\1c", 5) == 0);
+
+	CHECK(RB_InitEx(&buf, mem, 4096) == 1);
+	CHECK(RB_SetCodec(&buf, &RB_LZCodec, 32) == 1);
+	n = make_json(joined, sizeof(joined));
+	CHECK(RB_write(&buf, joined, n) == n);
+	CHECK(RB_PeekItem(&buf, 0, &v) > 0);
+	CHECK((v.flags & RB_Item_Packed) && v.length < n);
+	RB_SetCodec(&buf, NULL, 0);
+}
+
+static void test_requeue(void)
+{
+	struct RB_Buffer buf;
+	char a[40], b[40], c[40], out[64];
+	int last;
+
+	memset(a, 'a', sizeof(a));
+	memset(b, 'b', sizeof(b));
+	memset(c, 'c', sizeof(c));
+
+	RB_init(&buf);
+	CHECK(RB_Requeue(&buf) == 0);
+
+	/*空闲空间比记录短: 搬动时源和目标重叠*/
+	CHECK(RB_write(&buf, a, 40) == 40);
+	CHECK(RB_write(&buf, b, 40) == 40);
+	CHECK(RB_write(&buf, c, 40) == 40);
+	CHECK(RB_Requeue(&buf) == 40);
+	CHECK(buf.item_read_index == 1 && buf.item_write_index == 4);
+	CHECK(buf.read_index == 40 && buf.write_index == 160);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 40 && memcmp(out, b, 40) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 40 && memcmp(out, c, 40) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 40 && memcmp(out, a, 40) == 0);
+	CHECK(RB_GetItemsCount(&buf) == 0);
+
+	/*ring全满, 记录表全满: 原地转一圈*/
+	RB_init(&buf);
+	CHECK(RB_write(&buf, a, 32) == 32);
+	CHECK(RB_write(&buf, b, 32) == 32);
+	CHECK(RB_write(&buf, c, 32) == 32);
+	CHECK(RB_write(&buf, a, 32) == 32);
+	CHECK(RB_GetFreeSize(&buf) == 0 && RB_GetItemsCount(&buf) == RB_Max_Items);
+	CHECK(RB_Requeue(&buf) == 32);
+	CHECK(RB_GetFreeSize(&buf) == 0 && RB_GetItemsCount(&buf) == RB_Max_Items);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 32 && memcmp(out, b, 32) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 32 && memcmp(out, c, 32) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 32 && memcmp(out, a, 32) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 32 && memcmp(out, a, 32) == 0);
+
+	/*分片记录和读了一半的记录不移动*/
+	RB_init(&buf);
+	CHECK(RB_WriteChunk(&buf, a, 10, 1) == 10);
+	CHECK(RB_WriteChunk(&buf, b, 10, 0) == 10);
+	CHECK(RB_Requeue(&buf) == 0);
+	CHECK(RB_ReadChunk(&buf, 0, out, sizeof(out), &last) == 10 && last == 0);
+	CHECK(RB_Requeue(&buf) == 0);
+	CHECK(RB_ReadChunk(&buf, 10, out, sizeof(out), &last) == 10 && last == 1);
+	CHECK(memcmp(out, b, 10) == 0);
+}
+
+static void test_move(void)
+{
+	struct RB_Buffer buf;
+	struct RB_Buffer_Block items[16];
+	struct RB_MoveMark mark;
+	static char big[256];
+	char out[64];
+	int i;
+
+	/*绕回之后迁移, 游标不变, 内容和顺序不变*/
+	CHECK(RB_InitEx(&buf, mem, 64) == 1);
+	for (i = 0; i < 4; i++) CHECK(RB_write(&buf, "0123456789", 10) == 10);
+	for (i = 0; i < 3; i++) CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10);
+	for (i = 0; i < 3; i++) CHECK(RB_write(&buf, "abcdefghij", 10) == 10);
+	CHECK(RB_Move(&buf, big, 32, items, 16) == 0);	//放不下: 不动
+	CHECK(buf.pdata == mem);
+	CHECK(RB_Move(&buf, big, sizeof(big), items, 16) == 1);
+	CHECK(buf.pdata == big && buf.size == sizeof(big));
+	CHECK(RB_GetItemsCount(&buf) == 4);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10 && memcmp(out, "0123456789", 10) == 0);
+	for (i = 0; i < 3; i++) CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10 && memcmp(out, "abcdefghij", 10) == 0);
+
+	/*分两步: 复制期间有读有写*/
+	CHECK(RB_InitEx(&buf, mem, 64) == 1);
+	for (i = 0; i < 4; i++) CHECK(RB_write(&buf, "0123456789", 10) == 10);
+	RB_MoveStart(&buf, &mark);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10);
+	CHECK(RB_write(&buf, "abcdefghij", 10) == 10);
+	RB_MoveCopy(&buf, big, sizeof(big), items, 16, &mark);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10);
+	CHECK(RB_write(&buf, "ABCDEFGHIJ", 10) == 10);
+	CHECK(RB_MoveFinish(&buf, big, sizeof(big), items, 16, &mark) == 1);
+	CHECK(buf.pdata == big && buf.pitems == items);
+	CHECK(RB_GetItemsCount(&buf) == 4);
+	for (i = 0; i < 2; i++) CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10 && memcmp(out, "0123456789", 10) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10 && memcmp(out, "abcdefghij", 10) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10 && memcmp(out, "ABCDEFGHIJ", 10) == 0);
+
+	/*复制之后读空: 只搬之后写入的*/
+	CHECK(RB_InitEx(&buf, mem, 64) == 1);
+	for (i = 0; i < 2; i++) CHECK(RB_write(&buf, "0123456789", 10) == 10);
+	RB_MoveStart(&buf, &mark);
+	RB_MoveCopy(&buf, big, sizeof(big), items, 16, &mark);
+	for (i = 0; i < 2; i++) CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10);
+	CHECK(RB_write(&buf, "abcdefghij", 10) == 10);
+	CHECK(RB_MoveFinish(&buf, big, sizeof(big), items, 16, &mark) == 1);
+	CHECK(RB_GetItemsCount(&buf) == 1);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10 && memcmp(out, "abcdefghij", 10) == 0);
+
+	/*未发布的帧也随之迁移*/
+	CHECK(RB_InitEx(&buf, mem, 64) == 1);
+	RB_SetCoalesce(&buf, 16, 1000);
+	CHECK(RB_write(&buf, "ab", 2) == 2);
+	RB_MoveStart(&buf, &mark);
+	RB_MoveCopy(&buf, big, sizeof(big), items, 16, &mark);
+	CHECK(RB_write(&buf, "cd", 2) == 2);
+	CHECK(RB_MoveFinish(&buf, big, sizeof(big), items, 16, &mark) == 1);
+	RB_FlushFrame(&buf);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 2 && memcmp(out, "ab", 2) == 0);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 2 && memcmp(out, "cd", 2) == 0);
+
+	/*RB_Resize: 变大, 再缩小到刚好放下, 放不下时失败*/
+	CHECK(RB_InitEx(&buf, mem, 64) == 1);
+	for (i = 0; i < 3; i++) CHECK(RB_write(&buf, "0123456789", 10) == 10);
+	CHECK(RB_Resize(&buf, 1024, 64) == 1);
+	CHECK(buf.size == 1024 && buf.item_mask == 63 && buf.owned == 3);
+	CHECK(RB_Resize(&buf, 16, 0) == 0);
+	CHECK(RB_Resize(&buf, 32, 0) == 1);
+	CHECK(buf.size == 32 && buf.item_mask == 63);
+	for (i = 0; i < 3; i++) CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 10 && memcmp(out, "0123456789", 10) == 0);
+	CHECK(RB_Resize(&buf, 64, 4) == 1);
+	CHECK(buf.size == 64 && buf.item_mask == 3);
+
+	/*再次初始化先释放RB_Resize分配的空间; RB_Destroy之后回到内置空间*/
+	CHECK(RB_InitEx(&buf, mem, 64) == 1);
+	CHECK(buf.owned == 0 && buf.pdata == mem && buf.pitems == buf.items);
+	CHECK(RB_Resize(&buf, 128, 8) == 1);
+	RB_Destroy(&buf);
+	CHECK(buf.owned == 0 && buf.pdata == buf.data && buf.pitems == buf.items);
+}
+
+int main(void)
+{
+	test_codec();
+	test_codec_readers();
+	test_coalesce();
+	test_chunks();
+	test_cursors();
+	test_snapshot();
+	test_peek();
+	test_requeue();
+	test_move();
+
+	return check_done("test_rb_buffer");
+}
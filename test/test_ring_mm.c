@@ -0,0 +1,1028 @@
+#include <string.h>
+
+#include "../src/ring_buffer.h"
+#include "check.h"
+
+#ifdef USING_THREADS
+#include <sched.h>
+#endif
+
+#define STORAGE	4096
+#define LARGE	100	/* bigger than RB_SLAB_MAX_SIZE: a block of its own */
+
+#ifdef USING_TIME
+rb_u64 rb_test_clock;	/* RB_NOW() for this build (test_clock.h) */
+#endif
+
+static struct ring_mm ring;
+static char storage[STORAGE];
+static char data[STORAGE];	/* source of writes */
+
+#define WIDE_SLABS	10	/* slabs of the smallest class that fill wide[] */
+static char wide[WIDE_SLABS * RB_SLAB_OBJECTS * RB_SLAB_MIN_SIZE];
+
+
+/**
+ * free_bytes - total length of the free blocks
+ */
+static rb_off free_bytes(const struct ring_mm * r)
+{
+	rb_off total = 0;
+	int i;
+
+	for (i = 0; i < MAX_ITEMS; i++) {
+		if (RB_BIT_TEST(r->manifest_map, i) && !RB_BIT_TEST(r->in_use_map, i)) {
+			total += r->length[i];
+		}
+	}
+	return total;
+}
+
+
+/**
+ * manifest_blocks - number of metablocks describing the buffer
+ */
+static int manifest_blocks(const struct ring_mm * r)
+{
+	int i, n = 0;
+
+	for (i = 0; i < MAX_ITEMS; i++) {
+		if (RB_BIT_TEST(r->manifest_map, i)) {
+			n++;
+		}
+	}
+	return n;
+}
+
+
+/**
+ * fill - write blocks of one length until the ring refuses, returns how many
+ */
+static int fill(struct ring_mm * r, rb_off * handle, int max, rb_off length)
+{
+	int n;
+
+	for (n = 0; n < max; n++) {
+		data[0] = (char)n;
+		if ((handle[n] = rb_write(r, data, length)) < 0) {
+			break;
+		}
+	}
+	return n;
+}
+
+
+static void test_metablock_pool(void)
+{
+	rb_off handle[MAX_ITEMS + 1];
+	char out[LARGE];
+	int n, i;
+
+	CHECK(rb_init_ex(&ring, storage, STORAGE) == 0);
+	CHECK(manifest_blocks(&ring) == 1);
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* Runs out of metablocks long before it runs out of space */
+	n = fill(&ring, handle, MAX_ITEMS + 1, LARGE);
+	CHECK(n >= MAX_ITEMS - 1 && n <= MAX_ITEMS);
+	CHECK(free_bytes(&ring) >= LARGE);
+	CHECK(rb_write(&ring, out, LARGE) == -1);
+
+	for (i = 0; i < n; i++) {
+		CHECK(rb_find_block(&ring, handle[i]) >= 0);
+		CHECK(rb_read(&ring, handle[i], out, LARGE) == LARGE);
+		CHECK(out[0] == (char)i);
+	}
+	CHECK(rb_find_block(&ring, handle[0] + 1) == -1);
+
+	/* Every other block: holes that cannot merge */
+	for (i = 0; i < n; i += 2) {
+		CHECK(rb_free(&ring, handle[i]) == 0);
+	}
+	CHECK(rb_free(&ring, handle[0]) == -1);
+	CHECK(rb_read(&ring, handle[0], out, LARGE) < 0);
+
+	/* The rest: everything folds back into one block */
+	for (i = 1; i < n; i += 2) {
+		CHECK(rb_free(&ring, handle[i]) == 0);
+	}
+	CHECK(manifest_blocks(&ring) == 1);
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* And the whole buffer can be had again */
+	CHECK(rb_write(&ring, data, STORAGE) >= 0);
+	CHECK(free_bytes(&ring) == 0);
+}
+
+
+static void test_alloc_commit(void)
+{
+	struct rb_span first, second;
+	char out[LARGE], * p;
+	rb_off a, b, c;
+
+	rb_init_ex(&ring, storage, STORAGE);
+	memset(data, 'p', STORAGE);
+
+	/* Aligned, filled in place, readable only once committed */
+	a = rb_write(&ring, data, LARGE + 1);
+	b = rb_alloc(&ring, LARGE, 64, &p);
+	CHECK(b >= 0 && (unsigned long)p % 64 == 0);
+	CHECK(p == ring.base + b);
+	CHECK(rb_read(&ring, b, out, LARGE) == -1);
+	CHECK(rb_view(&ring, b, &first, &second) == -1);
+	memcpy(p, "in place", 8);
+	CHECK(rb_commit(&ring, b, LARGE + 1) == -1);
+	CHECK(rb_commit(&ring, b, 8) == 0);
+	CHECK(rb_commit(&ring, b, 8) == -1);
+	CHECK(rb_read(&ring, b, out, LARGE) == 8);
+	CHECK(memcmp(out, "in place", 8) == 0);
+	CHECK(rb_free(&ring, b) == 0);
+	CHECK(rb_commit(&ring, b, 8) == -1);
+
+	/* Bad alignment or length */
+	CHECK(rb_alloc(&ring, LARGE, 48, &p) == -3);
+	CHECK(rb_alloc(&ring, 0, 8, &p) == -1);
+	CHECK(rb_alloc(&ring, STORAGE + 1, 8, &p) == -1);
+
+	/* Abandoned before the commit */
+	b = rb_alloc(&ring, LARGE, 0, &p);
+	CHECK(b >= 0);
+	CHECK(rb_free(&ring, b) == 0);
+	CHECK(rb_find_block(&ring, b) == -1);
+	CHECK(rb_free(&ring, a) == 0);
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* Never split over the end of the buffer, unlike rb_write */
+	a = rb_write(&ring, data, STORAGE - 50);
+	CHECK(rb_free(&ring, a) == 0);
+	c = rb_alloc(&ring, LARGE, 1, &p);
+	CHECK(c >= 0 && c + LARGE <= STORAGE);
+	CHECK(rb_commit(&ring, c, LARGE) == 0);
+	CHECK(rb_view(&ring, c, &first, &second) == LARGE);
+	CHECK(second.length == 0);
+	CHECK(rb_unview(&ring, c) == 0);
+	CHECK(rb_free(&ring, c) == 0);
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* Exactly LARGE bytes left: aligned room only if they happen to start aligned */
+	a = rb_write(&ring, data, STORAGE - LARGE);
+	b = (a + STORAGE - LARGE) % STORAGE;
+	c = rb_alloc(&ring, LARGE, 64, &p);
+	CHECK((c >= 0) == ((unsigned long)(ring.base + b) % 64 == 0));
+	if (c < 0) {
+		CHECK(rb_alloc(&ring, LARGE, 0, &p) == b);
+	}
+}
+
+
+static void test_views(void)
+{
+	struct rb_span first, second;
+	rb_off a, b, c;
+	int k;
+
+	rb_init_ex(&ring, storage, STORAGE);
+	for (k = 0; k < STORAGE; k++) {
+		data[k] = (char)(k * 7);
+	}
+
+	/* A block in one piece */
+	a = rb_write(&ring, data, 3000);
+	b = rb_write(&ring, data, 1000);
+	CHECK(a >= 0 && b >= 0);
+	CHECK(rb_view(&ring, a, &first, &second) == 3000);
+	CHECK(first.data == ring.base + a && first.length == 3000);
+	CHECK(second.length == 0);
+	CHECK(memcmp(first.data, data, 3000) == 0);
+	CHECK(rb_unview(&ring, a) == 0);
+
+	/* Not a block, or gone */
+	CHECK(rb_view(&ring, a + 1, &first, &second) == -1);
+	CHECK(rb_free(&ring, a) == 0);
+	CHECK(rb_view(&ring, a, &first, &second) == -1);
+
+	/* A block written across the end of the buffer is two spans */
+	c = rb_write(&ring, data, 2000);
+	CHECK(c == 4000);
+	CHECK(rb_view(&ring, c, &first, &second) == 2000);
+	CHECK(first.length == STORAGE - 4000 && second.length == 2000 - (STORAGE - 4000));
+	CHECK(second.data == ring.base);
+	CHECK(memcmp(first.data, data, first.length) == 0);
+	CHECK(memcmp(second.data, data + first.length, second.length) == 0);
+
+	/* The view keeps the block: rb_free leaves it in use until rb_unview */
+	CHECK(rb_free(&ring, c) == 0);
+	CHECK(rb_find_block(&ring, c) >= 0);
+	CHECK(rb_write(&ring, data, STORAGE - 1000) == -1);
+	CHECK(memcmp(second.data, data + first.length, second.length) == 0);
+	CHECK(rb_unview(&ring, c) == 0);
+	CHECK(rb_find_block(&ring, c) == -1);
+	CHECK(rb_unview(&ring, c) == -1);
+
+	CHECK(rb_free(&ring, b) == 0);
+	CHECK(free_bytes(&ring) == STORAGE);
+}
+
+
+static void test_references(void)
+{
+	char out[LARGE];
+	rb_off a;
+	int i;
+
+	rb_init_ex(&ring, storage, STORAGE);
+	memset(data, 'r', LARGE);
+
+	a = rb_write(&ring, data, LARGE);
+	CHECK(a >= 0);
+	i = rb_find_block(&ring, a);
+	CHECK(ring.refs[i] == 1);
+
+	/* Two more consumers */
+	CHECK(rb_retain(&ring, a) == 0);
+	CHECK(rb_retain(&ring, a) == 0);
+	CHECK(ring.refs[i] == 3);
+
+	/* The writer lets go; the data stays until the last consumer does */
+	CHECK(rb_free(&ring, a) == 0);
+	CHECK(rb_read(&ring, a, out, LARGE) == LARGE);
+	CHECK(memcmp(out, data, LARGE) == 0);
+	CHECK(rb_release(&ring, a) == 0);
+	CHECK(rb_find_block(&ring, a) == i);
+	CHECK(free_bytes(&ring) == STORAGE - LARGE);
+	CHECK(rb_release(&ring, a) == 0);
+	CHECK(rb_find_block(&ring, a) == -1);
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* Nothing left to take or drop */
+	CHECK(rb_retain(&ring, a) == -1);
+	CHECK(rb_release(&ring, a) == -1);
+}
+
+
+static void test_slabs(void)
+{
+	struct rb_span first, second;
+	char out[LARGE];
+	rb_off h[8], a, b;
+	int k;
+
+	rb_init_ex(&ring, storage, STORAGE);
+	memcpy(data, "small data", 10);
+
+	/* Small writes share a slab: no metablock of their own */
+	a = rb_write(&ring, data, 10);
+	b = rb_write(&ring, data, 10);
+	CHECK(a >= 0 && b == a + 16);
+	CHECK(rb_find_block(&ring, a) == -1);
+	CHECK(manifest_blocks(&ring) == 2);
+	CHECK(rb_read(&ring, b, out, LARGE) == 10);
+
+	/* Retained like any block */
+	CHECK(rb_retain(&ring, a) == 0);
+	CHECK(rb_free(&ring, a) == 0);
+	CHECK(rb_read(&ring, a, out, LARGE) == 10);
+	CHECK(memcmp(out, "small data", 10) == 0);
+	CHECK(rb_release(&ring, a) == 0);
+	CHECK(rb_read(&ring, a, out, LARGE) == -1);
+	CHECK(rb_release(&ring, a) == -1);
+
+	/* Viewed in one span, kept until rb_unview */
+	CHECK(rb_view(&ring, b, &first, &second) == 10);
+	CHECK(first.data == ring.base + b && first.length == 10 && second.length == 0);
+	CHECK(rb_free(&ring, b) == 0);
+	CHECK(rb_read(&ring, b, out, LARGE) == 10);
+	CHECK(rb_write(&ring, data, 10) == a);	/* the free object, not the viewed one */
+	CHECK(memcmp(first.data, "small data", 10) == 0);
+	CHECK(rb_unview(&ring, b) == 0);
+	CHECK(rb_view(&ring, b, &first, &second) == -1);
+	CHECK(rb_unview(&ring, b) == -1);
+	CHECK(rb_free(&ring, a) == 0);
+
+	/* The slab kept for reuse gives way to a write that needs its room */
+	rb_init_ex(&ring, storage, STORAGE);
+	for (k = 0; k < 8; k++) {
+		h[k] = rb_write(&ring, data, 8);
+		CHECK(h[k] >= 0);
+	}
+	for (k = 0; k < 8; k++) {
+		CHECK(rb_free(&ring, h[k]) == 0);
+	}
+	CHECK(free_bytes(&ring) == STORAGE - RB_SLAB_OBJECTS * RB_SLAB_MIN_SIZE);
+	a = rb_write(&ring, data, 4000);
+	CHECK(a >= 0);
+	CHECK(rb_free(&ring, a) == 0);
+	CHECK(free_bytes(&ring) == STORAGE);
+	CHECK(manifest_blocks(&ring) == 1);
+
+	/* ... and a small write after that carves a new slab */
+	a = rb_write(&ring, data, 8);
+	CHECK(a >= 0 && rb_find_block(&ring, a) == -1);
+	CHECK(rb_free(&ring, a) == 0);
+
+	/* A slab that is not empty stays */
+	a = rb_write(&ring, data, 8);
+	CHECK(rb_write(&ring, data, 4000) == -1);
+	CHECK(rb_read(&ring, a, out, LARGE) == 8);
+
+	/* More slabs than the old fixed table of 8, each object found again */
+	rb_init_ex(&ring, wide, sizeof(wide));
+	for (k = 0; k < WIDE_SLABS * RB_SLAB_OBJECTS; k++) {
+		data[0] = (char)k;
+		CHECK(rb_write(&ring, data, 8) == (rb_off)k * RB_SLAB_MIN_SIZE);
+	}
+	CHECK(manifest_blocks(&ring) == WIDE_SLABS);
+	for (k = 0; k < WIDE_SLABS * RB_SLAB_OBJECTS; k++) {
+		CHECK(rb_read(&ring, (rb_off)k * RB_SLAB_MIN_SIZE, out, LARGE) == 8 && out[0] == (char)k);
+		CHECK(rb_free(&ring, (rb_off)k * RB_SLAB_MIN_SIZE) == 0);
+	}
+}
+
+
+static void test_free_many(void)
+{
+	char out[LARGE];
+	rb_off h[MAX_ITEMS + 2];
+	int status[MAX_ITEMS + 2];
+	int n, k;
+
+	rb_init_ex(&ring, storage, STORAGE);
+
+	/* Every other block, then the rest: holes merge in one pass */
+	n = fill(&ring, h, 12, LARGE);
+	CHECK(n == 12);
+	for (k = 0; k < 6; k++) {
+		h[k] = h[2 * k + 1];
+	}
+	CHECK(rb_free_many(&ring, h, 6, status) == 6);
+	for (k = 0; k < 6; k++) {
+		CHECK(status[k] == 0);
+		CHECK(rb_find_block(&ring, h[k]) == -1);
+	}
+	CHECK(ring.fifo_ok == 0);
+	CHECK(free_bytes(&ring) == STORAGE - 6 * LARGE);
+
+	/* Bad handles and duplicates fail alone; a retained block and a slab object go with the rest */
+	rb_init_ex(&ring, storage, STORAGE);
+	n = fill(&ring, h, 6, LARGE);
+	CHECK(rb_retain(&ring, h[2]) == 0);
+	h[6] = rb_write(&ring, data, 8);
+	h[7] = h[0] + 1;
+	h[8] = h[4];
+	CHECK(rb_free_many(&ring, h, 9, status) == 7);
+	CHECK(status[6] == 0 && status[7] == -1 && status[8] == -1);
+	CHECK(rb_read(&ring, h[2], out, LARGE) == LARGE && out[0] == 2);
+	CHECK(rb_read(&ring, h[6], out, LARGE) == -1);
+	CHECK(manifest_blocks(&ring) == 4);	/* free, h[2], free, slab */
+	CHECK(rb_free_many(&ring, &h[2], 1, NULL) == 1);
+	CHECK(free_bytes(&ring) == STORAGE - RB_SLAB_OBJECTS * RB_SLAB_MIN_SIZE);
+
+	/* In writing order: stays on the FIFO path */
+	rb_init_ex(&ring, storage, STORAGE);
+	n = fill(&ring, h, 10, LARGE);
+	CHECK(rb_free_many(&ring, h, n, NULL) == n);
+	CHECK(ring.fifo_ok == 1);
+	CHECK(manifest_blocks(&ring) == 1);
+	CHECK(rb_free_many(&ring, h, 0, NULL) == 0);
+}
+
+
+static void test_fifo(void)
+{
+	char out[1000];
+	rb_off h[MAX_ITEMS], k;
+	int n, i;
+
+	rb_init_ex(&ring, storage, STORAGE);
+	CHECK(ring.fifo_ok == 1);
+
+	/* Freed in the order written: one free block throughout, blocks back to back */
+	for (n = 0; n < 100; n++) {
+		data[0] = (char)n;
+		h[n % 3] = rb_write(&ring, data, 1000);
+		CHECK(h[n % 3] == (n * 1000L) % STORAGE);
+		CHECK(ring.fifo_ok == 1);
+		CHECK(manifest_blocks(&ring) == (n < 2 ? n + 2 : 4));
+		if (n >= 2) {
+			CHECK(rb_read(&ring, h[(n - 2) % 3], out, 1000) == 1000);
+			CHECK(out[0] == (char)(n - 2));
+			CHECK(rb_free(&ring, h[(n - 2) % 3]) == 0);
+			CHECK(ring.fifo_ok == 1);
+		}
+	}
+	for (i = 98; i < 100; i++) {
+		CHECK(rb_free(&ring, h[i % 3]) == 0);
+	}
+	CHECK(ring.fifo_ok == 1);
+	CHECK(manifest_blocks(&ring) == 1);
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* Exact fit fills the buffer; freeing it makes it the free block again */
+	h[0] = rb_write(&ring, data, STORAGE);
+	CHECK(h[0] >= 0 && ring.fifo_free == -1);
+	CHECK(rb_free(&ring, h[0]) == 0);
+	CHECK(ring.fifo_ok == 1 && free_bytes(&ring) == STORAGE);
+
+	/* Out of order: a hole turns the fast path off until the holes close */
+	rb_init_ex(&ring, storage, STORAGE);
+	for (n = 0; n < 4; n++) {
+		h[n] = rb_write(&ring, data, LARGE);
+	}
+	CHECK(rb_free(&ring, h[2]) == 0);
+	CHECK(ring.fifo_ok == 0);
+	CHECK(rb_free(&ring, h[0]) == 0);
+	CHECK(ring.fifo_ok == 0);
+
+	/* The general path still serves writes meanwhile */
+	k = rb_write(&ring, data, LARGE);
+	CHECK(k >= 0 && rb_read(&ring, k, out, LARGE) == LARGE);
+	CHECK(rb_free(&ring, h[1]) == 0);
+	CHECK(rb_free(&ring, k) == 0);
+	CHECK(rb_free(&ring, h[3]) == 0);
+	CHECK(ring.fifo_ok == 1);
+	CHECK(rb_write(&ring, data, LARGE) == 4 * LARGE);	/* fast path again: cut from the one free block */
+	CHECK(manifest_blocks(&ring) == 2);
+}
+
+
+static void test_magazines(void)
+{
+	struct rb_magazine mine, other;
+	char out[LARGE];
+	rb_off a, b, c, h[MAX_ITEMS];
+	int n, i;
+
+	rb_init_ex(&ring, storage, STORAGE);
+	rb_magazine_init(&mine);
+	rb_magazine_init(&other);
+	memset(data, 'm', LARGE);
+
+	/* A small write gets a block of its class size */
+	a = rb_write_cached(&ring, &mine, data, 10);
+	CHECK(a >= 0);
+	CHECK(ring.length[rb_find_block(&ring, a)] == RB_MAG_MIN_SIZE);
+	CHECK(rb_read(&ring, a, out, LARGE) == 10);
+	CHECK(memcmp(out, data, 10) == 0);
+
+	/* Freed into the magazine: still taken from the pool, and handed straight back */
+	CHECK(rb_free_cached(&ring, &mine, a) == 0);
+	CHECK(mine.count[0] == 1);
+	CHECK(free_bytes(&ring) == STORAGE - RB_MAG_MIN_SIZE);
+
+	/* A parked block is no longer reachable through its old handle */
+	CHECK(rb_find_block(&ring, a) == -1);
+	CHECK(rb_read(&ring, a, out, LARGE) == -1);
+	CHECK(rb_retain(&ring, a) == -1);
+	CHECK(rb_release(&ring, a) == -1);
+	CHECK(rb_free_cached(&ring, &mine, a) == -1);
+	CHECK(mine.count[0] == 1);
+
+	b = rb_write_cached(&ring, &mine, data, 12);
+	CHECK(b == a);
+	CHECK(mine.count[0] == 0);
+	CHECK(rb_read(&ring, b, out, LARGE) == 12);
+
+	/* A block written through one magazine may be freed into another */
+	CHECK(rb_free_cached(&ring, &other, b) == 0);
+	CHECK(other.count[0] == 1 && mine.count[0] == 0);
+	c = rb_write_cached(&ring, &other, data, 16);
+	CHECK(c == a);
+	CHECK(rb_free_cached(&ring, &other, c) == 0);
+
+	/* Blocks too large for a class, or with references left, bypass the magazine */
+	a = rb_write_cached(&ring, &mine, data, LARGE + 100);
+	CHECK(a >= 0);
+	CHECK(rb_free_cached(&ring, &mine, a) == 0);
+	CHECK(rb_find_block(&ring, a) == -1);
+	a = rb_write_cached(&ring, &mine, data, 30);
+	CHECK(rb_retain(&ring, a) == 0);
+	CHECK(rb_free_cached(&ring, &mine, a) == 0);
+	CHECK(mine.count[1] == 0);
+	CHECK(rb_free_cached(&ring, &mine, a) == 0);
+	CHECK(mine.count[1] == 1);
+
+	/* Draining gives everything back */
+	rb_magazine_drain(&ring, &mine);
+	rb_magazine_drain(&ring, &other);
+	CHECK(mine.count[1] == 0 && other.count[0] == 0);
+	CHECK(free_bytes(&ring) == STORAGE);
+	CHECK(manifest_blocks(&ring) == 1);
+
+	/* A full magazine holding the pool's metablocks is drained when the pool runs dry */
+	for (n = 0; n < MAX_ITEMS; n++) {
+		if ((h[n] = rb_write_cached(&ring, &mine, data, RB_MAG_MIN_SIZE)) < 0) {
+			break;
+		}
+	}
+	CHECK(n > RB_MAG_DEPTH);
+	for (i = 0; i < RB_MAG_DEPTH; i++) {
+		CHECK(rb_free_cached(&ring, &mine, h[i]) == 0);
+	}
+	CHECK(mine.count[0] == RB_MAG_DEPTH);
+	a = rb_write_cached(&ring, &mine, data, 2 * RB_MAG_MIN_SIZE);
+	CHECK(a >= 0);
+	CHECK(mine.count[0] == 0);
+
+	CHECK(rb_free(&ring, a) == 0);
+	for (; i < n; i++) {
+		CHECK(rb_free(&ring, h[i]) == 0);
+	}
+	CHECK(free_bytes(&ring) == STORAGE);
+}
+
+
+#ifdef USING_TIME
+static void test_sojourn(void)
+{
+	struct rb_magazine mag;
+	struct rb_histogram snap;
+	rb_off a, b, c;
+	char * p;
+
+	rb_init_ex(&ring, storage, STORAGE);
+	rb_magazine_init(&mag);
+	memset(data, 's', LARGE);
+
+	/* One sample when the last reference goes, not before */
+	rb_test_clock = 1000;
+	a = rb_write(&ring, data, LARGE);
+	rb_test_clock = 1500;
+	CHECK(rb_free(&ring, a) == 0);
+
+	rb_test_clock = 2000;
+	b = rb_write(&ring, data, LARGE);
+	CHECK(rb_retain(&ring, b) == 0);
+	rb_test_clock = 2100;
+	CHECK(rb_free(&ring, b) == 0);
+	rb_sojourn(&ring, &snap);
+	CHECK(snap.total == 1);
+	rb_test_clock = 2300;
+	CHECK(rb_release(&ring, b) == 0);
+
+	/* Through a magazine, and restamped when the cached block is reused */
+	rb_test_clock = 3000;
+	c = rb_write_cached(&ring, &mag, data, 20);
+	rb_test_clock = 3040;
+	CHECK(rb_free_cached(&ring, &mag, c) == 0);
+	rb_test_clock = 5000;
+	c = rb_write_cached(&ring, &mag, data, 20);
+	rb_test_clock = 5010;
+	CHECK(rb_free_cached(&ring, &mag, c) == 0);
+	rb_magazine_drain(&ring, &mag);
+
+	/* A slab object counts when its last reference goes, like a block */
+	rb_test_clock = 6000;
+	c = rb_write(&ring, data, 8);
+	CHECK(rb_find_block(&ring, c) == -1);
+	CHECK(rb_retain(&ring, c) == 0);
+	CHECK(rb_free(&ring, c) == 0);
+	rb_test_clock = 6070;
+	CHECK(rb_release(&ring, c) == 0);
+
+	/* A reservation abandoned before rb_commit was never stamped: no sample */
+	c = rb_alloc(&ring, LARGE, 8, &p);
+	CHECK(c >= 0);
+	rb_test_clock = 9000;
+	CHECK(rb_free(&ring, c) == 0);
+
+	rb_sojourn(&ring, &snap);
+	CHECK(snap.total == 5);
+	CHECK(snap.sum == 500 + 300 + 40 + 10 + 70);
+	CHECK(snap.max == 500);
+	CHECK(rb_hist_percentile(&snap, 20) == 10);
+	CHECK(free_bytes(&ring) == STORAGE - RB_SLAB_OBJECTS * RB_SLAB_MIN_SIZE);
+}
+
+
+static void test_expiry(void)
+{
+	char out[LARGE];
+	rb_off a, b, c, h[40];
+	int i, n;
+
+	rb_init_ex(&ring, storage, STORAGE);
+	memset(data, 'e', STORAGE);
+
+	/* No ttl: nothing expires */
+	rb_test_clock = 0;
+	a = rb_write(&ring, data, LARGE);
+	CHECK(rb_expire(&ring, 1000000) == 0);
+	CHECK(rb_free(&ring, a) == 0);
+
+	/* Oldest first, stopping at the first block still within its ttl */
+	rb_set_expiry(&ring, 100, 0);
+	rb_test_clock = 0;
+	a = rb_write(&ring, data, LARGE);
+	rb_test_clock = 10;
+	b = rb_write(&ring, data, LARGE);
+	rb_test_clock = 50;
+	c = rb_write(&ring, data, LARGE);
+	CHECK(rb_find_block(&ring, a) >= 0);
+	CHECK(rb_expire(&ring, 99) == 0);
+	CHECK(rb_expire(&ring, 105) == 1);
+	CHECK(rb_find_block(&ring, a) == -1);
+	CHECK(rb_find_block(&ring, b) >= 0);
+
+	/* A reader's reference keeps an expired block's data */
+	CHECK(rb_retain(&ring, c) == 0);
+	CHECK(rb_expire(&ring, 200) == 2);
+	CHECK(rb_find_block(&ring, b) == -1);
+	CHECK(rb_read(&ring, c, out, LARGE) == LARGE);
+	CHECK(rb_expire(&ring, 300) == 0);
+	CHECK(rb_release(&ring, c) == 0);
+	CHECK(rb_find_block(&ring, c) == -1);
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* Eviction: a full cache drops its oldest blocks to make room */
+	rb_set_expiry(&ring, 0, 1);
+	for (n = 0; n < 40; n++) {
+		rb_test_clock = n;
+		data[0] = (char)n;
+		h[n] = rb_write(&ring, data, 1000);
+		CHECK(h[n] >= 0);
+	}
+	CHECK(rb_find_block(&ring, h[0]) == -1);
+	CHECK(rb_find_block(&ring, h[35]) == -1);
+	for (i = 37; i < 40; i++) {
+		CHECK(rb_read(&ring, h[i], out, 1) == 1 && out[0] == (char)i);
+	}
+
+	/* Small writes are blocks of their own in a cache (slab objects are not aged) */
+	a = rb_write(&ring, data, 8);
+	CHECK(rb_find_block(&ring, a) >= 0);
+
+	/* A block a reader holds is passed over: it is off the age list */
+	CHECK(rb_retain(&ring, h[39]) == 0);
+	for (n = 0; n < 10; n++) {
+		CHECK(rb_write(&ring, data, 1000) >= 0);
+	}
+	CHECK(rb_read(&ring, h[39], out, 1) == 1 && out[0] == (char)39);
+	CHECK(rb_release(&ring, h[39]) == 0);
+	CHECK(rb_find_block(&ring, h[39]) == -1);
+
+	/* More than the whole buffer cannot be had by evicting */
+	CHECK(rb_write(&ring, data, STORAGE + 1) == -1);
+
+	rb_set_expiry(&ring, 0, 0);
+}
+#endif
+
+
+#ifdef USING_REGION
+static void test_trim(void)
+{
+	struct rb_region region;
+	char out[LARGE], * p;
+	rb_off a, b;
+
+	CHECK(rb_region_map(&region, 1024UL * 1024, RB_MEM_LAZY, 0) == 0);
+	rb_region_set_trim(&region, 10);
+	CHECK(rb_init_ex(&ring, region.base, (rb_off)region.size) == 0);
+	memset(data, 'k', LARGE);
+
+	/* The first call counts the whole ring as just used */
+	CHECK(rb_trim(&ring, &region, 0) == 0);
+
+	a = rb_alloc(&ring, 4 * (rb_off)region.chunk, 0, &p);
+	CHECK(a == 0);
+	memset(p, 1, 4 * region.chunk);
+	CHECK(rb_commit(&ring, a, 4 * (rb_off)region.chunk) == 0);
+	b = rb_write(&ring, data, LARGE);
+	CHECK(b == 4 * (rb_off)region.chunk);
+	CHECK(rb_free(&ring, a) == 0);
+
+	/* Chunks of freed blocks go back; the chunk of the block in use stays */
+	CHECK(rb_trim(&ring, &region, 5) == 0);
+	CHECK(rb_trim(&ring, &region, 100) == region.mapped - region.chunk);
+	CHECK(rb_region_resident(&region) <= region.chunk);
+	CHECK(rb_read(&ring, b, out, LARGE) == LARGE);
+	CHECK(memcmp(out, data, LARGE) == 0);
+
+	/* A block handed out after a trim is live for the next one, even if freed since */
+	a = rb_alloc(&ring, 2 * (rb_off)region.chunk, 0, &p);
+	CHECK(a >= 0);
+	memset(p, 2, 2 * region.chunk);
+	CHECK(rb_free(&ring, a) == 0);
+	CHECK(rb_trim(&ring, &region, 105) == 0);
+	CHECK(rb_trim(&ring, &region, 200) >= 2 * region.chunk);
+	CHECK(rb_free(&ring, b) == 0);
+
+	rb_region_unmap(&region);
+}
+#endif
+
+
+#ifdef USING_THREADS
+#define THREADS		4
+#define ROUNDS		20000
+#define SLOTS		4
+
+static rb_off slot[SLOTS];	/* blocks passed between threads, -1 if empty */
+static int written[THREADS];
+
+
+/**
+ * check_block - every byte of a block holds its length
+ */
+static void check_block(rb_off h)
+{
+	unsigned char out[256];
+	rb_off n, k;
+
+	n = rb_read(&ring, h, (char *)out, sizeof(out));
+	CHECK(n > 0 && n == out[0]);
+	for (k = 1; k < n; k++) {
+		if (out[k] != out[0]) {
+			CHECK(out[k] == out[0]);
+			break;
+		}
+	}
+}
+
+
+/**
+ * churn - write blocks of many sizes and pass each one on; free whatever
+ *         another thread passed in, into this thread's magazine
+ */
+static void * churn(void * arg)
+{
+	struct rb_magazine mag;
+	unsigned char src[256];
+	rb_off h, len;
+	int t = (int)(long)arg, i;
+
+	rb_magazine_init(&mag);
+
+	for (i = 0; i < ROUNDS; i++) {
+		len = 1 + (i * 7 + t * 13) % 200;
+		memset(src, (int)len, len);
+
+		if ((h = rb_write_cached(&ring, &mag, (const char *)src, len)) < 0) {
+			sched_yield();
+			continue;
+		}
+		written[t]++;
+		check_block(h);
+
+		h = __sync_lock_test_and_set(&slot[(i + t) % SLOTS], h);
+		if (h >= 0) {
+			check_block(h);
+			CHECK(rb_free_cached(&ring, &mag, h) == 0);
+		}
+	}
+
+	rb_magazine_drain(&ring, &mag);
+	return NULL;
+}
+
+
+static void test_threads(void)
+{
+	pthread_t th[THREADS];
+	int t, s;
+
+	rb_init_ex(&ring, storage, STORAGE);
+	for (s = 0; s < SLOTS; s++) {
+		slot[s] = -1;
+	}
+
+	for (t = 0; t < THREADS; t++) {
+		CHECK(pthread_create(&th[t], NULL, churn, (void *)(long)t) == 0);
+	}
+	for (t = 0; t < THREADS; t++) {
+		pthread_join(th[t], NULL);
+		CHECK(written[t] > 0);	/* no thread shut out for good */
+	}
+
+	for (s = 0; s < SLOTS; s++) {
+		if (slot[s] >= 0) {
+			check_block(slot[s]);
+			CHECK(rb_free(&ring, slot[s]) == 0);
+		}
+	}
+	CHECK(free_bytes(&ring) == STORAGE);
+	CHECK(manifest_blocks(&ring) == 1);
+}
+
+/**
+ * wait_arg - one caller parked in rb_write_timed or rb_alloc_wait
+ */
+struct wait_arg {
+	rb_off length;
+	int alloc;		/* rb_alloc_wait (filled with 'w' and committed) instead of rb_write_timed */
+	rb_off result;
+	int order;		/* place among the waiters that got their block */
+};
+
+static int wait_order;
+
+
+static void * wait_for_room(void * arg)
+{
+	struct wait_arg * w = (struct wait_arg *)arg;
+	char * p;
+
+	if (w->alloc) {
+		w->result = rb_alloc_wait(&ring, w->length, 1, &p, -1);
+		if (w->result >= 0) {
+			memset(p, 'w', w->length);
+			rb_commit(&ring, w->result, w->length);
+		}
+	} else {
+		w->result = rb_write_timed(&ring, data, w->length, -1);
+	}
+	w->order = __sync_fetch_and_add(&wait_order, 1);
+	return NULL;
+}
+
+
+/**
+ * waiters - number of callers queued for room
+ */
+static int waiters(void)
+{
+	struct rb_waiter * w;
+	int n = 0;
+
+	RB_LOCK(&ring.lock);
+	for (w = ring.wait_head; w != NULL; w = w->next) {
+		n++;
+	}
+	RB_UNLOCK(&ring.lock);
+	return n;
+}
+
+
+static void await_waiters(int n)
+{
+	while (waiters() < n) {
+		sched_yield();
+	}
+}
+
+
+static void test_waiting(void)
+{
+	struct wait_arg big, small;
+	struct rb_magazine mag;
+	pthread_t tb, ts;
+	rb_off h[16];
+	char out[1024], * p;
+	int n, k;
+
+	/* Full: no wait, a timeout, a length that can never fit */
+	rb_init_ex(&ring, storage, STORAGE);
+	h[0] = rb_write(&ring, data, STORAGE);
+	CHECK(h[0] >= 0);
+	CHECK(rb_write_timed(&ring, data, LARGE, 0) == -1);
+	CHECK(rb_write_timed(&ring, data, LARGE, 20) == -1);
+	CHECK(rb_alloc_wait(&ring, LARGE, 8, &p, 20) == -1);
+	CHECK(rb_write_timed(&ring, data, STORAGE + 1, -1) == -1);
+	CHECK(rb_alloc_wait(&ring, LARGE, 48, &p, -1) == -3);
+	CHECK(ring.wait_head == NULL);
+
+	/* Aligned, it can never fit past the padding to the first aligned address: not queued */
+	rb_init_ex(&ring, storage + 1, STORAGE - 1);
+	CHECK(rb_alloc_wait(&ring, STORAGE - 1, 2, &p, -1) == -1);
+	CHECK(ring.wait_head == NULL);
+	rb_init_ex(&ring, storage, STORAGE);
+	h[0] = rb_write(&ring, data, STORAGE);
+
+	/* Room made by another thread */
+	small.length = LARGE;
+	small.alloc = 0;
+	CHECK(pthread_create(&ts, NULL, wait_for_room, &small) == 0);
+	await_waiters(1);
+	CHECK(rb_free(&ring, h[0]) == 0);
+	pthread_join(ts, NULL);
+	CHECK(small.result >= 0);
+	CHECK(rb_read(&ring, small.result, out, sizeof(out)) == LARGE);
+	CHECK(rb_free(&ring, small.result) == 0);
+	CHECK(ring.wait_head == NULL && free_bytes(&ring) == STORAGE);
+
+	/* A large waiter at the head is served before a small one behind it,
+	   and neither waiter nor plain writer takes the room it waits for */
+	n = fill(&ring, h, 16, 400);
+	CHECK(n == STORAGE / 400);
+	wait_order = 0;
+	big.length = 800;
+	big.alloc = 1;
+	CHECK(pthread_create(&tb, NULL, wait_for_room, &big) == 0);
+	await_waiters(1);
+	small.length = LARGE;
+	small.alloc = 0;
+	CHECK(pthread_create(&ts, NULL, wait_for_room, &small) == 0);
+	await_waiters(2);
+
+	CHECK(rb_free(&ring, h[0]) == 0);
+	for (k = 0; k < 1000; k++) {
+		sched_yield();
+	}
+	CHECK(waiters() == 2);
+	CHECK(rb_write(&ring, data, LARGE) == -1);
+
+	CHECK(rb_free(&ring, h[1]) == 0);
+	pthread_join(tb, NULL);
+	CHECK(big.result >= 0 && big.order == 0);
+	CHECK(rb_read(&ring, big.result, out, sizeof(out)) == 800);
+	CHECK(out[0] == 'w' && out[799] == 'w');
+	CHECK(waiters() == 1);
+
+	CHECK(rb_free(&ring, h[2]) == 0);
+	pthread_join(ts, NULL);
+	CHECK(small.result >= 0 && small.order == 1);
+	CHECK(ring.wait_head == NULL);
+
+	CHECK(rb_free(&ring, big.result) == 0);
+	CHECK(rb_free(&ring, small.result) == 0);
+	for (k = 3; k < n; k++) {
+		CHECK(rb_free(&ring, h[k]) == 0);
+	}
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* Only the largest free block is kept for the head waiter: other free blocks stay usable */
+	n = fill(&ring, h, 16, 400);
+	big.length = 1200;
+	big.alloc = 0;
+	CHECK(pthread_create(&tb, NULL, wait_for_room, &big) == 0);
+	await_waiters(1);
+	CHECK(rb_free(&ring, h[0]) == 0);
+	CHECK(rb_free(&ring, h[1]) == 0);
+	CHECK(rb_free(&ring, h[5]) == 0);
+	h[5] = rb_write(&ring, data, LARGE);
+	CHECK(h[5] >= 0 && rb_read(&ring, h[5], out, sizeof(out)) == LARGE);
+	CHECK(rb_write(&ring, data, 500) == -1);
+	CHECK(waiters() == 1);
+	CHECK(rb_free(&ring, h[2]) == 0);
+	pthread_join(tb, NULL);
+	CHECK(big.result >= 0 && waiters() == 0);
+	CHECK(rb_free(&ring, big.result) == 0);
+	for (k = 3; k < n; k++) {
+		CHECK(rb_free(&ring, h[k]) == 0);
+	}
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* The last empty slab of a class is not kept while someone waits */
+	h[0] = rb_write(&ring, data, RB_SLAB_MIN_SIZE);
+	n = fill(&ring, h + 1, 15, 400);
+	big.length = free_bytes(&ring) + RB_SLAB_MIN_SIZE * RB_SLAB_OBJECTS;
+	CHECK(pthread_create(&tb, NULL, wait_for_room, &big) == 0);
+	await_waiters(1);
+	CHECK(rb_free(&ring, h[0]) == 0);
+	pthread_join(tb, NULL);
+	CHECK(big.result >= 0);
+	CHECK(rb_free(&ring, big.result) == 0);
+	for (k = 1; k <= n; k++) {
+		CHECK(rb_free(&ring, h[k]) == 0);
+	}
+	CHECK(free_bytes(&ring) == STORAGE);
+
+	/* Nor is a block parked in a magazine */
+	rb_magazine_init(&mag);
+	h[0] = rb_write_cached(&ring, &mag, data, RB_MAG_MIN_SIZE << (RB_MAG_CLASSES - 1));
+	n = fill(&ring, h + 1, 15, 400);
+	big.length = free_bytes(&ring) + (RB_MAG_MIN_SIZE << (RB_MAG_CLASSES - 1));
+	CHECK(pthread_create(&tb, NULL, wait_for_room, &big) == 0);
+	await_waiters(1);
+	CHECK(rb_free_cached(&ring, &mag, h[0]) == 0);
+	CHECK(mag.count[RB_MAG_CLASSES - 1] == 0);
+	pthread_join(tb, NULL);
+	CHECK(big.result >= 0);
+	CHECK(rb_free(&ring, big.result) == 0);
+	for (k = 1; k <= n; k++) {
+		CHECK(rb_free(&ring, h[k]) == 0);
+	}
+	CHECK(free_bytes(&ring) == STORAGE);
+}
+#endif
+
+
+int main(void)
+{
+	test_metablock_pool();
+	test_alloc_commit();
+	test_views();
+	test_references();
+	test_slabs();
+	test_free_many();
+	test_fifo();
+	test_magazines();
+#ifdef USING_TIME
+	test_sojourn();
+	test_expiry();
+#endif
+#ifdef USING_REGION
+	test_trim();
+#endif
+#ifdef USING_THREADS
+	test_threads();
+	test_waiting();
+#endif
+
+#ifdef USING_THREADS
+	return check_done("test_ring_mm_mt");
+#else
+	return check_done("test_ring_mm");
+#endif
+}
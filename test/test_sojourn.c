@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "../src/rb_histogram.h"
+#include "../lib_RingBuffer.h"
+#include "check.h"
+
+unsigned long long rb_test_clock;	/* RB_NOW() for this build */
+
+
+static void test_histogram(void)
+{
+	struct rb_histogram live, snap;
+	unsigned long long v, p;
+
+	rb_hist_init(&live);
+	rb_hist_snapshot(&live, &snap);
+	CHECK(snap.total == 0);
+	CHECK(rb_hist_percentile(&snap, 50) == 0);
+
+	for (v = 1; v <= 1000; v++) {
+		rb_hist_record(&live, v);
+	}
+	rb_hist_snapshot(&live, &snap);
+	CHECK(snap.total == 1000);
+	CHECK(snap.sum == 500500);
+	CHECK(snap.max == 1000);
+
+	/* Within one sub-bucket (1/RB_HIST_SUB_COUNT) above the true value */
+	p = rb_hist_percentile(&snap, 50);
+	CHECK(p >= 500 && p <= 500 + 500 / RB_HIST_SUB_COUNT);
+	p = rb_hist_percentile(&snap, 99);
+	CHECK(p >= 990 && p <= 1000);
+	CHECK(rb_hist_percentile(&snap, 100) == 1000);
+
+	/* Small values get a bucket each */
+	CHECK(rb_hist_percentile(&snap, 0.1) == 1);
+
+	/* The whole 64-bit range */
+	rb_hist_init(&live);
+	rb_hist_record(&live, 0);
+	rb_hist_record(&live, ~0ULL);
+	rb_hist_snapshot(&live, &snap);
+	CHECK(snap.total == 2);
+	CHECK(rb_hist_percentile(&snap, 50) == 0);
+	CHECK(rb_hist_percentile(&snap, 100) == ~0ULL);
+}
+
+
+static void test_rb_buffer(void)
+{
+	struct RB_Buffer buf;
+	struct rb_histogram snap;
+	struct RB_View view;
+	char out[64];
+
+	RB_init(&buf);
+
+	/* One sample per record, write to read */
+	rb_test_clock = 100;
+	CHECK(RB_write(&buf, "first", 5) == 5);
+	rb_test_clock = 150;
+	CHECK(RB_write(&buf, "second", 6) == 6);
+	RB_GetSojourn(&buf, &snap);
+	CHECK(snap.total == 0);
+
+	rb_test_clock = 350;
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 5);
+	CHECK(RB_DropItem(&buf) == 6);
+	RB_GetSojourn(&buf, &snap);
+	CHECK(snap.total == 2);
+	CHECK(snap.sum == 250 + 200);
+	CHECK(snap.max == 250);
+
+	/* Peeking does not count */
+	CHECK(RB_write(&buf, "x", 1) == 1);
+	CHECK(RB_PeekItem(&buf, 0, &view) == 1);
+	RB_GetSojourn(&buf, &snap);
+	CHECK(snap.total == 2);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 1);
+
+	/* A frame is one sample, from when it was opened until its last record is read */
+	RB_SetCoalesce(&buf, 32, 1000);
+	rb_test_clock = 1000;
+	CHECK(RB_write(&buf, "ab", 2) == 2);
+	rb_test_clock = 1100;
+	CHECK(RB_write(&buf, "cd", 2) == 2);
+	RB_FlushFrame(&buf);
+	rb_test_clock = 1400;
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 2);
+	RB_GetSojourn(&buf, &snap);
+	CHECK(snap.total == 3);
+	CHECK(RB_ReadItem(&buf, out, sizeof(out)) == 2);
+	RB_GetSojourn(&buf, &snap);
+	CHECK(snap.total == 4);
+	CHECK(snap.max == 400);
+}
+
+
+int main(void)
+{
+	test_histogram();
+	test_rb_buffer();
+
+	return check_done("test_sojourn");
+}